@@ -0,0 +1,12 @@
+# for the openFrameworks project generator
+
+meta:
+	ADDON_NAME = ofxMidiFileLoader
+	ADDON_DESCRIPTION = loads midi files, including .mid.gz files and zip archives of them
+
+common:
+	# gzip and zip members are inflated by src/MIDIInflate.cpp, so there are no libraries to link
+	# the example app isn't part of the addon
+	ADDON_SOURCES_EXCLUDE = src/testApp.cpp
+	ADDON_SOURCES_EXCLUDE += src/testApp.h
+	ADDON_SOURCES_EXCLUDE += src/main.cpp
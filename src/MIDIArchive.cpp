@@ -0,0 +1,337 @@
+/*
+ *  MIDIArchive.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#include "MIDIArchive.h"
+#include "MIDIInflate.h"
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+static inline uint16_t get16(const unsigned char* p){
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get32(const unsigned char* p){
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t get64(const unsigned char* p){
+	return get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+bool MIDIGzip::isGzip(const void* data, size_t size){
+	const unsigned char* p = (const unsigned char*)data;
+	return size >= 2 && p[0] == 0x1f && p[1] == 0x8b;
+}
+
+bool MIDIGzip::isGzip(std::istream& in){
+	if (in.peek() != 0x1f){
+		in.clear();
+		return false;
+	}
+	in.get();
+	bool gzip = in.peek() == 0x8b;
+	in.clear();
+	in.unget();
+	return gzip;
+}
+
+//skips a gzip member's header (RFC 1952) - the optional extra field, name and comment are of no use here
+static MIDIInflateResult skipGzipHeader(MIDIInflateInput& in){
+	unsigned char header[10];
+	if (!in.read(header, sizeof(header)))
+		return MIDI_INFLATE_BAD_DATA;
+	if (header[0] != 0x1f || header[1] != 0x8b || header[2] != 8 || (header[3] & 0xE0))
+		return MIDI_INFLATE_BAD_DATA;
+
+	int flags = header[3];
+	if (flags & 4){
+		unsigned char length[2];
+		if (!in.read(length, 2) || !in.skip(get16(length)))
+			return MIDI_INFLATE_BAD_DATA;
+	}
+	for (int text = 8; text <= 16; text <<= 1){
+		if (!(flags & text))
+			continue;
+		unsigned char c;
+		do {
+			if (!in.get(c))
+				return MIDI_INFLATE_BAD_DATA;
+		} while (c != 0);
+	}
+	if ((flags & 2) && !in.skip(2))
+		return MIDI_INFLATE_BAD_DATA;
+	return MIDI_INFLATE_OK;
+}
+
+//every member in turn, each checked against the CRC and length in its trailer
+static MIDIInflateResult inflateGzip(MIDIInflateInput& in, std::vector<char>& out, size_t maxBytes){
+	out.clear();
+	size_t produced = 0;
+	MIDIInflateResult result = MIDI_INFLATE_OK;
+
+	for (;;){
+		size_t memberStart = produced;
+		result = skipGzipHeader(in);
+		if (result == MIDI_INFLATE_OK)
+			result = midiInflateRaw(in, out, produced, maxBytes);
+		if (result != MIDI_INFLATE_OK)
+			break;
+
+		unsigned char trailer[8];
+		if (!in.read(trailer, sizeof(trailer))){
+			result = MIDI_INFLATE_BAD_DATA;//cut short
+			break;
+		}
+		uint32_t crc = midiCrc32(0, out.empty() ? 0 : &out[memberStart], produced - memberStart);
+		if (get32(trailer) != crc || get32(trailer + 4) != (uint32_t)(produced - memberStart)){
+			result = MIDI_INFLATE_BAD_DATA;
+			break;
+		}
+
+		//gzip files can be several members end to end - anything else after is ignored
+		unsigned char magic[2];
+		if (!in.peek(magic, 2) || !MIDIGzip::isGzip(magic, 2))
+			break;
+	}
+
+	if (in.failed())
+		result = MIDI_INFLATE_NOT_READABLE;
+	out.resize(result == MIDI_INFLATE_OK ? produced : 0);
+	return result;
+}
+
+MIDIInflateResult MIDIGzip::inflate(const void* data, size_t size, std::vector<char>& out, size_t maxBytes){
+	MIDIInflateInput input(data, size);
+	return inflateGzip(input, out, maxBytes);
+}
+
+MIDIInflateResult MIDIGzip::inflate(std::istream& in, std::vector<char>& out, size_t maxBytes){
+	MIDIInflateInput input(in);
+	MIDIInflateResult result = inflateGzip(input, out, maxBytes);
+	in.clear();
+	return result;
+}
+
+
+bool MIDIZipArchive::open(const std::string& archivePath){
+	path.clear();
+	archiveSize = 0;
+	members.clear();
+
+	std::ifstream file(archivePath.c_str(), std::ios::in | std::ios::binary);
+	if (!file || !file.seekg(0, std::ios::end))
+		return false;
+	uint64_t fileSize = (uint64_t)file.tellg();
+
+	//the end of central directory record is at the back, before a comment of up to 64k
+	size_t tailSize = (size_t)std::min<uint64_t>(fileSize, 22 + 65535);
+	std::vector<unsigned char> tail(tailSize);
+	file.seekg(fileSize - tailSize);
+	if (tailSize == 0 || !file.read((char*)&tail[0], tailSize))
+		return false;
+
+	size_t end = tailSize;
+	for (size_t i = tailSize >= 22 ? tailSize - 22 + 1 : 0; i-- > 0; ){
+		if (get32(&tail[i]) == 0x06054b50){
+			end = i;
+			break;
+		}
+	}
+	if (end == tailSize)
+		return false;
+
+	uint64_t count = get16(&tail[end + 10]);
+	uint64_t directorySize = get32(&tail[end + 12]);
+	uint64_t directoryOffset = get32(&tail[end + 16]);
+
+	//zip64 - the real numbers are in another record, found through the locator just before this one
+	if (count == 0xffff || directorySize == 0xffffffff || directoryOffset == 0xffffffff){
+		if (end < 20 || get32(&tail[end - 20]) != 0x07064b50)
+			return false;
+		unsigned char record[56];
+		file.seekg(get64(&tail[end - 20 + 8]));
+		if (!file.read((char*)record, sizeof(record)) || get32(record) != 0x06064b50)
+			return false;
+		count = get64(record + 32);
+		directorySize = get64(record + 40);
+		directoryOffset = get64(record + 48);
+	}
+
+	if (directoryOffset > fileSize || directorySize > fileSize - directoryOffset)
+		return false;
+
+	if (!readDirectory(file, directoryOffset, directorySize, count))
+		return false;
+
+	path = archivePath;
+	archiveSize = fileSize;
+	return true;
+}
+
+bool MIDIZipArchive::readDirectory(std::istream& file, uint64_t offset, uint64_t size, uint64_t count){
+	std::vector<unsigned char> directory((size_t)size);
+	file.seekg(offset);
+	if (size > 0 && !file.read((char*)&directory[0], size))
+		return false;
+
+	members.reserve((size_t)std::min<uint64_t>(count, size / 46));//46 bytes is the smallest entry
+
+	size_t pos = 0;
+	while (pos + 46 <= directory.size() && get32(&directory[pos]) == 0x02014b50){
+		const unsigned char* p = &directory[pos];
+		size_t nameLength = get16(p + 28);
+		size_t extraLength = get16(p + 30);
+		size_t commentLength = get16(p + 32);
+		if (pos + 46 + nameLength + extraLength + commentLength > directory.size())
+			return false;
+
+		MIDIZipMember member;
+		member.flags = get16(p + 8);
+		member.method = get16(p + 10);
+		member.crc = get32(p + 16);
+		member.compressedSize = get32(p + 20);
+		member.size = get32(p + 24);
+		member.headerOffset = get32(p + 42);
+		member.name.assign((const char*)p + 46, nameLength);
+
+		//zip64 extra field - holds the 64 bit versions of whichever of these overflowed, in this order
+		const unsigned char* extra = p + 46 + nameLength;
+		const unsigned char* extraEnd = extra + extraLength;
+		while (extra + 4 <= extraEnd){
+			uint16_t id = get16(extra);
+			size_t length = get16(extra + 2);
+			const unsigned char* field = extra + 4;
+			if (field + length > extraEnd)
+				break;
+			if (id == 0x0001){
+				const unsigned char* fieldEnd = field + length;
+				if (member.size == 0xffffffff && field + 8 <= fieldEnd){
+					member.size = get64(field);
+					field += 8;
+				}
+				if (member.compressedSize == 0xffffffff && field + 8 <= fieldEnd){
+					member.compressedSize = get64(field);
+					field += 8;
+				}
+				if (member.headerOffset == 0xffffffff && field + 8 <= fieldEnd)
+					member.headerOffset = get64(field);
+			}
+			extra += 4 + length;
+		}
+
+		members.push_back(member);
+		pos += 46 + nameLength + extraLength + commentLength;
+	}
+	return true;
+}
+
+size_t MIDIZipArchive::findMember(const std::string& name) const{
+	for (size_t i = 0; i < members.size(); i++){
+		if (members[i].name == name)
+			return i;
+	}
+	return members.size();
+}
+
+MIDIInflateResult MIDIZipArchive::read(size_t index, std::vector<char>& out, size_t maxBytes) const{
+	std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+	if (!file){
+		out.clear();
+		return MIDI_INFLATE_NOT_READABLE;
+	}
+	return read(index, file, out, maxBytes);
+}
+
+MIDIInflateResult MIDIZipArchive::read(size_t index, std::istream& file, std::vector<char>& out, size_t maxBytes) const{
+	out.clear();
+	if (index >= members.size())
+		return MIDI_INFLATE_NOT_READABLE;
+
+	const MIDIZipMember& member = members[index];
+	if ((member.flags & 1) || (member.method != 0 && member.method != 8))
+		return MIDI_INFLATE_UNSUPPORTED;
+	if (maxBytes && member.size > maxBytes)
+		return MIDI_INFLATE_TOO_BIG;
+	if (member.headerOffset > archiveSize || member.compressedSize > archiveSize - member.headerOffset)
+		return MIDI_INFLATE_BAD_DATA;
+
+	//the local header's name and extra field can differ from the directory's, so skip by its own lengths
+	unsigned char header[30];
+	file.clear();
+	file.seekg(member.headerOffset);
+	if (!file.read((char*)header, sizeof(header)) || get32(header) != 0x04034b50)
+		return MIDI_INFLATE_BAD_DATA;
+	file.seekg(get16(header + 26) + get16(header + 28), std::ios::cur);
+
+	if (member.method == 0){
+		if (member.size != member.compressedSize)
+			return MIDI_INFLATE_BAD_DATA;
+		out.resize((size_t)member.size);
+		if (member.size > 0 && !file.read(&out[0], out.size())){
+			out.clear();
+			return MIDI_INFLATE_BAD_DATA;
+		}
+	} else {
+		//the buffer grows as the output comes rather than being sized from the directory, so a
+		//member that claims to be huge costs nothing until it's actually inflated that far
+		//and never more than a byte past the size the directory gives (which is within maxBytes) -
+		//any more and the member isn't what it says it is
+		MIDIInflateInput input(file, member.compressedSize);
+		size_t produced = 0;
+		MIDIInflateResult result = midiInflateRaw(input, out, produced, (size_t)member.size + 1);
+		if (result == MIDI_INFLATE_TOO_BIG || (result == MIDI_INFLATE_OK && produced != member.size))
+			result = MIDI_INFLATE_BAD_DATA;
+		if (result != MIDI_INFLATE_OK){
+			out.clear();
+			return result;
+		}
+		out.resize(produced);
+	}
+
+	if (midiCrc32(0, out.empty() ? 0 : &out[0], out.size()) != member.crc){
+		out.clear();
+		return MIDI_INFLATE_BAD_DATA;
+	}
+	return MIDI_INFLATE_OK;
+}
+
+void MIDIZipArchive::readAll(const std::vector<size_t>& indices, const MemberCallback& process, int threads, size_t maxBytes) const{
+	std::vector<size_t> all;
+	if (indices.empty()){
+		for (size_t i = 0; i < members.size(); i++){
+			if (!members[i].isDirectory())
+				all.push_back(i);
+		}
+	}
+	const std::vector<size_t>& chosen = indices.empty() ? all : indices;
+
+	if (threads <= 0)
+		threads = std::thread::hardware_concurrency();
+	if (threads <= 0)
+		threads = 1;
+	if (threads > (int)chosen.size())
+		threads = chosen.size();
+
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++){
+		workers.push_back(std::thread([&](){
+			//own handle on the file, and a buffer that gets reused from member to member
+			std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+			std::vector<char> data;
+			for (size_t i = next++; i < chosen.size(); i = next++){
+				MIDIInflateResult result = file ? read(chosen[i], file, data, maxBytes) : MIDI_INFLATE_NOT_READABLE;
+				process(chosen[i], result, data);
+			}
+		}));
+	}
+	for (int t = 0; t < workers.size(); t++)
+		workers[t].join();
+}
@@ -0,0 +1,82 @@
+/*
+ *  MIDIArchive.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+//reading straight out of .mid.gz files and zip archives, so a compressed corpus never
+//has to be inflated to disk first - the inflating is done here too (MIDIInflate), so there's no library to link
+
+#ifndef MIDI_ARCHIVE
+#define MIDI_ARCHIVE
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <functional>
+#include <stdint.h>
+
+enum MIDIInflateResult {
+	MIDI_INFLATE_OK = 0,
+	MIDI_INFLATE_NOT_READABLE,
+	MIDI_INFLATE_BAD_DATA,//corrupt, truncated or failed its CRC
+	MIDI_INFLATE_TOO_BIG,//would have gone over maxBytes
+	MIDI_INFLATE_UNSUPPORTED//encrypted, or a compression method other than stored or deflate
+};
+
+class MIDIGzip{
+public:
+	static bool isGzip(const void* data, size_t size);
+	static bool isGzip(std::istream& in);//only peeks, the stream is left where it was
+
+	//inflates every member into out (replacing what was there) - maxBytes 0 for no limit
+	static MIDIInflateResult inflate(const void* data, size_t size, std::vector<char>& out, size_t maxBytes = 0);
+	//as it's read, a block at a time, so the compressed file is never held in memory
+	static MIDIInflateResult inflate(std::istream& in, std::vector<char>& out, size_t maxBytes = 0);
+};
+
+struct MIDIZipMember {
+	std::string name;
+	uint16_t method;//0 stored, 8 deflate
+	uint16_t flags;
+	uint32_t crc;
+	uint64_t compressedSize;
+	uint64_t size;
+	uint64_t headerOffset;//of the local header
+
+	bool isDirectory() const { return !name.empty() && name[name.size()-1] == '/'; }
+};
+
+class MIDIZipArchive{
+public:
+	MIDIZipArchive() : archiveSize(0) {}
+
+	//reads just the central directory - members are read from the file when asked for
+	bool open(const std::string& path);
+	bool isOpen() const { return !path.empty(); }
+
+	const std::string& getPath() const { return path; }
+	const std::vector<MIDIZipMember>& getMembers() const { return members; }
+	size_t findMember(const std::string& name) const;//members.size() if it isn't there
+
+	//safe to call from several threads at once - each call opens the file for itself
+	MIDIInflateResult read(size_t index, std::vector<char>& out, size_t maxBytes = 0) const;
+	//reusing an open stream on the archive, for reading members one after another
+	MIDIInflateResult read(size_t index, std::istream& file, std::vector<char>& out, size_t maxBytes = 0) const;
+
+	//inflates the chosen members (all of them if indices is empty) on a pool of threads
+	//and hands each to process, from whichever thread read it - buffers are reused, so copy what's kept
+	typedef std::function<void(size_t index, MIDIInflateResult result, const std::vector<char>& data)> MemberCallback;
+	void readAll(const std::vector<size_t>& indices, const MemberCallback& process, int threads = 0, size_t maxBytes = 0) const;
+
+private:
+	bool readDirectory(std::istream& file, uint64_t offset, uint64_t size, uint64_t count);
+
+	std::string path;
+	uint64_t archiveSize;
+	std::vector<MIDIZipMember> members;
+};
+
+#endif
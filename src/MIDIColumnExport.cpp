@@ -0,0 +1,253 @@
+/*
+ *  MIDIColumnExport.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#include "MIDIColumnExport.h"
+#include "MIDINoteColumns.h"
+#include <cstring>
+
+static bool isLittleEndian(){
+	uint16_t one = 1;
+	return *(uint8_t*)&one == 1;
+}
+
+MIDIBufferedWriter::MIDIBufferedWriter(size_t bufferSize){
+	file = 0;
+	buffer.resize(bufferSize);
+	used = 0;
+	failed = false;
+}
+
+MIDIBufferedWriter::~MIDIBufferedWriter(){
+	close();
+}
+
+bool MIDIBufferedWriter::open(const std::string& path){
+	close();
+	file = fopen(path.c_str(), "wb");
+	used = 0;
+	failed = file == 0;
+	return !failed;
+}
+
+bool MIDIBufferedWriter::close(){
+	if (!file)
+		return !failed;
+	flush();
+	if (fclose(file) != 0)
+		failed = true;
+	file = 0;
+	return !failed;
+}
+
+void MIDIBufferedWriter::flush(){
+	if (file && used > 0 && fwrite(&buffer[0], 1, used, file) != used)
+		failed = true;
+	used = 0;
+}
+
+void MIDIBufferedWriter::write(const void* data, size_t bytes){
+	if (!file)
+		return;
+	const char* bytesIn = (const char*)data;
+	
+	//big writes skip the buffer altogether
+	if (bytes >= buffer.size()){
+		flush();
+		if (fwrite(bytesIn, 1, bytes, file) != bytes)
+			failed = true;
+		return;
+	}
+	
+	if (used + bytes > buffer.size())
+		flush();
+	memcpy(&buffer[used], bytesIn, bytes);
+	used += bytes;
+}
+
+void MIDIBufferedWriter::writeLittleEndian(const void* values, size_t count, size_t valueSize){
+	if (valueSize == 1 || isLittleEndian()){
+		write(values, count * valueSize);
+		return;
+	}
+	
+	const char* in = (const char*)values;
+	char swapped[8];
+	for (size_t i = 0; i < count; i++){
+		for (size_t b = 0; b < valueSize; b++)
+			swapped[b] = in[i * valueSize + valueSize - 1 - b];
+		write(swapped, valueSize);
+	}
+}
+
+void MIDIColumnExport::writeNpyHeader(MIDIBufferedWriter& writer, const char* descr, size_t length){
+	char dictionary[128];
+	int dictionaryLength = snprintf(dictionary, sizeof(dictionary), "{'descr': '%s', 'fortran_order': False, 'shape': (%zu,), }", descr, length);
+	
+	//magic, version 1.0, 2 byte header length, then the dictionary padded with spaces
+	//and a newline so the data starts on a 64 byte boundary
+	const int preamble = 10;
+	int total = preamble + dictionaryLength + 1;
+	int padding = (64 - total % 64) % 64;
+	uint16_t headerLength = dictionaryLength + padding + 1;
+	
+	writer.write("\x93NUMPY\x01\x00", 8);
+	writer.writeLittleEndian(&headerLength, 1, sizeof(headerLength));
+	writer.write(dictionary, dictionaryLength);
+	for (int i = 0; i < padding; i++)
+		writer.write(" ", 1);
+	writer.write("\n", 1);
+}
+
+//one column, gathered from every score in turn
+template <typename T, typename Source>
+static bool writeColumn(MIDIBufferedWriter& writer, const std::string& path, const char* descr,
+						size_t length, const std::vector<Source>& sources, const T* (*column)(const Source&, size_t&)){
+	if (!writer.open(path))
+		return false;
+	MIDIColumnExport::writeNpyHeader(writer, descr, length);
+	for (int i = 0; i < sources.size(); i++){
+		size_t count = 0;
+		const T* values = column(sources[i], count);
+		writer.writeLittleEndian(values, count, sizeof(T));
+	}
+	return writer.close();
+}
+
+//controller and tempo rows, kept as columns as they're gathered
+struct MIDIExportExtras {
+	std::vector<int32_t> controlTicks;
+	std::vector<double> controlMillis;
+	std::vector<uint8_t> controlChannel;
+	std::vector<uint8_t> controlType;//status high nibble: 0xB0 controller, 0xC0 program, 0xD0 pressure, 0xE0 bend
+	std::vector<uint8_t> controlNumber;//controller number, program number, 0 otherwise
+	std::vector<uint16_t> controlValue;//14 bit for pitch bend
+	std::vector<uint32_t> controlFile;
+	
+	std::vector<int32_t> tempoTicks;
+	std::vector<double> tempoMillis;
+	std::vector<double> tempoBeatPeriod;
+	std::vector<uint32_t> tempoFile;
+	
+	void add(const MIDIScore& score, uint32_t file){
+		for (int i = 0; i < score.channelEvents.size(); i++){
+			const MIDIChannelEvent& e = score.channelEvents[i];
+			int type = e.getMessageType();
+			if (type < 0xB0)
+				continue;
+			controlTicks.push_back(e.ticks);
+			controlMillis.push_back(score.ticksToMillis(e.ticks));
+			controlChannel.push_back(e.getChannel());
+			controlType.push_back(type);
+			controlNumber.push_back(type == 0xB0 || type == 0xC0 ? e.data1 : 0);
+			controlValue.push_back(type == 0xE0 ? (e.data2 << 7) | e.data1 : (type == 0xB0 ? e.data2 : (type == 0xD0 ? e.data1 : 0)));
+			controlFile.push_back(file);
+		}
+		for (int i = 0; i < score.tempoMap.size(); i++){
+			tempoTicks.push_back(score.tempoMap[i].ticks);
+			tempoMillis.push_back(score.tempoMap[i].millis);
+			tempoBeatPeriod.push_back(score.tempoMap[i].beatPeriod);
+			tempoFile.push_back(file);
+		}
+	}
+};
+
+struct MIDIExportSource {
+	const MIDINoteColumns* notes;
+	std::vector<uint32_t>* file;
+};
+
+//column accessors for writeColumn
+static const double* onsetMillisColumn(const MIDIExportSource& s, size_t& n){ n = s.notes->size(); return s.notes->onsetMillis; }
+static const double* durationMillisColumn(const MIDIExportSource& s, size_t& n){ n = s.notes->size(); return s.notes->durationMillis; }
+static const int32_t* onsetTicksColumn(const MIDIExportSource& s, size_t& n){ n = s.notes->size(); return s.notes->onsetTicks; }
+static const int32_t* durationTicksColumn(const MIDIExportSource& s, size_t& n){ n = s.notes->size(); return s.notes->durationTicks; }
+static const uint16_t* trackColumn(const MIDIExportSource& s, size_t& n){ n = s.notes->size(); return s.notes->track; }
+static const uint8_t* pitchColumn(const MIDIExportSource& s, size_t& n){ n = s.notes->size(); return s.notes->pitch; }
+static const uint8_t* velocityColumn(const MIDIExportSource& s, size_t& n){ n = s.notes->size(); return s.notes->velocity; }
+static const uint8_t* channelColumn(const MIDIExportSource& s, size_t& n){ n = s.notes->size(); return s.notes->channel; }
+static const uint32_t* fileColumn(const MIDIExportSource& s, size_t& n){ n = s.file->size(); return n ? &(*s.file)[0] : 0; }
+
+//a column that's already all in one vector
+template <typename T>
+static bool writeArray(MIDIBufferedWriter& writer, const std::string& path, const char* descr, const std::vector<T>& values){
+	if (!writer.open(path))
+		return false;
+	MIDIColumnExport::writeNpyHeader(writer, descr, values.size());
+	if (!values.empty())
+		writer.writeLittleEndian(&values[0], values.size(), sizeof(T));
+	return writer.close();
+}
+
+bool MIDIColumnExport::exportScore(const MIDIScore& score, const std::string& prefix, int flags){
+	std::vector<MIDIScorePtr> scores;
+	scores.push_back(MIDIScorePtr(&score, [](const MIDIScore*){}));//borrowed, not owned
+	return exportScores(scores, prefix, flags);
+}
+
+bool MIDIColumnExport::exportScores(const std::vector<MIDIScorePtr>& scores, const std::string& prefix, int flags){
+	MIDIBufferedWriter writer;
+	bool ok = true;
+	
+	FILE* list = fopen((prefix + ".files.txt").c_str(), "w");
+	if (!list)
+		return false;
+	for (int i = 0; i < scores.size(); i++)
+		fprintf(list, "%s\n", scores[i] ? scores[i]->path.c_str() : "");
+	ok = fclose(list) == 0 && ok;
+	
+	if (flags & MIDI_EXPORT_NOTES){
+		//columns for each score, then each output column written straight from them
+		std::vector<MIDINoteColumns> columns(scores.size());
+		std::vector<std::vector<uint32_t> > files(scores.size());
+		std::vector<MIDIExportSource> sources(scores.size());
+		size_t total = 0;
+		for (int i = 0; i < scores.size(); i++){
+			if (scores[i])
+				columns[i].assign(scores[i]->notes);
+			files[i].assign(columns[i].size(), i);
+			sources[i].notes = &columns[i];
+			sources[i].file = &files[i];
+			total += columns[i].size();
+		}
+		
+		ok = writeColumn(writer, prefix + ".onset_ms.npy", "<f8", total, sources, onsetMillisColumn) && ok;
+		ok = writeColumn(writer, prefix + ".duration_ms.npy", "<f8", total, sources, durationMillisColumn) && ok;
+		ok = writeColumn(writer, prefix + ".onset_ticks.npy", "<i4", total, sources, onsetTicksColumn) && ok;
+		ok = writeColumn(writer, prefix + ".duration_ticks.npy", "<i4", total, sources, durationTicksColumn) && ok;
+		ok = writeColumn(writer, prefix + ".track.npy", "<u2", total, sources, trackColumn) && ok;
+		ok = writeColumn(writer, prefix + ".pitch.npy", "|u1", total, sources, pitchColumn) && ok;
+		ok = writeColumn(writer, prefix + ".velocity.npy", "|u1", total, sources, velocityColumn) && ok;
+		ok = writeColumn(writer, prefix + ".channel.npy", "|u1", total, sources, channelColumn) && ok;
+		ok = writeColumn(writer, prefix + ".file.npy", "<u4", total, sources, fileColumn) && ok;
+	}
+	
+	if (flags & (MIDI_EXPORT_CONTROLLERS | MIDI_EXPORT_TEMPO)){
+		MIDIExportExtras extras;
+		for (int i = 0; i < scores.size(); i++){
+			if (scores[i])
+				extras.add(*scores[i], i);
+		}
+		if (flags & MIDI_EXPORT_CONTROLLERS){
+			ok = writeArray(writer, prefix + ".control_ticks.npy", "<i4", extras.controlTicks) && ok;
+			ok = writeArray(writer, prefix + ".control_ms.npy", "<f8", extras.controlMillis) && ok;
+			ok = writeArray(writer, prefix + ".control_channel.npy", "|u1", extras.controlChannel) && ok;
+			ok = writeArray(writer, prefix + ".control_type.npy", "|u1", extras.controlType) && ok;
+			ok = writeArray(writer, prefix + ".control_number.npy", "|u1", extras.controlNumber) && ok;
+			ok = writeArray(writer, prefix + ".control_value.npy", "<u2", extras.controlValue) && ok;
+			ok = writeArray(writer, prefix + ".control_file.npy", "<u4", extras.controlFile) && ok;
+		}
+		if (flags & MIDI_EXPORT_TEMPO){
+			ok = writeArray(writer, prefix + ".tempo_ticks.npy", "<i4", extras.tempoTicks) && ok;
+			ok = writeArray(writer, prefix + ".tempo_ms.npy", "<f8", extras.tempoMillis) && ok;
+			ok = writeArray(writer, prefix + ".tempo_beat_period.npy", "<f8", extras.tempoBeatPeriod) && ok;
+			ok = writeArray(writer, prefix + ".tempo_file.npy", "<u4", extras.tempoFile) && ok;
+		}
+	}
+	
+	return ok;
+}
@@ -0,0 +1,58 @@
+/*
+ *  MIDIColumnExport.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#ifndef MIDI_COLUMN_EXPORT
+#define MIDI_COLUMN_EXPORT
+
+#include "MIDIScore.h"
+#include <string>
+#include <cstdio>
+
+enum MIDIExportFlags {
+	MIDI_EXPORT_NOTES = 1,
+	MIDI_EXPORT_CONTROLLERS = 2,//controllers, pitch bend, pressure and program changes
+	MIDI_EXPORT_TEMPO = 4,
+	MIDI_EXPORT_ALL = 7
+};
+
+//one output file at a time through one big buffer, so the disk sees large sequential writes
+class MIDIBufferedWriter{
+public:
+	MIDIBufferedWriter(size_t bufferSize = 1 << 20);
+	~MIDIBufferedWriter();
+	
+	bool open(const std::string& path);
+	bool close();//flushes, false if anything failed since open
+	
+	void write(const void* data, size_t bytes);
+	//little endian whatever the machine
+	void writeLittleEndian(const void* values, size_t count, size_t valueSize);
+	
+private:
+	void flush();
+	
+	FILE* file;
+	std::vector<char> buffer;
+	size_t used;
+	bool failed;
+};
+
+//numpy .npy arrays, one per column: prefix.pitch.npy, prefix.onset_ms.npy and so on
+//every row also gets the index of the score it came from (prefix.file.npy etc.) and prefix.files.txt lists the paths,
+//so one call can export a single file or a whole batch
+//np.load() reads them straight back, or memory map them with mmap_mode='r'
+
+class MIDIColumnExport{
+public:
+	static bool exportScore(const MIDIScore& score, const std::string& prefix, int flags = MIDI_EXPORT_ALL);
+	static bool exportScores(const std::vector<MIDIScorePtr>& scores, const std::string& prefix, int flags = MIDI_EXPORT_ALL);
+	
+	//the .npy header for a one dimensional array - descr is numpy's type string, e.g. "<f8"
+	static void writeNpyHeader(MIDIBufferedWriter& writer, const char* descr, size_t length);
+};
+#endif
@@ -0,0 +1,165 @@
+/*
+ *  MIDICompressedNotes.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#include "MIDICompressedNotes.h"
+#include "MIDIVarint.h"
+
+MIDICompressedNotes::MIDICompressedNotes(){
+	noteCount = 0;
+}
+
+void MIDICompressedNotes::clear(){
+	blocks.clear();
+	voices.clear();
+	data.clear();
+	noteCount = 0;
+	timing = MIDIScore();
+}
+
+size_t MIDICompressedNotes::bytes() const{
+	return sizeof(*this) + blocks.capacity() * sizeof(Block) + voices.capacity() * sizeof(Voice) + data.capacity()
+		+ timing.tempoMap.capacity() * sizeof(MIDITempoSegment);
+}
+
+void MIDICompressedNotes::compress(const MIDIScore& score){
+	clear();
+	timing.pulsesPerQuarternote = score.pulsesPerQuarternote;
+	timing.tempoMap = score.tempoMap;
+	noteCount = score.notes.size();
+	data.reserve(noteCount * 6);
+	
+	size_t i = 0;
+	while (i < score.notes.size()){
+		Block block;
+		block.firstTicks = score.notes[i].ticks;
+		block.lastTicks = block.firstTicks;
+		block.endTicks = block.firstTicks;
+		block.reachTicks = 0;
+		block.offset = data.size();
+		block.voiceOffset = voices.size();
+		block.count = 0;
+		block.voiceCount = 0;
+		
+		int lastTicks = block.firstTicks;
+		int lastVelocity = -1;
+		long lastDuration = -1;
+		
+		for (; i < score.notes.size() && block.count < maxBlockNotes; i++){
+			const noteData& note = score.notes[i];
+			
+			//find or add the voice, close the block if it's full of them
+			int voice = 0;
+			while (voice < block.voiceCount && !(voices[block.voiceOffset + voice].track == note.track && voices[block.voiceOffset + voice].channel == note.channel))
+				voice++;
+			if (voice == block.voiceCount){
+				if (block.voiceCount == maxBlockVoices)
+					break;
+				Voice v;
+				v.track = note.track;
+				v.channel = note.channel;
+				voices.push_back(v);
+				block.voiceCount++;
+			}
+			
+			bool velocityFollows = note.velocity != lastVelocity;
+			bool sameDuration = note.durationTicks == lastDuration;
+			data.push_back((note.pitch & 0x7F) | (velocityFollows ? 0x80 : 0));
+			data.push_back(voice | (sameDuration ? 0x80 : 0));
+			writeVarint(data, note.ticks - lastTicks);
+			if (!sameDuration)
+				writeVarint(data, note.durationTicks > 0 ? note.durationTicks : 0);
+			if (velocityFollows)
+				data.push_back(note.velocity & 0x7F);
+			
+			lastTicks = note.ticks;
+			lastVelocity = note.velocity;
+			lastDuration = note.durationTicks;
+			
+			block.lastTicks = note.ticks;
+			long end = note.ticks + (note.durationTicks > 0 ? note.durationTicks : 0);
+			if (end > block.endTicks)
+				block.endTicks = end;
+			block.count++;
+		}
+		block.reachTicks = blocks.empty() || block.endTicks > blocks.back().reachTicks ? block.endTicks : blocks.back().reachTicks;
+		blocks.push_back(block);
+	}
+}
+
+void MIDICompressedNotes::decodeBlock(int b, std::vector<noteData>& notes) const{
+	const Block& block = blocks[b];
+	const uint8_t* bytes = &data[0];
+	const Voice* blockVoices = &voices[block.voiceOffset];
+	size_t position = block.offset;
+	
+	bool constantTempo = timing.tempoMap.size() == 1;
+	
+	size_t first = notes.size();
+	notes.resize(first + block.count);
+	noteData* out = &notes[first];
+	
+	int ticks = block.firstTicks;
+	int velocity = 0;
+	long duration = 0;
+	for (int k = 0; k < block.count; k++){
+		uint8_t pitchByte = bytes[position++];
+		uint8_t voiceByte = bytes[position++];
+		ticks += readVarint(bytes, position);
+		if (!(voiceByte & 0x80))
+			duration = readVarint(bytes, position);
+		if (pitchByte & 0x80)
+			velocity = bytes[position++];
+		
+		noteData& note = out[k];
+		note.pitch = pitchByte & 0x7F;
+		note.ticks = ticks;
+		note.velocity = velocity;
+		note.durationTicks = duration;
+		note.track = blockVoices[voiceByte & 0x7F].track;
+		note.channel = blockVoices[voiceByte & 0x7F].channel;
+		note.beatPosition = ticks / (float) timing.pulsesPerQuarternote;
+		if (constantTempo){
+			note.timeMillis = (timing.tempoMap[0].beatPeriod * ticks) / (double) timing.pulsesPerQuarternote;
+			note.durationMillis = (timing.tempoMap[0].beatPeriod * (ticks + duration)) / (double) timing.pulsesPerQuarternote - note.timeMillis;
+		} else {
+			note.timeMillis = timing.ticksToMillis(ticks);
+			note.durationMillis = timing.durationToMillis(ticks, duration);
+		}
+	}
+}
+
+void MIDICompressedNotes::decodeAll(std::vector<noteData>& notes) const{
+	notes.reserve(notes.size() + noteCount);
+	for (int b = 0; b < blocks.size(); b++)
+		decodeBlock(b, notes);
+}
+
+void MIDICompressedNotes::decodeRange(long startTicks, long endTicks, std::vector<noteData>& notes) const{
+	//reach only goes up, so the first block that could have anything sounding at startTicks is a binary search away
+	int low = 0, high = blocks.size();
+	while (low < high){
+		int mid = (low + high) / 2;
+		if (blocks[mid].reachTicks < startTicks)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	
+	std::vector<noteData> block;
+	for (int b = low; b < blocks.size() && blocks[b].firstTicks < endTicks; b++){
+		if (blocks[b].endTicks < startTicks)
+			continue;
+		block.clear();
+		decodeBlock(b, block);
+		for (int k = 0; k < block.size(); k++){
+			const noteData& note = block[k];
+			if (note.ticks < endTicks && (note.ticks >= startTicks || note.ticks + note.durationTicks > startTicks))
+				notes.push_back(note);
+		}
+	}
+}
@@ -0,0 +1,66 @@
+/*
+ *  MIDICompressedNotes.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#ifndef MIDI_COMPRESSED_NOTES
+#define MIDI_COMPRESSED_NOTES
+
+#include "MIDIScore.h"
+#include <stdint.h>
+
+//a score's notes packed for keeping lots of them resident, typically 5-6 bytes a note instead of 48
+//
+//notes go in blocks of up to 128, each block starting from its own absolute tick so any block decodes on its own
+//per note: pitch byte (top bit: velocity follows), voice byte (which track/channel in the block's table,
+//top bit: same duration as the last note), varint onset delta, varint duration unless repeated, velocity unless repeated
+//millis aren't stored at all - they're worked out again from the tempo map, the same way the loader did it
+
+class MIDICompressedNotes{
+public:
+	MIDICompressedNotes();
+	
+	void compress(const MIDIScore& score);
+	void clear();
+	
+	size_t size() const { return noteCount; }
+	int getNumBlocks() const { return blocks.size(); }
+	size_t bytes() const;//everything held, for comparing with sizeof(noteData) * size()
+	
+	//decoded notes are appended
+	void decodeBlock(int block, std::vector<noteData>& notes) const;
+	void decodeAll(std::vector<noteData>& notes) const;
+	//notes sounding at any point from startTicks up to (not including) endTicks
+	void decodeRange(long startTicks, long endTicks, std::vector<noteData>& notes) const;
+	
+	static const int maxBlockNotes = 128;
+	static const int maxBlockVoices = 128;
+	
+private:
+	struct Block {
+		int32_t firstTicks;//onset of the first note, the first delta is from here
+		int32_t lastTicks;//onset of the last note
+		int32_t endTicks;//latest note end in the block
+		int32_t reachTicks;//latest note end in this block or any before it
+		uint32_t offset;//into data
+		uint32_t voiceOffset;//into voices
+		uint16_t count;
+		uint8_t voiceCount;
+	};
+	
+	struct Voice {
+		uint16_t track;
+		uint8_t channel;
+	};
+	
+	std::vector<Block> blocks;
+	std::vector<Voice> voices;
+	std::vector<uint8_t> data;
+	size_t noteCount;
+	
+	MIDIScore timing;//just the tempo map and ppq
+};
+#endif
@@ -0,0 +1,196 @@
+/*
+ *  MIDICurveStore.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#include "MIDICurveStore.h"
+#include "MIDIVarint.h"
+#include <algorithm>
+
+MIDICurve::MIDICurve(){
+	clear(0);
+}
+
+void MIDICurve::clear(int value){
+	data.clear();
+	blocks.clear();
+	count = 0;
+	defaultValue = value;
+	lastTicks = 0;
+	lastValue = value;
+}
+
+void MIDICurve::add(long ticks, int value){
+	if (value == lastValue)
+		return;//held
+	
+	if (count > 0 && ticks == lastTicks){
+		//two values at the same tick, the later one wins
+		//only safe to rewrite if it's the only change in its block, otherwise just store it with a zero delta
+		if (count % blockSize == 1 && data.size() == blocks.back().offset){
+			blocks.back().value = value;
+			lastValue = value;
+			return;
+		}
+	}
+	
+	if (count % blockSize == 0){
+		Block block;
+		block.ticks = ticks;
+		block.value = value;
+		block.offset = data.size();
+		blocks.push_back(block);
+	} else {
+		writeVarint(data, ticks - lastTicks);
+		writeVarint(data, zigzag(value - lastValue));
+	}
+	
+	count++;
+	lastTicks = ticks;
+	lastValue = value;
+}
+
+int MIDICurve::valueAt(long ticks) const{
+	if (blocks.empty() || ticks < blocks[0].ticks)
+		return defaultValue;
+	
+	//last block starting at or before ticks
+	int b = 0, e = blocks.size();
+	while (e - b > 1){
+		int mid = (b + e) / 2;
+		if (blocks[mid].ticks <= ticks)
+			b = mid;
+		else
+			e = mid;
+	}
+	
+	const Block& block = blocks[b];
+	long t = block.ticks;
+	int value = block.value;
+	size_t position = block.offset;
+	size_t end = b + 1 < blocks.size() ? blocks[b + 1].offset : data.size();
+	
+	while (position < end){
+		long nextTicks = t + readVarint(&data[0], position);
+		if (nextTicks > ticks)
+			break;
+		t = nextTicks;
+		value += unzigzag(readVarint(&data[0], position));
+	}
+	return value;
+}
+
+
+MIDICurveCursor::MIDICurveCursor(){
+	curve = 0;
+	seek(0);
+}
+
+MIDICurveCursor::MIDICurveCursor(const MIDICurve* c){
+	curve = c;
+	seek(0);
+}
+
+void MIDICurveCursor::readNext(){
+	if (!curve || index >= curve->count){
+		nextTicks = -1;
+		return;
+	}
+	
+	if (index % MIDICurve::blockSize == 0){
+		const MIDICurve::Block& block = curve->blocks[index / MIDICurve::blockSize];
+		nextTicks = block.ticks;
+		nextValue = block.value;
+		position = block.offset;
+	} else {
+		nextTicks = ticks + readVarint(&curve->data[0], position);
+		nextValue = value + unzigzag(readVarint(&curve->data[0], position));
+	}
+}
+
+void MIDICurveCursor::seek(long target){
+	index = 0;
+	position = 0;
+	ticks = 0;
+	value = curve ? curve->defaultValue : 0;
+	
+	//jump straight to the block containing target
+	if (curve && !curve->blocks.empty() && target >= curve->blocks[0].ticks){
+		int b = 0, e = curve->blocks.size();
+		while (e - b > 1){
+			int mid = (b + e) / 2;
+			if (curve->blocks[mid].ticks <= target)
+				b = mid;
+			else
+				e = mid;
+		}
+		index = b * MIDICurve::blockSize;
+	}
+	
+	readNext();
+	while (nextTicks >= 0 && nextTicks <= target){
+		ticks = nextTicks;
+		value = nextValue;
+		index++;
+		readNext();
+	}
+}
+
+int MIDICurveCursor::valueAt(long target){
+	if (target < ticks){
+		seek(target);
+		return value;
+	}
+	
+	while (nextTicks >= 0 && nextTicks <= target){
+		ticks = nextTicks;
+		value = nextValue;
+		index++;
+		readNext();
+	}
+	return value;
+}
+
+
+MIDICurveStore::MIDICurveStore(){
+}
+
+void MIDICurveStore::build(const MIDIScore& score){
+	curves.clear();
+	curves.resize(16 * MIDI_CURVES_PER_CHANNEL);
+	for (int channel = 0; channel < 16; channel++){
+		MIDICurve* channelCurves = &curves[channel * MIDI_CURVES_PER_CHANNEL];
+		//same power-on values as the seek index
+		channelCurves[7].clear(100);
+		channelCurves[10].clear(64);
+		channelCurves[11].clear(127);
+		channelCurves[MIDI_CURVE_PITCH_BEND].clear(8192);
+	}
+	
+	//channel events are already in time order
+	for (int i = 0; i < score.channelEvents.size(); i++){
+		const MIDIChannelEvent& e = score.channelEvents[i];
+		MIDICurve* channelCurves = &curves[e.getChannel() * MIDI_CURVES_PER_CHANNEL];
+		switch (e.getMessageType()){
+			case 0xB0:
+				channelCurves[e.data1 & 0x7F].add(e.ticks, e.data2);
+				break;
+			case 0xD0:
+				channelCurves[MIDI_CURVE_PRESSURE].add(e.ticks, e.data1);
+				break;
+			case 0xE0:
+				channelCurves[MIDI_CURVE_PITCH_BEND].add(e.ticks, (e.data2 << 7) | e.data1);
+				break;
+		}
+	}
+}
+
+size_t MIDICurveStore::bytes() const{
+	size_t total = 0;
+	for (int i = 0; i < curves.size(); i++)
+		total += curves[i].bytes();
+	return total;
+}
@@ -0,0 +1,101 @@
+/*
+ *  MIDICurveStore.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#ifndef MIDI_CURVE_STORE
+#define MIDI_CURVE_STORE
+
+#include "MIDIScore.h"
+#include <stdint.h>
+
+//one controller (or pitch bend, or channel pressure) on one channel over time
+//only changes of value are kept, so a held value costs nothing however often it's resent
+//each change is a varint tick delta and a zigzag varint value delta - usually two bytes
+//every blockSize changes there's an uncompressed entry so lookups only decode one block
+
+class MIDICurve{
+public:
+	MIDICurve();
+	
+	void clear(int defaultValue);
+	void add(long ticks, int value);//in time order
+	
+	int valueAt(long ticks) const;//binary search then decode within the block
+	
+	int getDefault() const { return defaultValue; }
+	int size() const { return count; }
+	bool empty() const { return count == 0; }
+	size_t bytes() const { return data.size() + blocks.size() * sizeof(Block); }
+	
+	static const int blockSize = 32;
+	
+private:
+	friend class MIDICurveCursor;
+	
+	struct Block {
+		long ticks;//of the first change in the block
+		int value;
+		unsigned int offset;//into data, just after the first change
+	};
+	
+	std::vector<uint8_t> data;
+	std::vector<Block> blocks;
+	int count;
+	int defaultValue;
+	long lastTicks;
+	int lastValue;
+};
+
+//for reading a curve forwards, e.g. once per audio block
+//advancing is amortised constant time, going backwards seeks again
+
+class MIDICurveCursor{
+public:
+	MIDICurveCursor();
+	MIDICurveCursor(const MIDICurve* curve);
+	
+	void seek(long ticks);
+	int valueAt(long ticks);//ticks usually at or after the last call
+	
+	long nextChangeTicks() const { return nextTicks; }//-1 if there are no more
+	
+private:
+	void readNext();
+	
+	const MIDICurve* curve;
+	size_t position;//where the change after next starts in the data
+	int index;//number of changes taken
+	long ticks;
+	int value;
+	long nextTicks;
+	int nextValue;
+};
+
+enum {
+	MIDI_CURVE_PITCH_BEND = 128,
+	MIDI_CURVE_PRESSURE = 129,
+	MIDI_CURVES_PER_CHANNEL = 130
+};
+
+//all controller, pitch bend and pressure curves in a score
+//controllers 0-127 are the CC numbers, then MIDI_CURVE_PITCH_BEND and MIDI_CURVE_PRESSURE
+
+class MIDICurveStore{
+public:
+	MIDICurveStore();
+	
+	void build(const MIDIScore& score);
+	
+	const MIDICurve& getCurve(int channel, int controller) const { return curves[channel * MIDI_CURVES_PER_CHANNEL + controller]; }
+	int valueAt(int channel, int controller, long ticks) const { return getCurve(channel, controller).valueAt(ticks); }
+	
+	size_t bytes() const;
+	
+private:
+	std::vector<MIDICurve> curves;
+};
+#endif
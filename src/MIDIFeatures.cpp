@@ -0,0 +1,223 @@
+/*
+ *  MIDIFeatures.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#include "MIDIFeatures.h"
+#include "MIDIFileLoader.h"
+#include <cmath>
+#include <cstring>
+#include <atomic>
+#include <thread>
+
+MIDIFeatures::MIDIFeatures(){
+	flags = 0;
+	frameMillis = 100;
+	clear();
+}
+
+void MIDIFeatures::clear(){
+	noteCount = 0;
+	memset(pitchHistogram, 0, sizeof(pitchHistogram));
+	memset(pitchClassHistogram, 0, sizeof(pitchClassHistogram));
+	memset(ioiHistogram, 0, sizeof(ioiHistogram));
+	memset(velocityHistogram, 0, sizeof(velocityHistogram));
+	velocitySum = 0;
+	velocitySumOfSquares = 0;
+	velocityMin = 127;
+	velocityMax = 0;
+	polyphony.clear();
+	density.clear();
+}
+
+double MIDIFeatures::velocityMean() const{
+	return noteCount > 0 ? velocitySum / (double) noteCount : 0;
+}
+
+double MIDIFeatures::velocityDeviation() const{
+	if (noteCount < 2)
+		return 0;
+	double mean = velocityMean();
+	double variance = velocitySumOfSquares / noteCount - mean * mean;
+	return variance > 0 ? sqrt(variance) : 0;
+}
+
+double MIDIFeatures::ioiBinMillis(int bin){
+	return pow(2.0, bin / 2.0);
+}
+
+void MIDIFeatures::add(const MIDIFeatures& other){
+	flags |= other.flags;
+	noteCount += other.noteCount;
+	for (int i = 0; i < 128; i++){
+		pitchHistogram[i] += other.pitchHistogram[i];
+		velocityHistogram[i] += other.velocityHistogram[i];
+	}
+	for (int i = 0; i < 12; i++)
+		pitchClassHistogram[i] += other.pitchClassHistogram[i];
+	for (int i = 0; i < ioiBins; i++)
+		ioiHistogram[i] += other.ioiHistogram[i];
+	velocitySum += other.velocitySum;
+	velocitySumOfSquares += other.velocitySumOfSquares;
+	if (other.noteCount > 0){
+		if (other.velocityMin < velocityMin)
+			velocityMin = other.velocityMin;
+		if (other.velocityMax > velocityMax)
+			velocityMax = other.velocityMax;
+	}
+}
+
+static int ioiBin(double ioi){
+	//two bins per octave, log2 from the exponent rather than calling log
+	int exponent;
+	double mantissa = frexp(ioi, &exponent);//ioi = mantissa * 2^exponent, mantissa in [0.5, 1)
+	int bin = 2 * (exponent - 1) + (mantissa >= 0.70710678 ? 1 : 0);
+	if (bin < 0)
+		bin = 0;
+	if (bin >= MIDIFeatures::ioiBins)
+		bin = MIDIFeatures::ioiBins - 1;
+	return bin;
+}
+
+void MIDIFeatureExtractor::extract(const MIDINoteColumns& notes, MIDIFeatures& features, int flags, double frameMillis){
+	features.clear();
+	features.flags = flags;
+	features.frameMillis = frameMillis;
+	
+	const size_t n = notes.size();
+	features.noteCount = n;
+	if (n == 0)
+		return;
+	
+	bool curves = (flags & (MIDI_FEATURE_POLYPHONY | MIDI_FEATURE_DENSITY)) != 0;
+	int frames = 0;
+	if (curves){
+		double end = 0;
+		for (size_t i = 0; i < n; i++){
+			double noteEnd = notes.onsetMillis[i] + notes.durationMillis[i];
+			end = noteEnd > end ? noteEnd : end;
+		}
+		frames = (int)(end / frameMillis) + 2;
+		//difference arrays to start with
+		if (flags & MIDI_FEATURE_POLYPHONY)
+			features.polyphony.assign(frames, 0);
+		if (flags & MIDI_FEATURE_DENSITY)
+			features.density.assign(frames, 0);
+	}
+	
+	float* polyphony = features.polyphony.empty() ? 0 : &features.polyphony[0];
+	float* density = features.density.empty() ? 0 : &features.density[0];
+	bool pitch = (flags & MIDI_FEATURE_PITCH) != 0;
+	bool ioi = (flags & MIDI_FEATURE_IOI) != 0;
+	double invFrame = 1.0 / frameMillis;
+	double lastOnset = notes.onsetMillis[0];
+	
+	//the fused pass
+	for (size_t i = 0; i < n; i++){
+		double onset = notes.onsetMillis[i];
+		if (pitch){
+			int p = notes.pitch[i] & 0x7F;
+			features.pitchHistogram[p]++;
+		}
+		if (ioi && onset > lastOnset){
+			features.ioiHistogram[ioiBin(onset - lastOnset)]++;
+			lastOnset = onset;
+		}
+		if (curves){
+			int start = (int)(onset * invFrame);
+			if (start < 0)
+				start = 0;
+			if (density)
+				density[start] += 1;
+			if (polyphony){
+				int end = (int)((onset + notes.durationMillis[i]) * invFrame);
+				if (end <= start)
+					end = start + 1;//even the shortest note shows up somewhere
+				polyphony[start] += 1;
+				polyphony[end] -= 1;
+			}
+		}
+	}
+	
+	if (pitch){
+		for (int p = 0; p < 128; p++)
+			features.pitchClassHistogram[p % 12] += features.pitchHistogram[p];
+	}
+	
+	if (polyphony){
+		float level = 0;
+		for (int f = 0; f < frames; f++){
+			level += polyphony[f];
+			polyphony[f] = level;
+		}
+	}
+	
+	if (flags & MIDI_FEATURE_VELOCITY){
+		const uint8_t* velocity = notes.velocity;
+		//plain reductions over bytes, these vectorise
+		//64 bit sums - squares of 127 would wrap 32 bits after about 266,000 notes
+		uint64_t sum = 0, sumOfSquares = 0;
+		uint8_t low = 127, high = 0;
+		for (size_t i = 0; i < n; i++){
+			uint64_t v = velocity[i];
+			sum += v;
+			sumOfSquares += v * v;
+			low = velocity[i] < low ? velocity[i] : low;
+			high = velocity[i] > high ? velocity[i] : high;
+		}
+		features.velocitySum = sum;
+		features.velocitySumOfSquares = (double)sumOfSquares;
+		features.velocityMin = low;
+		features.velocityMax = high;
+		for (size_t i = 0; i < n; i++)
+			features.velocityHistogram[velocity[i] & 0x7F]++;
+	}
+}
+
+void MIDIFeatureExtractor::extractCorpus(const std::vector<std::string>& paths, std::vector<MIDIFeatures>& results, MIDIFeatures& total,
+										 int flags, double frameMillis, int threads){
+	results.clear();
+	results.resize(paths.size());
+	total.clear();
+	total.flags = flags;
+	total.frameMillis = frameMillis;
+	
+	if (threads <= 0)
+		threads = std::thread::hardware_concurrency();
+	if (threads <= 0)
+		threads = 1;
+	if (threads > (int)paths.size())
+		threads = paths.size();
+	
+	//each worker takes the next file, so a few huge files don't leave the others idle
+	std::atomic<size_t> next(0);
+	std::vector<MIDIFeatures> partial(threads);
+	std::vector<std::thread> workers;
+	
+	for (int t = 0; t < threads; t++){
+		workers.push_back(std::thread([&, t](){
+			MIDIFileLoader loader;
+			loader.printMidiInfo = false;
+			MIDIParseOptions options;
+			options.quiet = true;
+			MIDINoteColumns columns;
+			
+			for (size_t i = next++; i < paths.size(); i = next++){
+				MIDIScorePtr score = loader.loadScore(paths[i], options);
+				if (!score)
+					continue;
+				columns.assign(score->notes);
+				extract(columns, results[i], flags, frameMillis);
+				partial[t].add(results[i]);
+			}
+		}));
+	}
+	
+	for (int t = 0; t < workers.size(); t++)
+		workers[t].join();
+	for (int t = 0; t < partial.size(); t++)
+		total.add(partial[t]);
+}
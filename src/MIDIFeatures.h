@@ -0,0 +1,68 @@
+/*
+ *  MIDIFeatures.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#ifndef MIDI_FEATURES
+#define MIDI_FEATURES
+
+#include "MIDINoteColumns.h"
+#include <string>
+
+enum MIDIFeatureFlags {
+	MIDI_FEATURE_PITCH = 1,//pitch and pitch class histograms
+	MIDI_FEATURE_IOI = 2,//inter-onset intervals between distinct onsets
+	MIDI_FEATURE_VELOCITY = 4,
+	MIDI_FEATURE_POLYPHONY = 8,//notes sounding per frame
+	MIDI_FEATURE_DENSITY = 16,//onsets per frame
+	MIDI_FEATURE_ALL = 31
+};
+
+struct MIDIFeatures {
+	static const int ioiBins = 24;//bin k holds intervals of 2^(k/2) to 2^((k+1)/2) millis
+	
+	int flags;
+	double frameMillis;//for the curves
+	
+	long noteCount;
+	long pitchHistogram[128];
+	long pitchClassHistogram[12];
+	long ioiHistogram[ioiBins];
+	
+	long velocityHistogram[128];
+	long velocitySum;
+	double velocitySumOfSquares;
+	int velocityMin, velocityMax;
+	
+	std::vector<float> polyphony;//one value per frame
+	std::vector<float> density;
+	
+	MIDIFeatures();
+	void clear();
+	
+	double velocityMean() const;
+	double velocityDeviation() const;
+	static double ioiBinMillis(int bin);//lower edge
+	
+	//sums histograms and statistics, for corpus totals - curves are per file so they're left alone
+	void add(const MIDIFeatures& other);
+};
+
+//all the features asked for in one pass over the note columns
+//the per note work is the histogram scatter, plus difference arrays for the curves
+//which are turned into levels afterwards - the velocity statistics run over the byte column on their own
+//so the compiler can vectorise them
+
+class MIDIFeatureExtractor{
+public:
+	static void extract(const MIDINoteColumns& notes, MIDIFeatures& features, int flags = MIDI_FEATURE_ALL, double frameMillis = 100);
+	
+	//loads and extracts every file, spread over threads (0 = one per core)
+	//results[i] is for paths[i] (noteCount 0 if it didn't load), total is everything added together
+	static void extractCorpus(const std::vector<std::string>& paths, std::vector<MIDIFeatures>& results, MIDIFeatures& total,
+							  int flags = MIDI_FEATURE_ALL, double frameMillis = 100, int threads = 0);
+};
+#endif
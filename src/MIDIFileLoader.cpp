@@ -8,26 +8,244 @@
  */
 
 #include "MIDIFileLoader.h"
+#include "MIDIArchive.h"
+#include <algorithm>
+#include <thread>
+#include <limits>
+#include <cstring>
+
+using namespace MIDIConstants;
+using namespace std;
 
 
 const bool overrideTempo = true;//for Andrew R's use with Logic exported files
 const int repeatCutoff = 150;//msec when looking for repeated midi events (post-filtering)
+const double firstBeatPeriod = 500;///guessing
 
 MIDIFileLoader:: MIDIFileLoader(){
 	printMidiInfo = true;
+	lastAsyncSequence = 0;
+	publishedSequence = 0;
+}
+
+
+//time, then note-offs before anything else, then track - again the same order as stable sorting the loaded events
+static bool channelEventCompare(const MIDIChannelEvent& a, const MIDIChannelEvent& b){
+	if (a.ticks != b.ticks)
+		return a.ticks < b.ticks;
+	if (a.isNoteOff() != b.isNoteOff())
+		return a.isNoteOff();
+	return a.track < b.track;
+}
+
+static void addChannelEvents(unsigned int trackNum, const MIDIEvent& event, std::vector<MIDIChannelEvent>& channelEvents){
+	MIDIChannelEvent e;
+	e.ticks = event.getTime();
+	e.track = trackNum;
+	e.status = event.getEventCode();
+	e.data1 = event.getData1();
+	e.data2 = event.getData2();
+	channelEvents.push_back(e);
+	
+	if (event.getMessageType() == MIDI_NOTE_ON && event.getVelocity() > 0){
+		e.ticks += event.getDuration();
+		e.status = MIDI_NOTE_OFF | event.getChannelNumber();
+		e.data2 = 0;
+		channelEvents.push_back(e);
+	}
+}
+
+//onset, then track - stable sorting the loaded (track by track) notes gives the same order
+static bool noteOnsetCompare(const noteData& a, const noteData& b){
+	if (a.ticks != b.ticks)
+		return a.ticks < b.ticks;
+	return a.track < b.track;
 }
 
 
 int MIDIFileLoader::loadFile(std::string& filename){
-	midiEvents.clear();//empty vector where we will hold the pitch and event time 
+	MIDIScorePtr score = loadScore(filename);
+	if (!score)
+		return 1;
+	
+	publishScore(score);
+	publishedSequence = lastAsyncSequence;//supersedes anything still loading in the background
+	return 0;
+}
+
+void MIDIFileLoader::publishScore(MIDIScorePtr score){
+	currentScore.publish(score);
+	if (score)
+		midiEvents = score->notes;//our own copy, free to filter
+	else
+		midiEvents.clear();
+}
+
+
+MIDIScorePtr MIDIFileLoader::loadScore(const std::string& filename, const MIDIParseOptions& options, MIDIParseResult* result) const{
+	MIDIFileReader fr(filename, options);
+	return readScore(fr, filename, options, result);
+}
+
+//the buffer isn't copied - it just has to outlive this call
+MIDIScorePtr MIDIFileLoader::loadScore(const void* data, size_t size, const std::string& name, const MIDIParseOptions& options, MIDIParseResult* result) const{
+	MIDIFileReader fr(data, size, options);
+	return readScore(fr, name, options, result);
+}
+
+MIDIScorePtr MIDIFileLoader::loadScore(std::istream& stream, const std::string& name, const MIDIParseOptions& options, MIDIParseResult* result) const{
+	MIDIFileReader fr(stream, options);
+	return readScore(fr, name, options, result);
+}
+
+MIDIParseResult MIDIFileLoader::probe(const std::string& filename, MIDIProbeInfo& info) const{
+	MIDIParseResult result = MIDIFileReader::probe(filename, info, true);
+	timeProbe(info);
+	return result;
+}
+
+MIDIParseResult MIDIFileLoader::probe(const void* data, size_t size, MIDIProbeInfo& info) const{
+	MIDIParseResult result = MIDIFileReader::probe(data, size, info, true);
+	timeProbe(info);
+	return result;
+}
+
+//the reader goes by the file's tempo events, which readScore ignores when overrideTempo is set
+//so time the end as readScore would - fixed beat period, and the default resolution for SMPTE files
+void MIDIFileLoader::timeProbe(MIDIProbeInfo& info) const{
+	if (!overrideTempo || info.timingDivision == 0)
+		return;
+	MIDIScore score;
+	if (info.timingDivision < 32768)
+		score.pulsesPerQuarternote = info.timingDivision;
+	std::vector<MIDITempoSegment> noChanges;
+	score.setTempoChanges(noChanges, firstBeatPeriod);
+	info.durationMillis = score.ticksToMillis(info.durationTicks);
+}
+
+//by extension, looking past a .gz
+static bool isMidiName(const std::string& name){
+	std::string lower(name);
+	std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+	if (lower.size() > 3 && lower.compare(lower.size() - 3, 3, ".gz") == 0)
+		lower.resize(lower.size() - 3);
+	const char* extensions[] = {".mid", ".midi", ".kar"};
+	for (int i = 0; i < 3; i++){
+		size_t length = strlen(extensions[i]);
+		if (lower.size() > length && lower.compare(lower.size() - length, length, extensions[i]) == 0)
+			return true;
+	}
+	return false;
+}
+
+std::vector<MIDIScorePtr> MIDIFileLoader::loadArchive(const std::string& path, int threads, std::vector<std::string>* memberNames, const MIDIParseOptions& options) const{
+	std::vector<MIDIScorePtr> scores;
+	MIDIZipArchive archive;
+	if (!archive.open(path)){
+		if (!options.quiet)
+			std::cerr << "Error: can't read zip archive " << path << std::endl;
+		return scores;
+	}
+	
+	const std::vector<MIDIZipMember>& members = archive.getMembers();
+	std::vector<size_t> chosen;
+	std::vector<size_t> slot(members.size());
+	for (size_t i = 0; i < members.size(); i++){
+		if (!members[i].isDirectory() && isMidiName(members[i].name)){
+			slot[i] = chosen.size();
+			chosen.push_back(i);
+		}
+	}
+	
+	scores.resize(chosen.size());
+	if (memberNames){
+		memberNames->clear();
+		for (size_t k = 0; k < chosen.size(); k++)
+			memberNames->push_back(members[chosen[k]].name);
+	}
 	
-	pulsesPerQuarternote = 240;
+	MIDIParseOptions memberOptions = options;
+	memberOptions.progress = 0;
+	memberOptions.stats = 0;
+	memberOptions.sink = 0;
+	memberOptions.sinkOnly = false;
 	
-	lastTick = 0;
-	lastMillis = 0;
+	//each member is parsed straight out of the inflate buffer, gunzipping it first if it needs it
+	archive.readAll(chosen, [&](size_t index, MIDIInflateResult result, const std::vector<char>& data){
+		if (result == MIDI_INFLATE_OK)
+			scores[slot[index]] = loadScore(data.empty() ? 0 : &data[0], data.size(), path + "/" + members[index].name, memberOptions);
+		else if (!options.quiet)
+			std::cerr << "Error: can't inflate " << members[index].name << " from " << path << std::endl;
+	}, threads, options.maxAllocatedBytes);
+	
+	return scores;
+}
+
+
+MIDIAsyncLoadPtr MIDIFileLoader::loadFileAsync(const std::string& filename){
+	MIDIAsyncLoadPtr load(new MIDIAsyncLoad());
+	load->path = filename;
+	load->sequence = ++lastAsyncSequence;
+	pendingLoads.push_back(load);
+	
+	bool printInfo = printMidiInfo;
+	std::thread([load, printInfo](){
+		//own loader so the thread doesn't depend on this one still being around
+		MIDIFileLoader worker;
+		worker.printMidiInfo = printInfo;
+		
+		MIDIParseOptions options;
+		options.progress = &load->progress;
+		
+		MIDIScorePtr score = worker.loadScore(load->path, options);
+		if (!load->isCancelled())
+			load->score = score;
+		load->finished.store(true, std::memory_order_release);
+	}).detach();
+	
+	return load;
+}
+
+bool MIDIFileLoader::update(){
+	bool published = false;
+	std::list<MIDIAsyncLoadPtr>::iterator i = pendingLoads.begin();
+	while (i != pendingLoads.end()){
+		MIDIAsyncLoadPtr load = *i;
+		if (!load->isFinished()){
+			++i;
+			continue;
+		}
+		
+		//a slow older load mustn't replace a newer one that finished first
+		if (load->score && load->sequence > publishedSequence){
+			publishScore(load->score);
+			publishedSequence = load->sequence;
+			published = true;
+		}
+		i = pendingLoads.erase(i);
+	}
+	return published;
+}
+
+float MIDIAsyncLoad::getFraction() const{
+	if (isFinished())
+		return 1;
+	size_t total = progress.totalBytes;
+	return total > 0 ? progress.bytesParsed / (float) total : 0;
+}
+
+
+//all parse state lives in locals here so any number of threads can load at once
+MIDIScorePtr MIDIFileLoader::readScore(const MIDIFileReader& fr, const std::string& filename, const MIDIParseOptions& options, MIDIParseResult* result) const{
+	if (result)
+		*result = fr.getParseResult();
+	MIDILoadStats* stats = options.stats;
+	std::shared_ptr<MIDIScore> score(new MIDIScore());
+	score->path = filename;
 	
-	beatPeriod = 500;///guessing
-	printf("FIRST BEAT PERIOD %f\n", beatPeriod);
+	std::vector<MIDITempoSegment> tempoChanges;
+	if (printMidiInfo)
+		printf("FIRST BEAT PERIOD %f\n", firstBeatPeriod);
 	//lastMeasurePosition = 0;
 	/*
 	noteOnIndex = 0;
@@ -38,30 +256,34 @@ int MIDIFileLoader::loadFile(std::string& filename){
 	*/
 	//setTempoFromMidiValue(500000, myMidiEvents);//default is 120bpm
 	
-	MIDIFileReader fr(filename);
-	
 	if (!fr.isOK()) {
-		std::cerr << "Error: " << fr.getError().c_str() << std::endl;
-		return 1;
+		if (!options.quiet)
+			std::cerr << "Error: " << fr.getError().c_str() << std::endl;
+		return MIDIScorePtr();
 	}
 	
-	MIDIComposition c = fr.load();
+	const MIDIComposition& c = fr.getComposition();
 	
-	switch (fr.getFormat()) {
-		case MIDI_SINGLE_TRACK_FILE: cout << "Format: MIDI Single Track File" << endl; break;
-		case MIDI_SIMULTANEOUS_TRACK_FILE: cout << "Format: MIDI Simultaneous Track File" << endl; break;
-		case MIDI_SEQUENTIAL_TRACK_FILE: cout << "Format: MIDI Sequential Track File" << endl; break;
-		default: cout << "Format: Unknown MIDI file format?" << endl; break;
+	if (printMidiInfo){
+		switch (fr.getFormat()) {
+			case MIDI_SINGLE_TRACK_FILE: cout << "Format: MIDI Single Track File" << endl; break;
+			case MIDI_SIMULTANEOUS_TRACK_FILE: cout << "Format: MIDI Simultaneous Track File" << endl; break;
+			case MIDI_SEQUENTIAL_TRACK_FILE: cout << "Format: MIDI Sequential Track File" << endl; break;
+			default: cout << "Format: Unknown MIDI file format?" << endl; break;
+		}
+		
+		std::cout << "Tracks: " << c.size() << endl;
 	}
 	
-	std::cout << "Tracks: " << c.size() << endl;
+	score->format = fr.getFormat();
+	score->numberOfTracks = c.size();
 	
 	int td = fr.getTimingDivision();
 	if (td < 32768) {
 		if (printMidiInfo)
 			std::cout << "Timing division: " << fr.getTimingDivision() << " ppq" << endl;
 		
-		pulsesPerQuarternote = fr.getTimingDivision();		
+		score->pulsesPerQuarternote = fr.getTimingDivision();		
 		
 		//myMidiEvents.pulsesPerQuarternote = fr.getTimingDivision();
 		//ticksPerMeasure = myMidiEvents.pulsesPerQuarternote * 4;//default setting
@@ -73,289 +295,364 @@ int MIDIFileLoader::loadFile(std::string& filename){
 			std::cout << "SMPTE timing: " << frames << " fps, " << subframes << " subframes" << endl;
 	}
 	
-	for (MIDIComposition::const_iterator i = c.begin(); i != c.end(); ++i) {
-		if (printMidiInfo)
-			std::cout << "Start of track: " << i->first+1 << endl;
+	for (MIDIComposition::const_iterator i = c.begin(); i != c.end(); ++i){
+		MIDI_STATS_TIMER(stats, MIDI_PHASE_NOTES, i->first);
+		readTrack(i->first, i->second, score->notes, tempoChanges, score->channelEvents, stats);
+	}
+	
+	MIDI_STATS_TIMER(stats, MIDI_PHASE_TIMING, -1);
+	
+	//tempo changes from every track apply to every track
+	score->tempoChanges = tempoChanges;
+	score->setTempoChanges(tempoChanges, firstBeatPeriod);
+	
+	setNoteTimes(*score, score->notes.begin(), score->notes.end());
+	std::stable_sort(score->notes.begin(), score->notes.end(), noteOnsetCompare);
+	std::stable_sort(score->channelEvents.begin(), score->channelEvents.end(), channelEventCompare);
+	
+	score->fingerprint.compute(*score);
+	
+	return score;
+}//end midi main reading
+
+
+//the per-track part of loading - adds this track's notes and tempo changes
+void MIDIFileLoader::readTrack(unsigned int trackNum, const MIDITrack& track, std::vector<noteData>& notes, std::vector<MIDITempoSegment>& tempoChanges, std::vector<MIDIChannelEvent>& channelEvents, MIDILoadStats* stats) const{
+	if (printMidiInfo)
+		std::cout << "Start of track: " << trackNum+1 << endl;
+	
+	for (MIDITrack::const_iterator j = track.begin(); j != track.end(); ++j) {
 		
-		for (MIDITrack::const_iterator j = i->second.begin(); j != i->second.end(); ++j) {
-			
-			unsigned int t = j->getTime();
-			int ch = j->getChannelNumber();
-			
-			if (j->isMeta()) {
-				int code = j->getMetaEventCode();
-				std::string name;
-				bool printable = true;
-				switch (code) {
-						
-					case MIDI_END_OF_TRACK:
-						std::cout << t << ": End of track" << endl;
-						break;
-						
-					case MIDI_TEXT_EVENT: name = "Text"; break;
-					case MIDI_COPYRIGHT_NOTICE: name = "Copyright"; break;
-					case MIDI_TRACK_NAME: name = "Track name"; break;
-					case MIDI_INSTRUMENT_NAME: name = "Instrument name"; break;
-					case MIDI_LYRIC: name = "Lyric"; break;
-					case MIDI_TEXT_MARKER: name = "Text marker"; break;
-					case MIDI_SEQUENCE_NUMBER: name = "Sequence number"; printable = false; break;
-					case MIDI_CHANNEL_PREFIX_OR_PORT: name = "Channel prefix or port"; printable = false; break;
-					case MIDI_CUE_POINT: name = "Cue point"; break;
-					case MIDI_CHANNEL_PREFIX: name = "Channel prefix"; printable = false; break;
-					case MIDI_SEQUENCER_SPECIFIC: name = "Sequencer specific"; printable = false; break;
-					case MIDI_SMPTE_OFFSET: name = "SMPTE offset"; printable = false; break;
-						
-					case MIDI_SET_TEMPO:
-					{
-						int m0 = j->getMetaMessage()[0];
-						int m1 = j->getMetaMessage()[1];
-						int m2 = j->getMetaMessage()[2];
-						long tempo = (((m0 << 8) + m1) << 8) + m2;
-						//if (printMidiInfo)
-						std::cout << "tempo data: " << tempo << endl;
-						std::cout << t << ": Tempo(BPM): " << 60000000.0 / double(tempo) << endl;
-						
-						// The 3 data bytes of tt tt tt are the tempo in microseconds per quarter note
-						
-						//Joel - this bit needs checking
-						//Andrew - yes, tempo above is actually period
-						//however, from Logic when exporting at 120 BPM I get 138.101 here
-						//so needs more checking
-						
-						if (!overrideTempo){
-							beatPeriod = tempo/1000.0;
-						} else {
-							printf("WARNING! - Tempo message overriden here");
-						}
-						
-						printf("BPM %.2f\n", 60000./beatPeriod);
-					
-						
-						double tmp = updateElapsedTime(t);
-						/*
-						DoubleVector tmp;
-						
-						double lastTickInMillis = 0;
-						double millisTimeNow = lastTickInMillis;
-						int tickInterval = 0;
-						if (myMidiEvents.periodValues.size() > 0){
-							lastTickInMillis = myMidiEvents.periodValues[myMidiEvents.periodValues.size()-1][2];
-							tickInterval = t  - myMidiEvents.periodValues[myMidiEvents.periodValues.size()-1][0];
-							millisTimeNow = lastTickInMillis + (myMidiEvents.periodValues[myMidiEvents.periodValues.size()-1][1]*tickInterval);
-							
-						}
-						
-						tmp.push_back(t);
-						
-						
-						tmp.push_back(60000000.0 / double(tempo));	
-						double tmpTempoVal = 60000000.0 / double(tempo);
-						tmp.push_back(millisTimeNow);
-						
-						myMidiEvents.periodValues.push_back(tmp);
-						
-						printf("tick[%i]: TEMPO %d tempoVal %f : time now %f\n", t, tempo, tmpTempoVal, millisTimeNow);
-						*/
-					}
-						break;
-						
-					case MIDI_TIME_SIGNATURE:
-					{
-						int numerator = j->getMetaMessage()[0];
-						int denominator = 1 << (int)j->getMetaMessage()[1];
-						
-						//newTimeSignature(t, numerator, denominator);
-						
-						//if (printMidiInfo)
-						std::cout << t << ": Time signature: " << numerator << "/" << denominator << endl;
-						printf(" ticks %i Time signature: %i by %i \n", t,  numerator , denominator );
-					}
-						
-					case MIDI_KEY_SIGNATURE:
-					{
-						int accidentals = j->getMetaMessage()[0];
-						int isMinor = j->getMetaMessage()[1];
-						bool isSharp = accidentals < 0 ? false : true;
-						accidentals = accidentals < 0 ? -accidentals : accidentals;
-						if (printMidiInfo)
-							std::cout << t << ": Key signature: " << accidentals << " "
-							<< (isSharp ?
-								(accidentals > 1 ? "sharps" : "sharp") :
-								(accidentals > 1 ? "flats" : "flat"))
-							<< (isMinor ? ", minor" : ", major") << endl;
-					}
-						
-				}
-				
-				
-				if (name != "") {
-					if (printable) {
-						std::cout << t << ": File meta event: code " << code
-						<< ": " << name << ": \"" << j->getMetaMessage()
-						<< "\"" << endl;
-					} else {
-						std::cout << t << ": File meta event: code " << code
-						<< ": " << name << ": ";
-						for (int k = 0; k < j->getMetaMessage().length(); ++k) {
-							std::cout << (int)j->getMetaMessage()[k] << " ";
-						}
-					}
-				}
-				continue;
-			}
-			double newBeatLocation = 0;
-			switch (j->getMessageType()) {
+		unsigned int t = j->getTime();
+		int ch = j->getChannelNumber();
+		
+		if (j->isMeta()) {
+			int code = j->getMetaEventCode();
+			std::string name;
+			bool printable = true;
+			switch (code) {
 					
-				case MIDI_NOTE_ON:
+				case MIDI_END_OF_TRACK:
 					if (printMidiInfo)
-						std::cout << t << ": Note: channel " << ch
-						<< " duration " << j->getDuration()
-						<< " pitch " << j->getPitch()
-						<< " velocity " << j->getVelocity() << endl;
-//						<< "event time " << myMidiEvents.getEventTimeMillis(t) << endl;
-					
-					noteData newNote;
-					newNote.pitch = j->getPitch();
-					newNote.ticks = t;
-					newNote.velocity = j->getVelocity();
-					newNote.durationTicks = j->getDuration();
-					newNote.durationMillis = ticksToMillis(newNote.durationTicks);
-					double millis;
-					millis = updateElapsedTime(t);
-					printf("ticks %i event time %f dur %f\n", t, millis, newNote.durationMillis);
-					//millis = (beatPeriod * newNote.ticks / (double) pulsesPerQuarternote);
-					
+						std::cout << t << ": End of track" << endl;
+					break;
 					
-					newNote.timeMillis = millis;
-				
-					midiEvents.push_back(newNote);
+				case MIDI_TEXT_EVENT: name = "Text"; break;
+				case MIDI_COPYRIGHT_NOTICE: name = "Copyright"; break;
+				case MIDI_TRACK_NAME: name = "Track name"; break;
+				case MIDI_INSTRUMENT_NAME: name = "Instrument name"; break;
+				case MIDI_LYRIC: name = "Lyric"; break;
+				case MIDI_TEXT_MARKER: name = "Text marker"; break;
+				case MIDI_SEQUENCE_NUMBER: name = "Sequence number"; printable = false; break;
+				case MIDI_CHANNEL_PREFIX_OR_PORT: name = "Channel prefix or port"; printable = false; break;
+				case MIDI_CUE_POINT: name = "Cue point"; break;
+				case MIDI_CHANNEL_PREFIX: name = "Channel prefix"; printable = false; break;
+				case MIDI_SEQUENCER_SPECIFIC: name = "Sequencer specific"; printable = false; break;
+				case MIDI_SMPTE_OFFSET: name = "SMPTE offset"; printable = false; break;
 					
-				
+				case MIDI_SET_TEMPO:
+				{
+					int m0 = j->getMetaMessage()[0];
+					int m1 = j->getMetaMessage()[1];
+					int m2 = j->getMetaMessage()[2];
+					long tempo = (((m0 << 8) + m1) << 8) + m2;
+					if (printMidiInfo){
+						std::cout << "tempo data: " << tempo << endl;
+						std::cout << t << ": Tempo(BPM): " << 60000000.0 / double(tempo) << endl;
+					}
 					
-					//newBeatLocation = getBeatPositionForTickCount(t, myMidiEvents);
+					// The 3 data bytes of tt tt tt are the tempo in microseconds per quarter note
 					
-					//	printf("%i channel %i durn %i pitch %i vel %i event time %f beat pos %f\n", t, ch, (int)j->getDuration(), (int)j->getPitch(), (int)j->getVelocity(), myMidiEvents.getEventTimeMillis(t)
-					//		   , newBeatLocation);
+					//Joel - this bit needs checking
+					//Andrew - yes, tempo above is actually period
+					//however, from Logic when exporting at 120 BPM I get 138.101 here
+					//so needs more checking
 					
+					if (!overrideTempo){
+						MIDITempoSegment change;
+						change.ticks = t;
+						change.beatPeriod = tempo/1000.0;
+						change.track = trackNum;
+						tempoChanges.push_back(change);
+						if (printMidiInfo)
+							printf("BPM %.2f\n", 60000./change.beatPeriod);
+					} else if (printMidiInfo){
+						printf("WARNING! - Tempo message overriden here");
+						printf("BPM %.2f\n", 60000./firstBeatPeriod);
+					}
+					/*
+					DoubleVector tmp;
 					
+					double lastTickInMillis = 0;
+					double millisTimeNow = lastTickInMillis;
+					int tickInterval = 0;
+					if (myMidiEvents.periodValues.size() > 0){
+						lastTickInMillis = myMidiEvents.periodValues[myMidiEvents.periodValues.size()-1][2];
+						tickInterval = t  - myMidiEvents.periodValues[myMidiEvents.periodValues.size()-1][0];
+						millisTimeNow = lastTickInMillis + (myMidiEvents.periodValues[myMidiEvents.periodValues.size()-1][1]*tickInterval);
+						
+					}
 					
-					//	printf("Beat location %3.2f\n", newBeatLocation);
+					tmp.push_back(t);
 					
-				/*
-					v.clear();
 					
-					//	printf("note on at %i\n", t);
+					tmp.push_back(60000000.0 / double(tempo));	
+					double tmpTempoVal = 60000000.0 / double(tempo);
+					tmp.push_back(millisTimeNow);
 					
-					//if (!chopBeginning)
-					v.push_back(t);
-					//else
-					//	v.push_back(t - firstTickTime);
+					myMidiEvents.periodValues.push_back(tmp);
 					
-					v.push_back(j->getPitch());
-					v.push_back(j->getVelocity());
-					v.push_back(j->getDuration());
-				 */
-					/*
-					myMidiEvents.recordedNoteOnMatrix.push_back(v);
-					myMidiEvents.noteOnMatches.push_back(false);
-					myMidiEvents.beatPositions.push_back(newBeatLocation);
+					printf("tick[%i]: TEMPO %d tempoVal %f : time now %f\n", t, tempo, tmpTempoVal, millisTimeNow);
 					*/
-					
-					break;
-					
-				case MIDI_POLY_AFTERTOUCH:
-					if (printMidiInfo)
-						std::cout << t << ": Polyphonic aftertouch: channel " << ch
-						<< " pitch " << j->getPitch()
-						<< " pressure " << j->getData2() << endl;
-					break;
-					
-				case MIDI_CTRL_CHANGE:
-				{
-					int controller = j->getData1();
-					std::string name;
-					switch (controller) {
-						case MIDI_CONTROLLER_BANK_MSB: name = "Bank select MSB"; break;
-						case MIDI_CONTROLLER_VOLUME: name = "Volume"; break;
-						case MIDI_CONTROLLER_BANK_LSB: name = "Bank select LSB"; break;
-						case MIDI_CONTROLLER_MODULATION: name = "Modulation wheel"; break;
-						case MIDI_CONTROLLER_PAN: name = "Pan"; break;
-						case MIDI_CONTROLLER_SUSTAIN: name = "Sustain"; break;
-						case MIDI_CONTROLLER_RESONANCE: name = "Resonance"; break;
-						case MIDI_CONTROLLER_RELEASE: name = "Release"; break;
-						case MIDI_CONTROLLER_ATTACK: name = "Attack"; break;
-						case MIDI_CONTROLLER_FILTER: name = "Filter"; break;
-						case MIDI_CONTROLLER_REVERB: name = "Reverb"; break;
-						case MIDI_CONTROLLER_CHORUS: name = "Chorus"; break;
-						case MIDI_CONTROLLER_NRPN_1: name = "NRPN 1"; break;
-						case MIDI_CONTROLLER_NRPN_2: name = "NRPN 2"; break;
-						case MIDI_CONTROLLER_RPN_1: name = "RPN 1"; break;
-						case MIDI_CONTROLLER_RPN_2: name = "RPN 2"; break;
-						case MIDI_CONTROLLER_SOUNDS_OFF: name = "All sounds off"; break;
-						case MIDI_CONTROLLER_RESET: name = "Reset"; break;
-						case MIDI_CONTROLLER_LOCAL: name = "Local"; break;
-						case MIDI_CONTROLLER_ALL_NOTES_OFF: name = "All notes off"; break;
-					}
-					if (printMidiInfo)
-						std::cout << t << ": Controller change: channel " << ch
-						<< " controller " << j->getData1();
-					if (name != "") std::cout << " (" << name << ")";
-					std::cout << " value " << j->getData2() << endl;
 				}
 					break;
 					
-				case MIDI_PROG_CHANGE:
-					if (printMidiInfo)
-						std::cout << t << ": Program change: channel " << ch
-						<< " program " << j->getData1() << endl;
-					break;
+				case MIDI_TIME_SIGNATURE:
+				{
+					int numerator = j->getMetaMessage()[0];
+					int denominator = 1 << (int)j->getMetaMessage()[1];
 					
-				case MIDI_CHNL_AFTERTOUCH:
-					if (printMidiInfo)
-						std::cout << t << ": Channel aftertouch: channel " << ch
-						<< " pressure " << j->getData1() << endl;
-					break;
+					//newTimeSignature(t, numerator, denominator);
 					
-				case MIDI_PITCH_BEND:
-					if (printMidiInfo)
-						std::cout << t << ": Pitch bend: channel " << ch
-						<< " value " << (int)j->getData2() * 128 + (int)j->getData1() << endl;
-					break;
+					if (printMidiInfo){
+						std::cout << t << ": Time signature: " << numerator << "/" << denominator << endl;
+						printf(" ticks %i Time signature: %i by %i \n", t,  numerator , denominator );
+					}
+				}
 					
-				case MIDI_SYSTEM_EXCLUSIVE:
+				case MIDI_KEY_SIGNATURE:
+				{
+					int accidentals = j->getMetaMessage()[0];
+					int isMinor = j->getMetaMessage()[1];
+					bool isSharp = accidentals < 0 ? false : true;
+					accidentals = accidentals < 0 ? -accidentals : accidentals;
 					if (printMidiInfo)
-						std::cout << t << ": System exclusive: code "
-						<< (int)j->getMessageType() << " message length " <<
-						j->getMetaMessage().length() << endl;
-					break;
-					
+						std::cout << t << ": Key signature: " << accidentals << " "
+						<< (isSharp ?
+							(accidentals > 1 ? "sharps" : "sharp") :
+							(accidentals > 1 ? "flats" : "flat"))
+						<< (isMinor ? ", minor" : ", major") << endl;
+				}
 					
 			}
 			
 			
+			if (name != "" && printMidiInfo) {
+				if (printable) {
+					std::cout << t << ": File meta event: code " << code
+					<< ": " << name << ": \"" << j->getMetaMessage()
+					<< "\"" << endl;
+				} else {
+					std::cout << t << ": File meta event: code " << code
+					<< ": " << name << ": ";
+					for (int k = 0; k < j->getMetaMessage().length(); ++k) {
+						std::cout << (int)j->getMetaMessage()[k] << " ";
+					}
+				}
+			}
+			continue;
+		}
+		if (j->getMessageType() < MIDI_SYSTEM_EXCLUSIVE)
+			addChannelEvents(trackNum, *j, channelEvents);
+		
+		double newBeatLocation = 0;
+		switch (j->getMessageType()) {
+				
+			case MIDI_NOTE_ON:
+				if (printMidiInfo)
+					std::cout << t << ": Note: channel " << ch
+					<< " duration " << j->getDuration()
+					<< " pitch " << j->getPitch()
+					<< " velocity " << j->getVelocity() << endl;
+//						<< "event time " << myMidiEvents.getEventTimeMillis(t) << endl;
+				
+				noteData newNote;
+				newNote.pitch = j->getPitch();
+				newNote.ticks = t;
+				newNote.velocity = j->getVelocity();
+				newNote.durationTicks = j->getDuration();
+				newNote.channel = ch;
+				newNote.track = trackNum;
+				//millis are filled in once the whole tempo map is known
+			
+				MIDI_STATS(stats, countPush(notes));
+				notes.push_back(newNote);
+				
+			
+				
+				//newBeatLocation = getBeatPositionForTickCount(t, myMidiEvents);
+				
+				//	printf("%i channel %i durn %i pitch %i vel %i event time %f beat pos %f\n", t, ch, (int)j->getDuration(), (int)j->getPitch(), (int)j->getVelocity(), myMidiEvents.getEventTimeMillis(t)
+				//		   , newBeatLocation);
+				
+				
+				
+				//	printf("Beat location %3.2f\n", newBeatLocation);
+				
+			/*
+				v.clear();
+				
+				//	printf("note on at %i\n", t);
+				
+				//if (!chopBeginning)
+				v.push_back(t);
+				//else
+				//	v.push_back(t - firstTickTime);
+				
+				v.push_back(j->getPitch());
+				v.push_back(j->getVelocity());
+				v.push_back(j->getDuration());
+			 */
+				/*
+				myMidiEvents.recordedNoteOnMatrix.push_back(v);
+				myMidiEvents.noteOnMatches.push_back(false);
+				myMidiEvents.beatPositions.push_back(newBeatLocation);
+				*/
+				
+				break;
+				
+			case MIDI_POLY_AFTERTOUCH:
+				if (printMidiInfo)
+					std::cout << t << ": Polyphonic aftertouch: channel " << ch
+					<< " pitch " << j->getPitch()
+					<< " pressure " << j->getData2() << endl;
+				break;
+				
+			case MIDI_CTRL_CHANGE:
+			{
+				int controller = j->getData1();
+				std::string name;
+				switch (controller) {
+					case MIDI_CONTROLLER_BANK_MSB: name = "Bank select MSB"; break;
+					case MIDI_CONTROLLER_VOLUME: name = "Volume"; break;
+					case MIDI_CONTROLLER_BANK_LSB: name = "Bank select LSB"; break;
+					case MIDI_CONTROLLER_MODULATION: name = "Modulation wheel"; break;
+					case MIDI_CONTROLLER_PAN: name = "Pan"; break;
+					case MIDI_CONTROLLER_SUSTAIN: name = "Sustain"; break;
+					case MIDI_CONTROLLER_RESONANCE: name = "Resonance"; break;
+					case MIDI_CONTROLLER_RELEASE: name = "Release"; break;
+					case MIDI_CONTROLLER_ATTACK: name = "Attack"; break;
+					case MIDI_CONTROLLER_FILTER: name = "Filter"; break;
+					case MIDI_CONTROLLER_REVERB: name = "Reverb"; break;
+					case MIDI_CONTROLLER_CHORUS: name = "Chorus"; break;
+					case MIDI_CONTROLLER_NRPN_1: name = "NRPN 1"; break;
+					case MIDI_CONTROLLER_NRPN_2: name = "NRPN 2"; break;
+					case MIDI_CONTROLLER_RPN_1: name = "RPN 1"; break;
+					case MIDI_CONTROLLER_RPN_2: name = "RPN 2"; break;
+					case MIDI_CONTROLLER_SOUNDS_OFF: name = "All sounds off"; break;
+					case MIDI_CONTROLLER_RESET: name = "Reset"; break;
+					case MIDI_CONTROLLER_LOCAL: name = "Local"; break;
+					case MIDI_CONTROLLER_ALL_NOTES_OFF: name = "All notes off"; break;
+				}
+				if (printMidiInfo){
+					std::cout << t << ": Controller change: channel " << ch
+					<< " controller " << j->getData1();
+					if (name != "") std::cout << " (" << name << ")";
+					std::cout << " value " << j->getData2() << endl;
+				}
+			}
+				break;
+				
+			case MIDI_PROG_CHANGE:
+				if (printMidiInfo)
+					std::cout << t << ": Program change: channel " << ch
+					<< " program " << j->getData1() << endl;
+				break;
+				
+			case MIDI_CHNL_AFTERTOUCH:
+				if (printMidiInfo)
+					std::cout << t << ": Channel aftertouch: channel " << ch
+					<< " pressure " << j->getData1() << endl;
+				break;
+				
+			case MIDI_PITCH_BEND:
+				if (printMidiInfo)
+					std::cout << t << ": Pitch bend: channel " << ch
+					<< " value " << (int)j->getData2() * 128 + (int)j->getData1() << endl;
+				break;
+				
+			case MIDI_SYSTEM_EXCLUSIVE:
+				if (printMidiInfo)
+					std::cout << t << ": System exclusive: code "
+					<< (int)j->getMessageType() << " message length " <<
+					j->getMetaMessage().length() << endl;
+				break;
+				
+				
 		}
 		
 		
 	}
+}
 
-}//end midi main reading
 
+void MIDIFileLoader::setNoteTimes(const MIDIScore& score, std::vector<noteData>::iterator begin, std::vector<noteData>::iterator end) const{
+	for (std::vector<noteData>::iterator note = begin; note != end; ++note){
+		note->timeMillis = score.ticksToMillis(note->ticks);
+		note->durationMillis = score.durationToMillis(note->ticks, note->durationTicks);
+		if (printMidiInfo)
+			printf("ticks %i event time %f dur %f\n", note->ticks, note->timeMillis, note->durationMillis);
+	}
+}
 
-double MIDIFileLoader::updateElapsedTime(int ticksNow){
 
-	double millisNow = ((beatPeriod * (ticksNow - lastTick)) / (double) pulsesPerQuarternote);//update time elapsed since we last updated
-	printf("ticks elapsed %i, last millis %f elapsed millis %f\n", (ticksNow - lastTick), lastMillis, millisNow);
+//new score from an old one with some of its tracks re-decoded
+//changedTracks maps track number to the bytes of its MTrk chunk (after the 8 byte chunk header)
+MIDIScorePtr MIDIFileLoader::patchTracks(const MIDIScore& oldScore, const std::map<unsigned int, std::string>& changedTracks) const{
+	std::shared_ptr<MIDIScore> score(new MIDIScore(oldScore));
 	
-	millisNow += lastMillis;
+	std::vector<noteData> newNotes;
+	std::vector<MIDITempoSegment> newTempoChanges;
+	std::vector<MIDIChannelEvent> newChannelEvents;
+	for (std::map<unsigned int, std::string>::const_iterator i = changedTracks.begin(); i != changedTracks.end(); ++i){
+		MIDITrack track;
+		if (!MIDIFileReader::parseTrackChunk(i->second, i->first, track))
+			return MIDIScorePtr();
+		readTrack(i->first, track, newNotes, newTempoChanges, newChannelEvents, 0);
+	}
 	
-	lastTick = ticksNow;
-	lastMillis = millisNow;
+	//keep everything that came from an unchanged track
+	std::vector<MIDITempoSegment> tempoChanges;
+	for (int k = 0; k < oldScore.tempoChanges.size(); k++){
+		if (changedTracks.find(oldScore.tempoChanges[k].track) == changedTracks.end())
+			tempoChanges.push_back(oldScore.tempoChanges[k]);
+	}
+	bool tempoChanged = !newTempoChanges.empty() || tempoChanges.size() != oldScore.tempoChanges.size();
+	tempoChanges.insert(tempoChanges.end(), newTempoChanges.begin(), newTempoChanges.end());
 	
-	return millisNow;
-}
-
-double MIDIFileLoader::ticksToMillis(int ticks){
-	return (beatPeriod * ticks / (double) pulsesPerQuarternote);
+	score->notes.clear();
+	for (int k = 0; k < oldScore.notes.size(); k++){
+		if (changedTracks.find(oldScore.notes[k].track) == changedTracks.end())
+			score->notes.push_back(oldScore.notes[k]);
+	}
+	size_t keptCount = score->notes.size();
+	
+	if (tempoChanged){
+		score->tempoChanges = tempoChanges;
+		score->setTempoChanges(tempoChanges, firstBeatPeriod);
+		setNoteTimes(*score, score->notes.begin(), score->notes.end());
+	}
+	
+	setNoteTimes(*score, newNotes.begin(), newNotes.end());
+	std::stable_sort(newNotes.begin(), newNotes.end(), noteOnsetCompare);
+	
+	//both halves are in onset then track order already, same as a full load
+	score->notes.insert(score->notes.end(), newNotes.begin(), newNotes.end());
+	std::inplace_merge(score->notes.begin(), score->notes.begin() + keptCount, score->notes.end(), noteOnsetCompare);
+	
+	score->channelEvents.clear();
+	for (int k = 0; k < oldScore.channelEvents.size(); k++){
+		if (changedTracks.find(oldScore.channelEvents[k].track) == changedTracks.end())
+			score->channelEvents.push_back(oldScore.channelEvents[k]);
+	}
+	keptCount = score->channelEvents.size();
+	std::stable_sort(newChannelEvents.begin(), newChannelEvents.end(), channelEventCompare);
+	score->channelEvents.insert(score->channelEvents.end(), newChannelEvents.begin(), newChannelEvents.end());
+	std::inplace_merge(score->channelEvents.begin(), score->channelEvents.begin() + keptCount, score->channelEvents.end(), channelEventCompare);
+	
+	score->fingerprint.compute(*score);
+	
+	return score;
 }
 
 
@@ -367,14 +664,32 @@ void MIDIFileLoader::printNoteData(){
 	}
 }
 
+void MIDIFileLoader::getNoteColumns(MIDINoteColumns& columns) const{
+	columns.assign(midiEvents);
+}
+
 void MIDIFileLoader::filterMidiEvents(){
-	int index = 0;
-	while (index < midiEvents.size()){
-		if (filterEvent(index))
-			midiEvents.erase(midiEvents.begin()+index);
-		else 
-			index++;
+	//one pass, remembering when each pitch was last kept - the same answer as
+	//asking filterEvent() about every note, as the notes are in time order,
+	//but without rescanning the window or erasing from the middle each time
+	double lastKept[128];
+	for (int p = 0; p < 128; p++)
+		lastKept[p] = -std::numeric_limits<double>::infinity();
+	
+	int kept = 0;
+	for (int index = 0; index < midiEvents.size(); index++){
+		int pitch = midiEvents[index].pitch;
+		double time = midiEvents[index].timeMillis;
+		if (pitch >= 0 && pitch < 128){
+			if (lastKept[pitch] > time - repeatCutoff)
+				continue;
+			lastKept[pitch] = time;
+		}
+		if (kept != index)
+			midiEvents[kept] = midiEvents[index];
+		kept++;
 	}
+	midiEvents.resize(kept);
 }
 
 bool MIDIFileLoader::filterEvent(int index){
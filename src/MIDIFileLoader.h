@@ -11,44 +11,100 @@
 #define MIDI_FILE_LOADER
 
 #include "MIDIFileReader.h"
-using namespace MIDIConstants;
-#include "vector.h"
-	
-struct noteData {
-	float beatPosition;//in beats from beginning
-	int pitch;//as MIDI note number
-	double timeMillis;
-	int ticks;
-	int velocity;
-	long  durationTicks;
-	double durationMillis;
+#include <vector>
+#include "MIDIScore.h"
+#include "MIDINoteColumns.h"
+#include <map>
+#include <list>
+
+//handle on a load running in the background (see MIDIFileLoader::loadFileAsync)
+class MIDIAsyncLoad{
+public:
+	MIDIAsyncLoad() : finished(false), sequence(0) {}
+	
+	bool isFinished() const { return finished.load(std::memory_order_acquire); }
+	void cancel() { progress.cancelled = true; }//cooperative - the parse stops at its next check
+	bool isCancelled() const { return progress.cancelled; }
+	MIDIScorePtr getScore() const { return isFinished() ? score : MIDIScorePtr(); }//null if it failed or was cancelled
+	
+	float getFraction() const;//0 to 1, by bytes parsed
+	size_t getBytesParsed() const { return progress.bytesParsed; }
+	unsigned getTracksDone() const { return progress.tracksDone; }
+	unsigned getTotalTracks() const { return progress.totalTracks; }
+	
+	std::string path;
+	MIDIParseProgress progress;
+	
+private:
+	friend class MIDIFileLoader;
+	std::atomic<bool> finished;
+	MIDIScorePtr score;//written by the load thread before finished is set
+	int sequence;
 };
 
+typedef std::shared_ptr<MIDIAsyncLoad> MIDIAsyncLoadPtr;
+
+
 class MIDIFileLoader{
 public:
 	MIDIFileLoader();
 	
+	//parses into a new score, touches no loader state so can be called from any thread
+	//result, if given, gets how the parse went - the only way to tell why a null came back
+	MIDIScorePtr loadScore(const std::string& filename, const MIDIParseOptions& options = MIDIParseOptions(), MIDIParseResult* result = 0) const;
+	MIDIScorePtr loadScore(const void* data, size_t size, const std::string& name = "", const MIDIParseOptions& options = MIDIParseOptions(), MIDIParseResult* result = 0) const;//parses the caller's bytes in place
+	MIDIScorePtr loadScore(std::istream& stream, const std::string& name = "", const MIDIParseOptions& options = MIDIParseOptions(), MIDIParseResult* result = 0) const;
+	
+	//every MIDI member of a zip (.mid, .midi or .kar, gzipped or not), inflated and parsed on a pool of threads
+	//scores come back in archive order, named archive/member, with a null for each one that failed
+	//progress, sink and stats are per file so they aren't passed on
+	std::vector<MIDIScorePtr> loadArchive(const std::string& path, int threads = 0, std::vector<std::string>* memberNames = 0, const MIDIParseOptions& options = MIDIParseOptions()) const;
+	
+	//header and meta events only, for cataloguing - as MIDIFileReader::probe, but with
+	//durationMillis timed the way loadScore times the notes
+	MIDIParseResult probe(const std::string& filename, MIDIProbeInfo& info) const;
+	MIDIParseResult probe(const void* data, size_t size, MIDIProbeInfo& info) const;
+	
+	//re-decodes just the given tracks (track number -> MTrk chunk data) and patches them into a copy of oldScore
+	MIDIScorePtr patchTracks(const MIDIScore& oldScore, const std::map<unsigned int, std::string>& changedTracks) const;
+	
+	//loads, publishes the new score and refreshes midiEvents
 	int loadFile(std::string& filename);
 	
-	double updateElapsedTime(int ticksNow);
-	double ticksToMillis(int ticks);
+	//loads on a background thread and returns straight away
+	//call update() from the main loop - it publishes the score once it's ready, in the order loads were asked for
+	MIDIAsyncLoadPtr loadFileAsync(const std::string& filename);
+	bool update();//true if a new score was published
+	
+	//the current score for other threads - they keep whatever they loaded until they ask again
+	MIDIScorePtr getScore() const { return currentScore.load(); }
+	void publishScore(MIDIScorePtr score);
 	
 	void printNoteData();
+	void getNoteColumns(MIDINoteColumns& columns) const;//column (SoA) copy of midiEvents
 	void filterMidiEvents();
 	bool filterEvent(int index);
 	
 	//newTimeSignature(int ticks, int numerator, int denominator);
 	//where we store the info
+	//working copy of the last published score, for the thread that calls loadFile
 	std::vector<noteData> midiEvents;
 	
-	int lastTick;
-	double lastMillis;
-	
-	double beatPeriod;
 	bool printMidiInfo;
-	int pulsesPerQuarternote;
 	
 	//	int lastMeasurePosition;
+	
+private:
+	MIDIScorePtr readScore(const MIDIFileReader& fr, const std::string& filename, const MIDIParseOptions& options, MIDIParseResult* result) const;
+	void readTrack(unsigned int trackNum, const MIDITrack& track, std::vector<noteData>& notes, std::vector<MIDITempoSegment>& tempoChanges, std::vector<MIDIChannelEvent>& channelEvents, MIDILoadStats* stats) const;
+	void timeProbe(MIDIProbeInfo& info) const;
+	void setNoteTimes(const MIDIScore& score, std::vector<noteData>::iterator begin, std::vector<noteData>::iterator end) const;
+	
+	MIDIScoreSlot currentScore;
+	
+	std::list<MIDIAsyncLoadPtr> pendingLoads;
+	int lastAsyncSequence;
+	int publishedSequence;
 };
 #endif
 
@@ -60,7 +116,6 @@ public:
 #include "MIDIFileReader.h"
 //#include "MIDIEvent.h"
 #include "midiEventHolder.h"
-using namespace MIDIConstants;
 
 class CannamMidiFileLoader{
 	
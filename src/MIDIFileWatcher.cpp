@@ -0,0 +1,334 @@
+/*
+ *  MIDIFileWatcher.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#include "MIDIFileWatcher.h"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <limits.h>
+#endif
+
+using namespace MIDIConstants;
+
+//FNV-1a, plenty to tell whether a chunk changed
+static uint64_t hashBytes(const char* data, size_t length){
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < length; i++){
+		hash ^= (unsigned char) data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static long chunkLength(const std::string& data, size_t offset){
+	return ((long)(unsigned char)data[offset] << 24) | ((long)(unsigned char)data[offset+1] << 16)
+			| ((long)(unsigned char)data[offset+2] << 8) | (long)(unsigned char)data[offset+3];
+}
+
+static std::string directoryOf(const std::string& path){
+	size_t slash = path.find_last_of('/');
+	if (slash == std::string::npos)
+		return ".";
+	if (slash == 0)
+		return "/";
+	return path.substr(0, slash);
+}
+
+static std::string fileNameOf(const std::string& path){
+	size_t slash = path.find_last_of('/');
+	return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+
+MIDIFileWatcher::MIDIFileWatcher(MIDIFileLoader& midiLoader) : loader(midiLoader){
+	lastChangedTracks = 0;
+	notifyDescriptor = -1;
+#ifdef __linux__
+	notifyDescriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (notifyDescriptor < 0 && loader.printMidiInfo)
+		printf("MIDIFileWatcher: inotify unavailable, polling instead\n");
+#endif
+}
+
+MIDIFileWatcher::~MIDIFileWatcher(){
+	//they use the loader, which may not be around much longer
+	for (int i = 0; i < jobs.size(); i++)
+		jobs[i]->thread.join();
+	
+#ifdef __linux__
+	if (notifyDescriptor >= 0)
+		close(notifyDescriptor);//drops all the watches with it
+#endif
+}
+
+
+void MIDIFileWatcher::watch(const std::string& path){
+	for (int i = 0; i < files.size(); i++){
+		if (files[i].path == path)
+			return;
+	}
+	
+	WatchedFile file;
+	file.path = path;
+	file.watchDescriptor = -1;
+	file.modifiedTime = 0;
+	file.fileSize = 0;
+	file.job = 0;
+	file.changedAgain = false;
+	
+	//the loader's current score can be taken as it is - anything else is loaded by the job
+	MIDIScorePtr current = loader.getScore();
+	if (current && current->path == path)
+		file.score = current;
+	
+	changedOnDisk(file);//just records the current modification time
+	addWatch(file);
+	files.push_back(file);
+	startJob(files.back(), true);
+}
+
+void MIDIFileWatcher::addWatch(WatchedFile& file){
+#ifdef __linux__
+	if (notifyDescriptor < 0)
+		return;
+	
+	//watch the directory rather than the file - editors and DAWs often save by
+	//writing a new file and renaming it over the old one
+	std::string directory = directoryOf(file.path);
+	for (int i = 0; i < files.size(); i++){
+		if (directoryOf(files[i].path) == directory && files[i].watchDescriptor >= 0){
+			file.watchDescriptor = files[i].watchDescriptor;
+			return;
+		}
+	}
+	file.watchDescriptor = inotify_add_watch(notifyDescriptor, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+#endif
+}
+
+void MIDIFileWatcher::unwatch(const std::string& path){
+	for (int i = 0; i < files.size(); i++){
+		if (files[i].path != path)
+			continue;
+		
+		int descriptor = files[i].watchDescriptor;
+		files.erase(files.begin() + i);
+		
+#ifdef __linux__
+		bool shared = false;
+		for (int k = 0; k < files.size(); k++){
+			if (files[k].watchDescriptor == descriptor)
+				shared = true;
+		}
+		if (descriptor >= 0 && !shared)
+			inotify_rm_watch(notifyDescriptor, descriptor);
+#endif
+		return;
+	}
+}
+
+MIDIScorePtr MIDIFileWatcher::getScore(const std::string& path) const{
+	for (int i = 0; i < files.size(); i++){
+		if (files[i].path == path)
+			return files[i].score;
+	}
+	return MIDIScorePtr();
+}
+
+
+bool MIDIFileWatcher::update(){
+	std::vector<bool> touched(files.size(), false);
+	
+#ifdef __linux__
+	if (notifyDescriptor >= 0){
+		char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+		ssize_t length;
+		while ((length = read(notifyDescriptor, buffer, sizeof(buffer))) > 0){
+			for (char* p = buffer; p < buffer + length; ){
+				struct inotify_event* event = (struct inotify_event*) p;
+				if (event->len > 0){
+					for (int i = 0; i < files.size(); i++){
+						if (files[i].watchDescriptor == event->wd && fileNameOf(files[i].path) == event->name)
+							touched[i] = true;
+					}
+				}
+				p += sizeof(struct inotify_event) + event->len;
+			}
+		}
+	}
+#endif
+	
+	for (int i = 0; i < files.size(); i++){
+		if (files[i].watchDescriptor < 0)
+			touched[i] = changedOnDisk(files[i]);
+		
+		if (!touched[i])
+			continue;
+		if (files[i].job)
+			files[i].changedAgain = true;
+		else
+			startJob(files[i], false);
+	}
+	
+	bool reloaded = false;
+	for (int i = 0; i < jobs.size(); ){
+		if (!jobs[i]->finished.load(std::memory_order_acquire)){
+			i++;
+			continue;
+		}
+		JobPtr job = jobs[i];
+		job->thread.join();//already done, so this doesn't wait
+		jobs.erase(jobs.begin() + i);
+		if (finishJob(*job))
+			reloaded = true;
+	}
+	return reloaded;
+}
+
+bool MIDIFileWatcher::changedOnDisk(WatchedFile& file){
+	struct stat info;
+	if (stat(file.path.c_str(), &info) != 0)
+		return false;
+	
+	bool changed = info.st_mtime != file.modifiedTime || info.st_size != file.fileSize;
+	file.modifiedTime = info.st_mtime;
+	file.fileSize = info.st_size;
+	return changed;
+}
+
+
+//splits the file into its header and track chunks, skipping any unknown chunk types
+bool MIDIFileWatcher::readChunks(const std::string& path, std::string& fileData, std::string& header, std::vector<size_t>& trackOffsets, std::vector<size_t>& trackLengths) const{
+	std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+	if (!in)
+		return false;
+	std::ostringstream contents;
+	contents << in.rdbuf();
+	fileData = contents.str();
+	
+	if (fileData.length() < 14 || fileData.compare(0, 4, MIDI_FILE_HEADER) != 0)
+		return false;
+	
+	size_t offset = 8 + chunkLength(fileData, 4);
+	header = fileData.substr(0, offset);
+	
+	while (offset + 8 <= fileData.length()){
+		size_t length = chunkLength(fileData, offset + 4);
+		if (offset + 8 + length > fileData.length())
+			return false;//truncated, probably still being written
+		
+		if (fileData.compare(offset, 4, MIDI_TRACK_HEADER) == 0){
+			trackOffsets.push_back(offset + 8);
+			trackLengths.push_back(length);
+		}
+		offset += 8 + length;
+	}
+	return true;
+}
+
+void MIDIFileWatcher::startJob(WatchedFile& file, bool first){
+	JobPtr job(new Job());
+	job->path = file.path;
+	job->first = first;
+	job->oldScore = file.score;
+	job->oldHeader = file.header;
+	job->oldHashes = file.trackHashes;
+	
+	file.job = job.get();
+	file.changedAgain = false;
+	
+	Job* running = job.get();
+	job->thread = std::thread([this, running](){
+		run(*running);
+		running->finished.store(true, std::memory_order_release);
+	});
+	jobs.push_back(job);
+}
+
+//everything that's as big as the file - loader.loadScore and patchTracks are safe from any thread
+void MIDIFileWatcher::run(Job& job) const{
+	std::string fileData;
+	std::vector<size_t> offsets, lengths;
+	bool readOK = readChunks(job.path, fileData, job.header, offsets, lengths);
+	if (readOK){
+		for (int i = 0; i < offsets.size(); i++)
+			job.hashes.push_back(hashBytes(fileData.data() + offsets[i], lengths[i]));
+	}
+	
+	//hashes of what we've got now, so the first save only reloads what it touched
+	if (job.first){
+		job.score = job.oldScore ? job.oldScore : loader.loadScore(job.path);
+		job.changed = true;
+		return;
+	}
+	
+	if (!readOK)
+		return;
+	
+	//same layout - decode only the tracks that changed
+	if (job.header == job.oldHeader && job.hashes.size() == job.oldHashes.size() && job.oldScore && job.oldScore->numberOfTracks == job.hashes.size()){
+		std::map<unsigned int, std::string> changedTracks;
+		for (int i = 0; i < job.hashes.size(); i++){
+			if (job.hashes[i] != job.oldHashes[i])
+				changedTracks[i] = fileData.substr(offsets[i], lengths[i]);
+		}
+		
+		if (changedTracks.empty())
+			return;//touched but saved unchanged
+		
+		job.score = loader.patchTracks(*job.oldScore, changedTracks);
+		job.changedTracks = changedTracks.size();
+	}
+	
+	if (!job.score){
+		job.score = loader.loadScore(job.path);
+		job.changedTracks = -1;
+	}
+	
+	job.changed = job.score != 0;//if not, leave the old score in place, we'll try again on the next change
+}
+
+//back on the main thread - true if it reloaded a watched file
+bool MIDIFileWatcher::finishJob(Job& job){
+	WatchedFile* file = 0;
+	for (int i = 0; i < files.size(); i++){
+		if (files[i].job == &job)
+			file = &files[i];
+	}
+	if (!file)
+		return false;//unwatched while it ran
+	
+	file->job = 0;
+	bool reloaded = false;
+	
+	if (job.changed){
+		MIDIScorePtr current = loader.getScore();
+		bool isCurrent = current && current->path == file->path;
+		
+		file->score = job.score;
+		file->header = job.header;
+		file->trackHashes = job.hashes;
+		
+		if (!job.first){
+			lastChangedTracks = job.changedTracks;
+			if (loader.printMidiInfo)
+				printf("MIDIFileWatcher: reloaded '%s' (%i tracks changed)\n", file->path.c_str(), lastChangedTracks);
+			if (isCurrent)
+				loader.publishScore(job.score);
+			reloaded = true;
+		}
+	}
+	
+	if (file->changedAgain)
+		startJob(*file, false);
+	return reloaded;
+}
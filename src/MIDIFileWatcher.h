@@ -0,0 +1,89 @@
+/*
+ *  MIDIFileWatcher.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#ifndef MIDI_FILE_WATCHER
+#define MIDI_FILE_WATCHER
+
+#include "MIDIFileLoader.h"
+#include <stdint.h>
+#include <sys/types.h>
+#include <thread>
+#include <atomic>
+
+//watches loaded files for saves (e.g. re-exporting from Logic) and reloads them
+//each MTrk chunk is hashed, and only tracks whose bytes changed get decoded again
+//uses inotify on Linux, elsewhere it checks modification times each update()
+//reading, hashing and decoding all happen on worker threads, as with MIDIFileLoader::loadFileAsync,
+//so the main loop only ever collects the results
+
+class MIDIFileWatcher{
+public:
+	MIDIFileWatcher(MIDIFileLoader& loader);
+	~MIDIFileWatcher();//waits for any reload still running
+	
+	//returns straight away - the file is hashed (and loaded, unless it's the loader's current score)
+	//on a worker thread, and watched from a later update() once that's done
+	void watch(const std::string& path);
+	void unwatch(const std::string& path);
+	
+	//call from the main loop, never blocks - returns true if any watched file was reloaded
+	//a reload of the loader's current file is published to it
+	bool update();
+	
+	MIDIScorePtr getScore(const std::string& path) const;//null until it's been loaded
+	
+	int lastChangedTracks;//tracks re-decoded by the last reload, -1 if it was a full load
+	
+private:
+	//one file's worth of work for a worker thread - it only reads what it's given and
+	//writes its own results, then sets finished for update() to collect
+	struct Job {
+		Job() : first(false), changed(false), changedTracks(-1), finished(false) {}
+		
+		std::string path;
+		bool first;//from watch() rather than a save
+		MIDIScorePtr oldScore;
+		std::string oldHeader;
+		std::vector<uint64_t> oldHashes;
+		
+		bool changed;//false if it couldn't be read or was saved unchanged
+		MIDIScorePtr score;
+		std::string header;
+		std::vector<uint64_t> hashes;
+		int changedTracks;
+		
+		std::thread thread;
+		std::atomic<bool> finished;
+	};
+	typedef std::shared_ptr<Job> JobPtr;
+	
+	struct WatchedFile {
+		std::string path;
+		MIDIScorePtr score;
+		std::string header;//MThd chunk
+		std::vector<uint64_t> trackHashes;//one per MTrk chunk
+		int watchDescriptor;
+		time_t modifiedTime;
+		off_t fileSize;
+		const Job* job;//the one running for it, if any
+		bool changedAgain;//saved again while it was, so reload once more when it's done
+	};
+	
+	bool readChunks(const std::string& path, std::string& fileData, std::string& header, std::vector<size_t>& trackOffsets, std::vector<size_t>& trackLengths) const;
+	void startJob(WatchedFile& file, bool first);
+	void run(Job& job) const;//on the worker thread
+	bool finishJob(Job& job);
+	bool changedOnDisk(WatchedFile& file);
+	void addWatch(WatchedFile& file);
+	
+	MIDIFileLoader& loader;
+	std::vector<WatchedFile> files;
+	std::vector<JobPtr> jobs;
+	int notifyDescriptor;
+};
+#endif
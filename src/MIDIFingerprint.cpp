@@ -0,0 +1,142 @@
+/*
+ *  MIDIFingerprint.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#include "MIDIFingerprint.h"
+#include "MIDIScore.h"
+#include <algorithm>
+
+static const uint64_t fnvOffset = 14695981039346656037ULL;
+static const uint64_t fnvPrime = 1099511628211ULL;
+
+static uint64_t hashValue(uint64_t hash, uint64_t value){
+	for (int i = 0; i < 8; i++){
+		hash ^= (value >> (i * 8)) & 0xFF;
+		hash *= fnvPrime;
+	}
+	return hash;
+}
+
+//finaliser from MurmurHash3, cheap way to get independent-ish hash functions from one hash and a seed
+static uint64_t mix(uint64_t h){
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+void MIDIFingerprint::clear(){
+	exact = fnvOffset;
+	noteCount = 0;
+	for (int i = 0; i < hashes; i++)
+		minHash[i] = 0xFFFFFFFF;
+}
+
+void MIDIFingerprint::compute(const MIDIScore& score){
+	clear();
+	int ppq = score.pulsesPerQuarternote > 0 ? score.pulsesPerQuarternote : 480;
+	
+	//onset | pitch | duration packed so sorting the numbers sorts the notes
+	std::vector<uint64_t> canonical;
+	canonical.reserve(score.notes.size());
+	for (int i = 0; i < score.notes.size(); i++){
+		const noteData& note = score.notes[i];
+		uint64_t onset = ((uint64_t)note.ticks * resolution + ppq / 2) / ppq;
+		uint64_t duration = note.durationTicks > 0 ? ((uint64_t)note.durationTicks * resolution + ppq / 2) / ppq : 0;
+		if (duration > 0xFFFF)
+			duration = 0xFFFF;
+		canonical.push_back((onset << 24) | ((uint64_t)(note.pitch & 0x7F) << 16) | duration);
+	}
+	std::sort(canonical.begin(), canonical.end());
+	//the same note twice on different tracks is a doubling, not new material
+	canonical.erase(std::unique(canonical.begin(), canonical.end()), canonical.end());
+	
+	noteCount = canonical.size();
+	for (int i = 0; i < canonical.size(); i++)
+		exact = hashValue(exact, canonical[i]);
+	
+	//shingles of three notes: pitches and the gaps between them, so position in the piece doesn't matter
+	for (int i = 0; i + 2 < canonical.size(); i++){
+		uint64_t shingle = fnvOffset;
+		for (int k = 0; k < 3; k++){
+			uint64_t note = canonical[i + k];
+			uint64_t gap = k > 0 ? (note >> 24) - (canonical[i + k - 1] >> 24) : 0;
+			shingle = hashValue(shingle, ((note >> 16) & 0x7F) | (gap << 8));
+		}
+		for (int h = 0; h < hashes; h++){
+			uint32_t value = mix(shingle + 0x9E3779B97F4A7C15ULL * (h + 1));
+			if (value < minHash[h])
+				minHash[h] = value;
+		}
+	}
+}
+
+uint64_t MIDIFingerprint::bandKey(int band) const{
+	const int rows = hashes / bands;
+	uint64_t key = hashValue(fnvOffset, band);
+	for (int r = 0; r < rows; r++)
+		key = hashValue(key, minHash[band * rows + r]);
+	return key;
+}
+
+double MIDIFingerprint::similarity(const MIDIFingerprint& other) const{
+	if (!hasSignature() || !other.hasSignature())
+		return 0;//all the minHashes would be left at their initial value and agree
+	int same = 0;
+	for (int h = 0; h < hashes; h++){
+		if (minHash[h] == other.minHash[h])
+			same++;
+	}
+	return same / (double) hashes;
+}
+
+
+void MIDIFingerprintIndex::clear(){
+	fingerprints.clear();
+	exact.clear();
+	bandBuckets.clear();
+}
+
+void MIDIFingerprintIndex::add(int id, const MIDIFingerprint& fingerprint){
+	fingerprints[id] = fingerprint;
+	exact.insert(std::make_pair(fingerprint.exact, id));
+	if (!fingerprint.hasSignature())
+		return;//every such score would land in the same buckets
+	for (int b = 0; b < MIDIFingerprint::bands; b++)
+		bandBuckets.insert(std::make_pair(fingerprint.bandKey(b), id));
+}
+
+void MIDIFingerprintIndex::findExact(const MIDIFingerprint& fingerprint, std::vector<int>& ids) const{
+	ids.clear();
+	std::pair<std::multimap<uint64_t, int>::const_iterator, std::multimap<uint64_t, int>::const_iterator> range = exact.equal_range(fingerprint.exact);
+	for (std::multimap<uint64_t, int>::const_iterator it = range.first; it != range.second; ++it){
+		if (fingerprints.find(it->second)->second == fingerprint)
+			ids.push_back(it->second);
+	}
+}
+
+void MIDIFingerprintIndex::findSimilar(const MIDIFingerprint& fingerprint, double threshold, std::vector<int>& ids) const{
+	ids.clear();
+	if (!fingerprint.hasSignature())
+		return;
+	for (int b = 0; b < MIDIFingerprint::bands; b++){
+		std::pair<std::multimap<uint64_t, int>::const_iterator, std::multimap<uint64_t, int>::const_iterator> range = bandBuckets.equal_range(fingerprint.bandKey(b));
+		for (std::multimap<uint64_t, int>::const_iterator it = range.first; it != range.second; ++it)
+			ids.push_back(it->second);
+	}
+	std::sort(ids.begin(), ids.end());
+	ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+	
+	int kept = 0;
+	for (int i = 0; i < ids.size(); i++){
+		if (fingerprints.find(ids[i])->second.similarity(fingerprint) >= threshold)
+			ids[kept++] = ids[i];
+	}
+	ids.resize(kept);
+}
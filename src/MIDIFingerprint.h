@@ -0,0 +1,62 @@
+/*
+ *  MIDIFingerprint.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#ifndef MIDI_FINGERPRINT
+#define MIDI_FINGERPRINT
+
+#include <vector>
+#include <map>
+#include <stdint.h>
+
+class MIDIScore;
+
+//what a file sounds like rather than how it's written down:
+//notes as (onset in quarter notes, pitch, duration), sorted, ignoring tracks, channels, velocities,
+//meta events and ppq - so re-saved, re-ordered and re-timed copies of a file come out the same
+//
+//exact is a hash of the whole list
+//minHash summarises the set of short note patterns, for near duplicates (an edited bar, a dropped track),
+//split into bands for locality sensitive hashing - scores sharing any band key are worth comparing
+
+struct MIDIFingerprint {
+	static const int hashes = 32;
+	static const int bands = 8;//of hashes / bands rows each
+	static const int resolution = 48;//steps per quarter note onsets are rounded to
+	
+	uint64_t exact;
+	uint32_t minHash[hashes];
+	int noteCount;
+	
+	void clear();
+	void compute(const MIDIScore& score);
+	
+	//a score with fewer than three distinct notes has no shingles, so no minHash to go on -
+	//it can still be matched exactly but is left out of the LSH bands
+	bool hasSignature() const { return noteCount >= 3; }
+	
+	uint64_t bandKey(int band) const;
+	double similarity(const MIDIFingerprint& other) const;//estimated Jaccard similarity, 0 to 1 - 0 without signatures
+	bool operator==(const MIDIFingerprint& other) const { return exact == other.exact && noteCount == other.noteCount; }
+};
+
+//hash join over fingerprints, instead of comparing every pair of files
+class MIDIFingerprintIndex{
+public:
+	void clear();
+	void add(int id, const MIDIFingerprint& fingerprint);
+	
+	void findExact(const MIDIFingerprint& fingerprint, std::vector<int>& ids) const;
+	//candidates from the LSH bands, checked against the threshold - nothing for a fingerprint without a signature
+	void findSimilar(const MIDIFingerprint& fingerprint, double threshold, std::vector<int>& ids) const;
+	
+private:
+	std::map<int, MIDIFingerprint> fingerprints;
+	std::multimap<uint64_t, int> exact;
+	std::multimap<uint64_t, int> bandBuckets;//band number is mixed into the key
+};
+#endif
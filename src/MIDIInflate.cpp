@@ -0,0 +1,460 @@
+/*
+ *  MIDIInflate.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#include "MIDIInflate.h"
+#include <algorithm>
+#include <cstring>
+
+static const size_t inputBlockSize = 65536;
+static const size_t historySize = 8;//kept back over a refill, so a few bytes can be given back
+static const size_t outputBlockSize = 65536;
+
+MIDIInflateInput::MIDIInflateInput(const void* data, size_t size) :
+	next((const unsigned char*)data), left(data ? size : 0), stream(0), streamLeft(0), bad(false){
+}
+
+MIDIInflateInput::MIDIInflateInput(std::istream& in, uint64_t limit) :
+	next(0), left(0), stream(&in), streamLeft(limit), bad(false){
+	block.resize(historySize + inputBlockSize);
+	next = &block[historySize];
+}
+
+//moves what's unread (and a little of what's been read, for unget) to the front and tops up from the stream
+bool MIDIInflateInput::refill(){
+	if (!stream || streamLeft == 0 || bad)
+		return false;
+
+	size_t history = std::min<size_t>(next - &block[0], historySize);
+	memmove(&block[historySize - history], next - history, history + left);
+	next = &block[historySize];
+
+	size_t room = block.size() - historySize - left;
+	size_t amount = (size_t)std::min<uint64_t>(room, streamLeft);
+	stream->read((char*)&block[historySize + left], amount);
+	size_t got = (size_t)stream->gcount();
+	if (stream->bad())
+		bad = true;
+	streamLeft -= got;
+	left += got;
+	return got > 0;
+}
+
+bool MIDIInflateInput::read(void* out, size_t n){
+	unsigned char* to = (unsigned char*)out;
+	while (n > 0){
+		if (left == 0 && !refill())
+			return false;
+		size_t amount = std::min(n, left);
+		memcpy(to, next, amount);
+		to += amount;
+		next += amount;
+		left -= amount;
+		n -= amount;
+	}
+	return true;
+}
+
+bool MIDIInflateInput::skip(size_t n){
+	while (n > 0){
+		if (left == 0 && !refill())
+			return false;
+		size_t amount = std::min(n, left);
+		next += amount;
+		left -= amount;
+		n -= amount;
+	}
+	return true;
+}
+
+bool MIDIInflateInput::peek(unsigned char* out, size_t n){
+	while (left < n){
+		if (!refill())
+			return false;
+	}
+	memcpy(out, next, n);
+	return true;
+}
+
+void MIDIInflateInput::unget(size_t n){
+	next -= n;
+	left += n;
+}
+
+
+//Huffman codes as deflate builds them, from a code length per symbol
+//codes up to fastBits long are looked up in one go, longer ones are worked out a bit at a time
+static const int maxBits = 15;
+static const int fastBits = 10;
+
+struct MIDIHuffman {
+	uint16_t fast[1 << fastBits];//symbol << 4 | length, 0 if the code is longer (or there isn't one)
+	uint16_t count[maxBits + 1];//codes of each length
+	uint16_t symbol[288];//in code order
+
+	//false if the lengths don't make a usable code - over-subscribed, or incomplete when that isn't allowed
+	bool build(const unsigned char* lengths, int n, bool allowIncomplete){
+		memset(count, 0, sizeof(count));
+		for (int s = 0; s < n; s++)
+			count[lengths[s]]++;
+		count[0] = 0;
+
+		int unused = 1;
+		int longest = 0;
+		for (int len = 1; len <= maxBits; len++){
+			unused = (unused << 1) - count[len];
+			if (unused < 0)
+				return false;
+			if (count[len])
+				longest = len;
+		}
+		//an incomplete code is only any use when it's a single one bit code, as deflate allows for
+		//distances - no codes at all is fine too, as long as none are asked for
+		if (unused > 0 && longest > 0 && !(allowIncomplete && longest == 1))
+			return false;
+
+		uint16_t offsets[maxBits + 2];
+		offsets[1] = 0;
+		for (int len = 1; len <= maxBits; len++)
+			offsets[len + 1] = offsets[len] + count[len];
+		for (int s = 0; s < n; s++){
+			if (lengths[s])
+				symbol[offsets[lengths[s]]++] = s;
+		}
+
+		//canonical codes in order, bit reversed for the table since deflate packs them high bit first
+		memset(fast, 0, sizeof(fast));
+		int code = 0;
+		int index = 0;
+		for (int len = 1; len <= fastBits; len++){
+			for (int i = 0; i < count[len]; i++, index++, code++){
+				int reversed = 0;
+				for (int b = 0; b < len; b++)
+					reversed |= ((code >> b) & 1) << (len - 1 - b);
+				for (int fill = reversed; fill < (1 << fastBits); fill += 1 << len)
+					fast[fill] = (uint16_t)(symbol[index] << 4 | len);
+			}
+			code <<= 1;
+		}
+		return true;
+	}
+};
+
+static const uint16_t lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t distanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t distanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+//the fixed codes, built once
+struct MIDIFixedCodes {
+	MIDIHuffman literals, distances;
+	MIDIFixedCodes(){
+		unsigned char lengths[288];
+		for (int s = 0; s < 288; s++)
+			lengths[s] = s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8;
+		literals.build(lengths, 288, false);
+		//32 distance codes to make the code complete, though the last two are never valid
+		for (int s = 0; s < 32; s++)
+			lengths[s] = 5;
+		distances.build(lengths, 32, false);
+	}
+};
+
+class MIDIInflater{
+public:
+	MIDIInflater(MIDIInflateInput& in, std::vector<char>& out, size_t& produced, size_t maxBytes) :
+		in(in), out(out), produced(produced), maxBytes(maxBytes), bits(0), count(0), result(MIDI_INFLATE_OK) {}
+
+	MIDIInflateResult run();
+
+private:
+	//bits come in least significant first
+	bool need(int n){
+		while (count < n){
+			unsigned char byte;
+			if (!in.get(byte))
+				return fail(MIDI_INFLATE_BAD_DATA);
+			bits |= (uint64_t)byte << count;
+			count += 8;
+		}
+		return true;
+	}
+	uint32_t take(int n){
+		uint32_t value = (uint32_t)(bits & ((1u << n) - 1));
+		bits >>= n;
+		count -= n;
+		return value;
+	}
+	bool fail(MIDIInflateResult why){
+		if (result == MIDI_INFLATE_OK)
+			result = in.failed() ? MIDI_INFLATE_NOT_READABLE : why;
+		return false;
+	}
+
+	bool decode(const MIDIHuffman& code, int& symbol);
+	bool room(size_t n);
+	bool stored();
+	bool dynamic();
+	bool codes(const MIDIHuffman& literals, const MIDIHuffman& distances);
+
+	MIDIInflateInput& in;
+	std::vector<char>& out;
+	size_t& produced;
+	size_t maxBytes;
+	uint64_t bits;
+	int count;
+	MIDIInflateResult result;
+	MIDIHuffman dynamicLiterals, dynamicDistances;
+};
+
+bool MIDIInflater::decode(const MIDIHuffman& code, int& symbol){
+	//whatever's there, up to a table's worth - near the end of the data there may be less
+	while (count < fastBits){
+		unsigned char byte;
+		if (!in.get(byte))
+			break;
+		bits |= (uint64_t)byte << count;
+		count += 8;
+	}
+
+	uint16_t entry = code.fast[bits & ((1 << fastBits) - 1)];
+	if (entry && (entry & 15) <= count){
+		take(entry & 15);
+		symbol = entry >> 4;
+		return true;
+	}
+
+	//a bit at a time, counting through the codes of each length
+	int value = 0, first = 0, index = 0;
+	for (int len = 1; len <= maxBits; len++){
+		if (!need(len))
+			return false;
+		value |= (int)((bits >> (len - 1)) & 1);
+		int n = code.count[len];
+		if (value - first < n){
+			take(len);
+			symbol = code.symbol[index + value - first];
+			return true;
+		}
+		index += n;
+		first = (first + n) << 1;
+		value <<= 1;
+	}
+	return fail(MIDI_INFLATE_BAD_DATA);
+}
+
+//makes sure there's space to write n more bytes, growing out by doubling but never past the limit
+bool MIDIInflater::room(size_t n){
+	if (maxBytes && (produced > maxBytes || n > maxBytes - produced))
+		return fail(MIDI_INFLATE_TOO_BIG);
+	if (produced + n <= out.size())
+		return true;
+	size_t grown = std::max(std::max(out.size() * 2, outputBlockSize), produced + n);
+	if (maxBytes && grown > maxBytes)
+		grown = maxBytes;
+	out.reserve(grown);//exactly - resize alone would be free to double it again
+	out.resize(grown);
+	return true;
+}
+
+bool MIDIInflater::stored(){
+	//to the byte boundary, then the length and its complement
+	take(count & 7);
+	unsigned char header[4];
+	for (int i = 0; i < 4; i++){
+		if (!need(8))
+			return false;
+		header[i] = (unsigned char)take(8);
+	}
+	size_t length = header[0] | (header[1] << 8);
+	if ((header[2] | (header[3] << 8)) != (~length & 0xFFFF))
+		return fail(MIDI_INFLATE_BAD_DATA);
+	if (!room(length))
+		return false;
+
+	//whole bytes already taken in for the bit buffer come first
+	while (length > 0 && count >= 8){
+		out[produced++] = (char)take(8);
+		length--;
+	}
+	if (length > 0 && !in.read(&out[produced], length))
+		return fail(MIDI_INFLATE_BAD_DATA);
+	produced += length;
+	return true;
+}
+
+bool MIDIInflater::dynamic(){
+	static const unsigned char order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+	if (!need(14))
+		return false;
+	int literalCount = take(5) + 257;
+	int distanceCount = take(5) + 1;
+	int lengthCount = take(4) + 4;
+	if (literalCount > 286 || distanceCount > 30)
+		return fail(MIDI_INFLATE_BAD_DATA);
+
+	unsigned char lengths[286 + 30];
+	memset(lengths, 0, 19);
+	for (int i = 0; i < lengthCount; i++){
+		if (!need(3))
+			return false;
+		lengths[order[i]] = (unsigned char)take(3);
+	}
+	MIDIHuffman lengthCode;
+	if (!lengthCode.build(lengths, 19, false))
+		return fail(MIDI_INFLATE_BAD_DATA);
+
+	//literal/length then distance code lengths, run length coded as one list
+	int total = literalCount + distanceCount;
+	for (int i = 0; i < total; ){
+		int symbol;
+		if (!decode(lengthCode, symbol))
+			return false;
+		if (symbol < 16){
+			lengths[i++] = (unsigned char)symbol;
+			continue;
+		}
+		int repeat;
+		unsigned char value = 0;
+		if (symbol == 16){
+			if (i == 0)
+				return fail(MIDI_INFLATE_BAD_DATA);
+			if (!need(2))
+				return false;
+			value = lengths[i - 1];
+			repeat = 3 + take(2);
+		} else if (symbol == 17){
+			if (!need(3))
+				return false;
+			repeat = 3 + take(3);
+		} else {
+			if (!need(7))
+				return false;
+			repeat = 11 + take(7);
+		}
+		if (i + repeat > total)
+			return fail(MIDI_INFLATE_BAD_DATA);
+		while (repeat-- > 0)
+			lengths[i++] = value;
+	}
+
+	if (lengths[256] == 0)//no way to end the block
+		return fail(MIDI_INFLATE_BAD_DATA);
+	if (!dynamicLiterals.build(lengths, literalCount, false) ||
+		!dynamicDistances.build(lengths + literalCount, distanceCount, true))
+		return fail(MIDI_INFLATE_BAD_DATA);
+
+	return codes(dynamicLiterals, dynamicDistances);
+}
+
+bool MIDIInflater::codes(const MIDIHuffman& literals, const MIDIHuffman& distances){
+	for (;;){
+		int symbol;
+		if (!decode(literals, symbol))
+			return false;
+
+		if (symbol < 256){
+			if (!room(1))
+				return false;
+			out[produced++] = (char)symbol;
+			continue;
+		}
+		if (symbol == 256)
+			return true;
+
+		symbol -= 257;
+		if (symbol >= 29)
+			return fail(MIDI_INFLATE_BAD_DATA);
+		if (!need(lengthExtra[symbol]))
+			return false;
+		size_t length = lengthBase[symbol] + take(lengthExtra[symbol]);
+
+		if (!decode(distances, symbol))
+			return false;
+		if (symbol >= 30)
+			return fail(MIDI_INFLATE_BAD_DATA);
+		if (!need(distanceExtra[symbol]))
+			return false;
+		size_t distance = distanceBase[symbol] + take(distanceExtra[symbol]);
+
+		if (distance > produced)
+			return fail(MIDI_INFLATE_BAD_DATA);
+		if (!room(length))
+			return false;
+
+		//overlapping copies repeat what they've just written, so byte by byte unless they're far enough back
+		char* to = &out[produced];
+		const char* from = to - distance;
+		if (distance >= length)
+			memcpy(to, from, length);
+		else {
+			for (size_t i = 0; i < length; i++)
+				to[i] = from[i];
+		}
+		produced += length;
+	}
+}
+
+MIDIInflateResult MIDIInflater::run(){
+	static const MIDIFixedCodes fixed;
+
+	bool last = false;
+	while (!last){
+		if (!need(3))
+			return result;
+		last = take(1) != 0;
+		int type = take(2);
+
+		bool ok;
+		if (type == 0)
+			ok = stored();
+		else if (type == 1)
+			ok = codes(fixed.literals, fixed.distances);
+		else if (type == 2)
+			ok = dynamic();
+		else
+			ok = fail(MIDI_INFLATE_BAD_DATA);
+		if (!ok)
+			return result;
+	}
+
+	//the stream ends on a byte boundary - whole bytes read ahead for lookups belong to what follows
+	take(count & 7);
+	in.unget(count / 8);
+	bits = 0;
+	count = 0;
+	return MIDI_INFLATE_OK;
+}
+
+MIDIInflateResult midiInflateRaw(MIDIInflateInput& in, std::vector<char>& out, size_t& produced, size_t maxBytes){
+	MIDIInflater inflater(in, out, produced, maxBytes);
+	return inflater.run();
+}
+
+
+//the usual reflected CRC-32, a byte at a time from a table
+struct MIDICrcTable {
+	uint32_t entries[256];
+	MIDICrcTable(){
+		for (uint32_t n = 0; n < 256; n++){
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++)
+				c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			entries[n] = c;
+		}
+	}
+};
+
+uint32_t midiCrc32(uint32_t crc, const void* data, size_t size){
+	static const MIDICrcTable table;
+	const unsigned char* p = (const unsigned char*)data;
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+		crc = table.entries[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
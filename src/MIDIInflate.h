@@ -0,0 +1,58 @@
+/*
+ *  MIDIInflate.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+//the deflate (RFC 1951) decoder behind MIDIArchive, so reading compressed files needs no other library
+//everything is inflated into memory anyway, so the output doubles as the window for back references
+
+#ifndef MIDI_INFLATE
+#define MIDI_INFLATE
+
+#include "MIDIArchive.h"
+#include <vector>
+#include <istream>
+#include <stdint.h>
+
+//compressed bytes from memory, or from a stream a block at a time
+class MIDIInflateInput{
+public:
+	MIDIInflateInput(const void* data, size_t size);
+	MIDIInflateInput(std::istream& in, uint64_t limit = (uint64_t)-1);//no more than limit bytes are read from in
+
+	bool get(unsigned char& byte){
+		if (left == 0 && !refill())
+			return false;
+		byte = *next++;
+		left--;
+		return true;
+	}
+	bool read(void* out, size_t n);//false if it runs out first
+	bool skip(size_t n);
+	bool peek(unsigned char* out, size_t n);//n of up to 8, left to be read again
+	void unget(size_t n);//give back up to 8 bytes just read
+
+	bool failed() const { return bad; }//the stream went bad, as opposed to running out
+
+private:
+	bool refill();
+
+	const unsigned char* next;
+	size_t left;
+	std::istream* stream;
+	uint64_t streamLeft;
+	std::vector<unsigned char> block;
+	bool bad;
+};
+
+//decodes one raw deflate stream, appending to out from produced - out.size() is what's allocated, produced
+//what's used, and both grow as needed but never past maxBytes (0 for no limit)
+//OK only once the final block has ended - input left after it is still there to read
+MIDIInflateResult midiInflateRaw(MIDIInflateInput& in, std::vector<char>& out, size_t& produced, size_t maxBytes);
+
+uint32_t midiCrc32(uint32_t crc, const void* data, size_t size);//start from 0
+
+#endif
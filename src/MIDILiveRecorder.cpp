@@ -0,0 +1,221 @@
+/*
+ *  MIDILiveRecorder.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#include "MIDILiveRecorder.h"
+#include <cmath>
+
+static const size_t none = (size_t)-1;
+
+MIDILiveQueue::MIDILiveQueue(size_t capacity) : head(0), tail(0){
+	size_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+	events.resize(size);
+	mask = size - 1;
+}
+
+bool MIDILiveQueue::push(const MIDILiveEvent& event){
+	size_t t = tail.load(std::memory_order_relaxed);
+	if (t - head.load(std::memory_order_acquire) == events.size())
+		return false;
+	events[t & mask] = event;
+	tail.store(t + 1, std::memory_order_release);
+	return true;
+}
+
+bool MIDILiveQueue::pop(MIDILiveEvent& event){
+	size_t h = head.load(std::memory_order_relaxed);
+	if (h == tail.load(std::memory_order_acquire))
+		return false;
+	event = events[h & mask];
+	head.store(h + 1, std::memory_order_release);
+	return true;
+}
+
+
+MIDILiveRecorder::MIDILiveRecorder(size_t queueSize, int ppq, double beatPeriod) :
+	publishInterval(50), queue(queueSize), dropped(0), running(false), lastMillis(0){
+	score.pulsesPerQuarternote = ppq;
+	std::vector<MIDITempoSegment> noChanges;
+	score.setTempoChanges(noChanges, beatPeriod);
+	score.numberOfTracks = 1;
+}
+
+MIDILiveRecorder::~MIDILiveRecorder(){
+	stop();
+}
+
+void MIDILiveRecorder::start(){
+	if (running)
+		return;
+
+	//a fresh score at the same tempo, and nothing left over from before
+	MIDIScore fresh;
+	fresh.pulsesPerQuarternote = score.pulsesPerQuarternote;
+	fresh.tempoMap = score.tempoMap;
+	fresh.numberOfTracks = 1;
+	score = fresh;
+
+	pendingHead.assign(16 * 128, none);
+	pendingTail.assign(16 * 128, none);
+	pendingNext.clear();
+	lastMillis = 0;
+	dropped = 0;
+
+	MIDILiveEvent stale;
+	while (queue.pop(stale)){}
+
+	publish(false);
+
+	startTime = std::chrono::steady_clock::now();
+	running.store(true, std::memory_order_release);
+	worker = std::thread(&MIDILiveRecorder::run, this);
+}
+
+void MIDILiveRecorder::stop(){
+	if (!running)
+		return;
+	running.store(false, std::memory_order_release);
+	worker.join();
+
+	drain();
+
+	//anything still held ends with the last event, like a note with no note-off at the end of a track
+	for (size_t key = 0; key < pendingHead.size(); key++){
+		for (size_t i = pendingHead[key]; i != none; i = pendingNext[i]){
+			noteData& note = score.notes[i];
+			note.durationMillis = lastMillis - note.timeMillis;
+			note.durationTicks = (long)floor(score.millisToTicks(lastMillis) + 0.5) - note.ticks;
+		}
+		pendingHead[key] = pendingTail[key] = none;
+	}
+
+	publish(true);
+}
+
+bool MIDILiveRecorder::push(uint8_t status, uint8_t data1, uint8_t data2, double millis){
+	MIDILiveEvent event;
+	event.millis = millis;
+	event.status = status;
+	event.data1 = data1;
+	event.data2 = data2;
+	if (queue.push(event))
+		return true;
+	dropped.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+bool MIDILiveRecorder::push(uint8_t status, uint8_t data1, uint8_t data2){
+	double millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+	return push(status, data1, data2, millis);
+}
+
+void MIDILiveRecorder::run(){
+	std::chrono::steady_clock::time_point lastPublish = std::chrono::steady_clock::now();
+	bool changed = false;
+
+	while (running.load(std::memory_order_acquire)){
+		if (drain())
+			changed = true;
+		else
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));//polling - the input thread mustn't have to wake us
+
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (changed && std::chrono::duration<double, std::milli>(now - lastPublish).count() >= publishInterval){
+			publish(false);
+			changed = false;
+			lastPublish = now;
+		}
+	}
+}
+
+bool MIDILiveRecorder::drain(){
+	bool any = false;
+	MIDILiveEvent event;
+	while (queue.pop(event)){
+		add(event);
+		any = true;
+	}
+	return any;
+}
+
+//pairing happens as the events come in - each note-off goes to the earliest held note of
+//the same pitch on the same channel, as the file reader pairs them
+void MIDILiveRecorder::add(const MIDILiveEvent& event){
+	int type = event.status & 0xF0;
+	if (type < 0x80 || type > 0xE0)
+		return;
+
+	if (event.millis > lastMillis)
+		lastMillis = event.millis;
+	int ticks = (int)floor(score.millisToTicks(event.millis) + 0.5);
+
+	MIDIChannelEvent channelEvent;
+	channelEvent.ticks = ticks;
+	channelEvent.track = 0;
+	channelEvent.status = event.status;
+	channelEvent.data1 = event.data1;
+	channelEvent.data2 = event.data2;
+	score.channelEvents.push_back(channelEvent);
+
+	if (type != 0x80 && type != 0x90)
+		return;
+
+	int channel = event.status & 0x0F;
+	size_t key = channel * 128 + (event.data1 & 0x7F);
+
+	if (type == 0x90 && event.data2 > 0){
+		noteData note;
+		note.timeMillis = event.millis;
+		note.ticks = ticks;
+		note.beatPosition = ticks / (float)score.pulsesPerQuarternote;
+		note.pitch = event.data1 & 0x7F;
+		note.velocity = event.data2;
+		note.channel = channel;
+		note.track = 0;
+		note.durationTicks = 0;
+		note.durationMillis = 0;
+
+		size_t index = score.notes.size();
+		score.notes.push_back(note);
+		pendingNext.push_back(none);
+		if (pendingTail[key] == none)
+			pendingHead[key] = index;
+		else
+			pendingNext[pendingTail[key]] = index;
+		pendingTail[key] = index;
+
+	} else if (pendingHead[key] != none){
+		noteData& note = score.notes[pendingHead[key]];
+		note.durationMillis = event.millis - note.timeMillis;
+		note.durationTicks = ticks - note.ticks;
+
+		pendingHead[key] = pendingNext[pendingHead[key]];
+		if (pendingHead[key] == none)
+			pendingTail[key] = none;
+	}
+}
+
+//copies the score so far for other threads - held notes get their duration up to now in the copy only
+void MIDILiveRecorder::publish(bool final){
+	std::shared_ptr<MIDIScore> snapshot(new MIDIScore(score));
+
+	long lastTicks = (long)floor(score.millisToTicks(lastMillis) + 0.5);
+	for (size_t key = 0; key < pendingHead.size(); key++){
+		for (size_t i = pendingHead[key]; i != none; i = pendingNext[i]){
+			noteData& note = snapshot->notes[i];
+			note.durationMillis = lastMillis - note.timeMillis;
+			note.durationTicks = lastTicks - note.ticks;
+		}
+	}
+
+	if (final)
+		snapshot->fingerprint.compute(*snapshot);
+
+	slot.publish(snapshot);
+}
@@ -0,0 +1,91 @@
+/*
+ *  MIDILiveRecorder.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+//records a live performance into the same noteData form the file loader gives,
+//so it can be lined up against the score it's following
+//the MIDI input thread only ever writes into a fixed ring buffer - no locks, no allocation -
+//and a background thread pairs up the note-offs and publishes snapshots of the score so far
+
+#ifndef MIDI_LIVE_RECORDER
+#define MIDI_LIVE_RECORDER
+
+#include "MIDIScore.h"
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+struct MIDILiveEvent {
+	double millis;
+	uint8_t status;
+	uint8_t data1;
+	uint8_t data2;
+};
+
+//single producer, single consumer, fixed size
+//push and pop are each a couple of loads and a store, so they never wait on the other side
+
+class MIDILiveQueue{
+public:
+	explicit MIDILiveQueue(size_t capacity);//rounded up to a power of two
+
+	bool push(const MIDILiveEvent& event);//false if it's full
+	bool pop(MIDILiveEvent& event);//false if it's empty
+
+	size_t capacity() const { return events.size(); }
+
+private:
+	std::vector<MIDILiveEvent> events;
+	size_t mask;
+	//on their own cache lines so the two threads don't keep stealing each other's
+	alignas(64) std::atomic<size_t> head;//next to pop, written by the consumer
+	alignas(64) std::atomic<size_t> tail;//next to push, written by the producer
+};
+
+class MIDILiveRecorder{
+public:
+	//the nominal tempo just gives the notes ticks and beat positions - the millis are what was played
+	MIDILiveRecorder(size_t queueSize = 4096, int ppq = 480, double beatPeriod = 500);
+	~MIDILiveRecorder();
+
+	void start();//times from push() without a time are measured from here
+	void stop();//takes in whatever's still queued, ends held notes there and publishes the final score
+	bool isRecording() const { return running.load(std::memory_order_relaxed); }
+
+	//from the MIDI input thread - wait-free, false (and counted) if the queue is full
+	//system and running status bytes aren't expected, give whole channel messages
+	bool push(uint8_t status, uint8_t data1, uint8_t data2, double millis);
+	bool push(uint8_t status, uint8_t data1, uint8_t data2);
+
+	//the score so far, from any thread - notes still held have their duration up to the latest event
+	//the fingerprint is only filled in once recording stops
+	MIDIScorePtr getScore() const { return slot.load(); }
+	size_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+	double publishInterval;//millis between snapshots while recording
+
+private:
+	void run();
+	bool drain();//true if anything came in
+	void add(const MIDILiveEvent& event);
+	void publish(bool final);
+
+	MIDILiveQueue queue;
+	std::atomic<size_t> dropped;
+	std::atomic<bool> running;
+	std::thread worker;
+	std::chrono::steady_clock::time_point startTime;
+
+	//only touched by the worker (or by stop() once it's gone)
+	MIDIScore score;//being built, copied out to publish
+	std::vector<size_t> pendingHead, pendingTail;//notes waiting for a note-off, by channel * 128 + pitch
+	std::vector<size_t> pendingNext;//by note index
+	double lastMillis;
+
+	MIDIScoreSlot slot;
+};
+#endif
@@ -0,0 +1,114 @@
+/*
+ *  MIDILoadStats.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#include "MIDILoadStats.h"
+#include <chrono>
+#include <cstdio>
+
+MIDILoadStats::MIDILoadStats(){
+	clear();
+}
+
+void MIDILoadStats::clear(){
+	bytesRead = 0;
+	bytesParsed = 0;
+	events = 0;
+	for (int i = 0; i < 8; i++)
+		channelEvents[i] = 0;
+	metaEvents = 0;
+	allocations = 0;
+	allocatedBytes = 0;
+	timings.clear();
+	
+	epoch = 0;
+	epoch = nowMicros();
+}
+
+double MIDILoadStats::nowMicros() const{
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count() - epoch;
+}
+
+void MIDILoadStats::addTiming(MIDILoadPhase phase, int track, double startMicros){
+	MIDIPhaseTiming timing;
+	timing.phase = phase;
+	timing.track = track;
+	timing.startMicros = startMicros;
+	timing.durationMicros = nowMicros() - startMicros;
+	timings.push_back(timing);
+}
+
+void MIDILoadStats::countEvent(int eventCode){
+	events++;
+	if (eventCode == 0xFF)
+		metaEvents++;
+	else if (eventCode >= 0x80)
+		channelEvents[(eventCode >> 4) - 8]++;
+}
+
+double MIDILoadStats::phaseMicros(MIDILoadPhase phase) const{
+	double total = 0;
+	for (int i = 0; i < timings.size(); i++){
+		if (timings[i].phase == phase)
+			total += timings[i].durationMicros;
+	}
+	return total;
+}
+
+double MIDILoadStats::trackMicros(MIDILoadPhase phase, int track) const{
+	double total = 0;
+	for (int i = 0; i < timings.size(); i++){
+		if (timings[i].phase == phase && timings[i].track == track)
+			total += timings[i].durationMicros;
+	}
+	return total;
+}
+
+const char* MIDILoadStats::phaseName(MIDILoadPhase phase){
+	switch (phase){
+		case MIDI_PHASE_READ: return "read";
+		case MIDI_PHASE_HEADER: return "header";
+		case MIDI_PHASE_DECODE: return "decode";
+		case MIDI_PHASE_DELTA: return "delta times";
+		case MIDI_PHASE_CONSOLIDATE: return "consolidate note-offs";
+		case MIDI_PHASE_NOTES: return "notes";
+		case MIDI_PHASE_TIMING: return "note timing";
+		default: return "unknown";
+	}
+}
+
+void MIDILoadStats::print() const{
+	printf("bytes read %zu parsed %zu, events %zu (meta %zu)\n", bytesRead, bytesParsed, events, metaEvents);
+	const char* channelNames[8] = {"note off", "note on", "poly aftertouch", "controller", "program", "channel aftertouch", "pitch bend", "sysex"};
+	for (int i = 0; i < 8; i++){
+		if (channelEvents[i] > 0)
+			printf("  %s %zu\n", channelNames[i], channelEvents[i]);
+	}
+	printf("allocations %zu (%zu bytes)\n", allocations, allocatedBytes);
+	for (int phase = 0; phase < MIDI_PHASE_COUNT; phase++)
+		printf("  %s %.1f us\n", phaseName((MIDILoadPhase)phase), phaseMicros((MIDILoadPhase)phase));
+}
+
+//complete ("X") events, one thread row per track
+bool MIDILoadStats::writeChromeTrace(const std::string& path) const{
+	FILE* file = fopen(path.c_str(), "w");
+	if (!file)
+		return false;
+	
+	fprintf(file, "{\"traceEvents\":[\n");
+	for (int i = 0; i < timings.size(); i++){
+		const MIDIPhaseTiming& t = timings[i];
+		fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"midi\",\"ph\":\"X\",\"pid\":1,\"tid\":%i,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"track\":%i}}\n",
+				i > 0 ? "," : "", phaseName(t.phase), t.track + 1, t.startMicros, t.durationMicros, t.track);
+	}
+	fprintf(file, "],\n\"otherData\":{\"bytesRead\":%zu,\"bytesParsed\":%zu,\"events\":%zu,\"metaEvents\":%zu,\"allocations\":%zu,\"allocatedBytes\":%zu}}\n",
+			bytesRead, bytesParsed, events, metaEvents, allocations, allocatedBytes);
+	
+	bool ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
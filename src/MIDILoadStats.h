@@ -0,0 +1,110 @@
+/*
+ *  MIDILoadStats.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#ifndef MIDI_LOAD_STATS_H
+#define MIDI_LOAD_STATS_H
+
+#include <vector>
+#include <string>
+#include <stddef.h>
+
+//counters and per-track phase timings for a load
+//only collected when built with MIDI_LOAD_STATS defined, otherwise the hooks compile to nothing
+//and a stats object passed in just stays empty
+
+//#define MIDI_LOAD_STATS 1
+
+enum MIDILoadPhase {
+	MIDI_PHASE_READ,//getting the bytes into memory
+	MIDI_PHASE_HEADER,
+	MIDI_PHASE_DECODE,//per track, event decoding
+	MIDI_PHASE_DELTA,//per track, delta to absolute times
+	MIDI_PHASE_CONSOLIDATE,//per track, pairing note-offs
+	MIDI_PHASE_NOTES,//per track, loader picking out notes and tempo
+	MIDI_PHASE_TIMING,//loader tempo map, note times and sorting
+	MIDI_PHASE_COUNT
+};
+
+struct MIDIPhaseTiming {
+	MIDILoadPhase phase;
+	int track;//-1 for whole-file phases
+	double startMicros;//since the stats were cleared
+	double durationMicros;
+};
+
+class MIDILoadStats{
+public:
+	MIDILoadStats();
+	
+	void clear();
+	
+	double phaseMicros(MIDILoadPhase phase) const;//summed over tracks
+	double trackMicros(MIDILoadPhase phase, int track) const;
+	
+	void print() const;
+	bool writeChromeTrace(const std::string& path) const;//load in chrome://tracing or Perfetto
+	
+	static const char* phaseName(MIDILoadPhase phase);
+	
+	size_t bytesRead;
+	size_t bytesParsed;
+	size_t events;
+	size_t channelEvents[8];//by status high nibble, 0x80 note off to 0xF0 sysex
+	size_t metaEvents;
+	size_t allocations;//vector growths while storing events and notes
+	size_t allocatedBytes;
+	
+	std::vector<MIDIPhaseTiming> timings;
+	
+	//hooks used through the macros below
+	double nowMicros() const;
+	void addTiming(MIDILoadPhase phase, int track, double startMicros);
+	void countEvent(int eventCode);
+	template <class V> void countPush(const V& v){
+		if (v.size() == v.capacity()){
+			allocations++;
+			allocatedBytes += (v.capacity() ? 2 * v.capacity() : 1) * sizeof(typename V::value_type);
+		}
+	}
+	
+private:
+	double epoch;
+};
+
+#ifdef MIDI_LOAD_STATS
+
+class MIDIPhaseTimer{
+public:
+	MIDIPhaseTimer(MIDILoadStats* s, MIDILoadPhase p, int t) : stats(s), phase(p), track(t){
+		if (stats)
+			start = stats->nowMicros();
+	}
+	~MIDIPhaseTimer(){
+		if (stats)
+			stats->addTiming(phase, track, start);
+	}
+private:
+	MIDILoadStats* stats;
+	MIDILoadPhase phase;
+	int track;
+	double start;
+};
+
+#define MIDI_STATS_JOIN2(a, b) a##b
+#define MIDI_STATS_JOIN(a, b) MIDI_STATS_JOIN2(a, b)
+#define MIDI_STATS(stats, call) do { if (stats) (stats)->call; } while (0)
+#define MIDI_STATS_TIMER(stats, phase, track) MIDIPhaseTimer MIDI_STATS_JOIN(midiPhaseTimer, __LINE__)(stats, phase, track)
+
+#else
+
+#define MIDI_STATS(stats, call) do { } while (0)
+#define MIDI_STATS_TIMER(stats, phase, track) do { } while (0)
+
+#endif
+
+#endif
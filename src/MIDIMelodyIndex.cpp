@@ -0,0 +1,366 @@
+/*
+ *  MIDIMelodyIndex.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#include "MIDIMelodyIndex.h"
+#include "MIDIVarint.h"
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <cmath>
+
+//each step of an n-gram packed into 9 bits: 6 for the interval, 3 for the rhythm
+static const int maxInterval = 24;//wider leaps are clamped, they're rare and usually octave errors anyway
+static const uint32_t indexMagic = 0x5844494D;//"MIDX"
+static const uint32_t indexVersion = 2;//rhythm keys changed in 2
+
+static int rhythmClass(double previousIOI, double ioi){
+	if (previousIOI <= 0 || ioi <= 0)
+		return 2;
+	double ratio = log(ioi / previousIOI) / log(2.0);
+	if (ratio < -1.5) return 0;
+	if (ratio < -0.5) return 1;
+	if (ratio <= 0.5) return 2;
+	if (ratio <= 1.5) return 3;
+	return 4;
+}
+
+bool MIDIMelodyIndex::Entry::operator<(const Entry& other) const{
+	if (key != other.key)
+		return key < other.key;
+	if (line != other.line)
+		return line < other.line;
+	return position < other.position;
+}
+
+MIDIMelodyIndex::MIDIMelodyIndex(int gramLength, bool rhythm){
+	n = gramLength < 1 ? 1 : (gramLength > maxN ? maxN : gramLength);
+	useRhythm = rhythm;
+	scoresAdded = 0;
+}
+
+void MIDIMelodyIndex::clear(){
+	scoresAdded = 0;
+	lines.clear();
+	pending.clear();
+	keys.clear();
+	offsets.clear();
+	postings.clear();
+}
+
+int MIDIMelodyIndex::makeKeys(const std::vector<int>& pitches, const std::vector<double>& onsets, std::vector<uint64_t>& grams) const{
+	grams.clear();
+	int count = (int)pitches.size() - n;//n intervals need n + 1 notes
+	if (count <= 0)
+		return 0;
+	
+	bool haveOnsets = useRhythm && onsets.size() == pitches.size();
+	for (int i = 0; i < count; i++){
+		uint64_t key = 0;
+		for (int k = 0; k < n; k++){
+			int interval = pitches[i + k + 1] - pitches[i + k];
+			if (interval > maxInterval) interval = maxInterval;
+			if (interval < -maxInterval) interval = -maxInterval;
+			
+			//each step's duration against the one before it in the gram - the first has
+			//nothing in the gram to compare with, so it's always "same", and a query matches
+			//whatever led up to the fragment
+			int rhythm = 0;
+			if (haveOnsets){
+				if (k == 0)
+					rhythm = 2;
+				else
+					rhythm = rhythmClass(onsets[i + k] - onsets[i + k - 1], onsets[i + k + 1] - onsets[i + k]);
+			}
+			key = (key << 9) | ((uint64_t)(interval + maxInterval) << 3) | rhythm;
+		}
+		grams.push_back(key);
+	}
+	return count;
+}
+
+void MIDIMelodyIndex::addScore(const MIDIScore& score){
+	//split by track and channel, notes are already in onset order
+	std::map<std::pair<int, int>, std::vector<int> > parts;
+	for (int i = 0; i < score.notes.size(); i++)
+		parts[std::make_pair(score.notes[i].track, score.notes[i].channel)].push_back(i);
+	
+	for (std::map<std::pair<int, int>, std::vector<int> >::iterator it = parts.begin(); it != parts.end(); ++it){
+		//top voice: the highest pitch at each onset
+		std::vector<int> melody;
+		const std::vector<int>& indices = it->second;
+		for (int j = 0; j < indices.size(); j++){
+			const noteData& note = score.notes[indices[j]];
+			if (!melody.empty() && score.notes[melody.back()].ticks == note.ticks){
+				if (note.pitch > score.notes[melody.back()].pitch)
+					melody.back() = indices[j];
+			} else
+				melody.push_back(indices[j]);
+		}
+		if (melody.size() > n)
+			addLine(score, scoresAdded, it->first.first, it->first.second, melody);
+	}
+	scoresAdded++;
+}
+
+void MIDIMelodyIndex::addLine(const MIDIScore& score, int scoreNumber, int track, int channel, const std::vector<int>& noteIndices){
+	MIDIMelodyLine line;
+	line.score = scoreNumber;
+	line.path = score.path;
+	line.track = track;
+	line.channel = channel;
+	line.noteIndices = noteIndices;
+	
+	std::vector<int> pitches(noteIndices.size());
+	std::vector<double> onsets(noteIndices.size());
+	for (int i = 0; i < noteIndices.size(); i++){
+		pitches[i] = score.notes[noteIndices[i]].pitch;
+		onsets[i] = score.notes[noteIndices[i]].timeMillis;
+	}
+	
+	std::vector<uint64_t> grams;
+	int count = makeKeys(pitches, onsets, grams);
+	Entry entry;
+	entry.line = lines.size();
+	for (int i = 0; i < count; i++){
+		entry.key = grams[i];
+		entry.position = i;
+		pending.push_back(entry);
+	}
+	lines.push_back(line);
+}
+
+void MIDIMelodyIndex::build(){
+	std::sort(pending.begin(), pending.end());
+	
+	keys.clear();
+	offsets.clear();
+	postings.clear();
+	
+	uint32_t lastLine = 0, lastPosition = 0;
+	for (int i = 0; i < pending.size(); i++){
+		const Entry& entry = pending[i];
+		if (keys.empty() || keys.back() != entry.key){
+			keys.push_back(entry.key);
+			offsets.push_back(postings.size());
+			lastLine = 0;
+			lastPosition = 0;
+		}
+		//line delta, then position - as a delta when it's the same line
+		uint32_t lineDelta = entry.line - lastLine;
+		writeVarint(postings, lineDelta);
+		writeVarint(postings, lineDelta == 0 ? entry.position - lastPosition : entry.position);
+		lastLine = entry.line;
+		lastPosition = entry.position;
+	}
+	offsets.push_back(postings.size());
+	
+	std::vector<Entry>().swap(pending);
+}
+
+void MIDIMelodyIndex::query(const std::vector<int>& pitches, std::vector<MIDIMelodyMatch>& matches, int maxMatches) const{
+	std::vector<double> noOnsets;
+	query(pitches, noOnsets, matches, maxMatches);
+}
+
+void MIDIMelodyIndex::query(const std::vector<int>& pitches, const std::vector<double>& onsetMillis,
+							std::vector<MIDIMelodyMatch>& matches, int maxMatches) const{
+	matches.clear();
+	
+	std::vector<uint64_t> grams;
+	int count = makeKeys(pitches, onsetMillis, grams);
+	
+	//votes for each (line, where the query would start in it)
+	std::map<std::pair<uint32_t, int>, int> votes;
+	for (int i = 0; i < count; i++){
+		std::vector<uint64_t>::const_iterator it = std::lower_bound(keys.begin(), keys.end(), grams[i]);
+		if (it == keys.end() || *it != grams[i])
+			continue;
+		
+		size_t k = it - keys.begin();
+		size_t position = offsets[k];
+		uint32_t line = 0, linePosition = 0;
+		while (position < offsets[k + 1]){
+			uint32_t lineDelta = readVarint(&postings[0], position);
+			uint32_t positionValue = readVarint(&postings[0], position);
+			line += lineDelta;
+			if (line >= lines.size())
+				break;//load() turns away indexes like this, so it's only ever a bug
+			linePosition = lineDelta == 0 ? linePosition + positionValue : positionValue;
+			votes[std::make_pair(line, (int)linePosition - i)]++;
+		}
+	}
+	
+	for (std::map<std::pair<uint32_t, int>, int>::const_iterator it = votes.begin(); it != votes.end(); ++it){
+		MIDIMelodyMatch match;
+		match.line = it->first.first;
+		match.position = it->first.second < 0 ? 0 : it->first.second;
+		match.hits = it->second;
+		matches.push_back(match);
+	}
+	
+	//most hits first, then keep only the best alignment per line
+	struct {
+		bool operator()(const MIDIMelodyMatch& a, const MIDIMelodyMatch& b) const {
+			if (a.hits != b.hits)
+				return a.hits > b.hits;
+			if (a.line != b.line)
+				return a.line < b.line;
+			return a.position < b.position;
+		}
+	} byHits;
+	std::sort(matches.begin(), matches.end(), byHits);
+	
+	std::vector<bool> seen(lines.size(), false);
+	int kept = 0;
+	for (int i = 0; i < matches.size() && kept < maxMatches; i++){
+		if (seen[matches[i].line])
+			continue;
+		seen[matches[i].line] = true;
+		matches[kept++] = matches[i];
+	}
+	matches.resize(kept);
+}
+
+template <typename T>
+static void writeValue(std::ofstream& out, const T& value){
+	out.write((const char*)&value, sizeof(T));
+}
+
+template <typename T>
+static bool readValue(std::ifstream& in, T& value){
+	in.read((char*)&value, sizeof(T));
+	return in.good();
+}
+
+template <typename T>
+static void writeArray(std::ofstream& out, const std::vector<T>& values){
+	writeValue(out, (uint32_t)values.size());
+	if (!values.empty())
+		out.write((const char*)&values[0], values.size() * sizeof(T));
+}
+
+//the count is checked against what's left of the file before anything's allocated for it
+template <typename T>
+static bool readArray(std::ifstream& in, std::vector<T>& values, uint64_t fileSize){
+	uint32_t size;
+	if (!readValue(in, size))
+		return false;
+	std::streampos position = in.tellg();
+	if (position == std::streampos(-1) || (uint64_t)size * sizeof(T) > fileSize - (uint64_t)position)
+		return false;
+	values.resize(size);
+	if (size > 0)
+		in.read((char*)&values[0], size * sizeof(T));
+	return in.good();
+}
+
+//native byte order, it's a cache rather than an interchange format
+bool MIDIMelodyIndex::save(const std::string& path) const{
+	std::ofstream out(path.c_str(), std::ios::out | std::ios::binary);
+	if (!out)
+		return false;
+	
+	writeValue(out, indexMagic);
+	writeValue(out, indexVersion);
+	writeValue(out, (int32_t)n);
+	writeValue(out, (uint8_t)useRhythm);
+	writeValue(out, (int32_t)scoresAdded);
+	
+	writeValue(out, (uint32_t)lines.size());
+	for (int i = 0; i < lines.size(); i++){
+		const MIDIMelodyLine& line = lines[i];
+		writeValue(out, (int32_t)line.score);
+		writeValue(out, (int32_t)line.track);
+		writeValue(out, (int32_t)line.channel);
+		std::vector<char> path(line.path.begin(), line.path.end());
+		writeArray(out, path);
+		std::vector<int32_t> indices(line.noteIndices.begin(), line.noteIndices.end());
+		writeArray(out, indices);
+	}
+	
+	writeArray(out, keys);
+	writeArray(out, offsets);
+	writeArray(out, postings);
+	return out.good();
+}
+
+bool MIDIMelodyIndex::load(const std::string& path){
+	clear();
+	std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+	if (!in)
+		return false;
+	
+	in.seekg(0, std::ios::end);
+	uint64_t fileSize = (uint64_t)in.tellg();
+	in.seekg(0, std::ios::beg);
+	
+	uint32_t magic, version, lineCount;
+	int32_t gramLength, scores;
+	uint8_t rhythm;
+	if (!readValue(in, magic) || magic != indexMagic || !readValue(in, version) || version != indexVersion)
+		return false;
+	if (!readValue(in, gramLength) || !readValue(in, rhythm) || !readValue(in, scores) || !readValue(in, lineCount))
+		return false;
+	if (gramLength < 1 || gramLength > maxN)
+		return false;
+	
+	//a line takes at least its three numbers and two counts
+	if ((uint64_t)lineCount * 20 > fileSize - (uint64_t)in.tellg())
+		return false;
+	
+	n = gramLength;
+	useRhythm = rhythm != 0;
+	scoresAdded = scores;
+	
+	for (uint32_t i = 0; i < lineCount; i++){
+		MIDIMelodyLine line;
+		int32_t score, track, channel;
+		std::vector<char> linePath;
+		std::vector<int32_t> indices;
+		if (!readValue(in, score) || !readValue(in, track) || !readValue(in, channel) || !readArray(in, linePath, fileSize) || !readArray(in, indices, fileSize)){
+			clear();
+			return false;
+		}
+		line.score = score;
+		line.track = track;
+		line.channel = channel;
+		line.path.assign(linePath.begin(), linePath.end());
+		line.noteIndices.assign(indices.begin(), indices.end());
+		lines.push_back(line);
+	}
+	
+	if (!readArray(in, keys, fileSize) || !readArray(in, offsets, fileSize) || !readArray(in, postings, fileSize)
+		|| offsets.size() != keys.size() + 1 || offsets.back() != postings.size() || !postingsValid()){
+		clear();
+		return false;
+	}
+	return true;
+}
+
+//query() decodes the postings without checking them, so a loaded index has to be checked here -
+//keys in order, and every list decoding inside its own bytes to lines the index has
+bool MIDIMelodyIndex::postingsValid() const{
+	//offsets.back() is the end of postings, so in order they're all inside it
+	for (size_t k = 0; k < keys.size(); k++){
+		if ((k > 0 && keys[k] <= keys[k - 1]) || offsets[k] > offsets[k + 1])
+			return false;
+	}
+	
+	for (size_t k = 0; k < keys.size(); k++){
+		size_t position = offsets[k];
+		uint64_t line = 0, lineDelta, positionValue;
+		while (position < offsets[k + 1]){
+			if (!readVarint(&postings[0], offsets[k + 1], position, lineDelta) || !readVarint(&postings[0], offsets[k + 1], position, positionValue))
+				return false;
+			line += lineDelta;
+			if (lineDelta > lines.size() || line >= lines.size())
+				return false;
+		}
+	}
+	return true;
+}
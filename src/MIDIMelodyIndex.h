@@ -0,0 +1,83 @@
+/*
+ *  MIDIMelodyIndex.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#ifndef MIDI_MELODY_INDEX
+#define MIDI_MELODY_INDEX
+
+#include "MIDIScore.h"
+#include <string>
+#include <stdint.h>
+
+//one melodic line that was indexed - a track/channel of one file, reduced to its top voice
+struct MIDIMelodyLine {
+	int score;//order addScore() was called in
+	std::string path;
+	int track;
+	int channel;
+	std::vector<int> noteIndices;//into that score's notes, one per melody note
+};
+
+struct MIDIMelodyMatch {
+	int line;
+	int position;//melody note in the line the query lines up with
+	int hits;//n-grams that agreed on that alignment
+};
+
+//inverted index of pitch interval n-grams, so transposed fragments still match
+//with useRhythm each interval also carries a coarse duration ratio (much shorter .. much longer)
+//postings are delta encoded varints of (line, position), sorted, one list per n-gram
+//
+//add scores, build(), then query - or save() and load() the built index
+
+class MIDIMelodyIndex{
+public:
+	MIDIMelodyIndex(int n = 4, bool useRhythm = false);
+	
+	void clear();
+	void addScore(const MIDIScore& score);
+	void build();//after the last addScore
+	
+	//pitches as sung/played, onsets optional (needed if the index uses rhythm)
+	void query(const std::vector<int>& pitches, const std::vector<double>& onsetMillis,
+			   std::vector<MIDIMelodyMatch>& matches, int maxMatches = 20) const;
+	void query(const std::vector<int>& pitches, std::vector<MIDIMelodyMatch>& matches, int maxMatches = 20) const;
+	
+	bool save(const std::string& path) const;
+	bool load(const std::string& path);//false, and left empty, if the file is truncated or corrupt
+	
+	const std::vector<MIDIMelodyLine>& getLines() const { return lines; }
+	size_t getNumGrams() const { return keys.size(); }
+	size_t getPostingBytes() const { return postings.size(); }
+	
+	static const int maxN = 7;
+	
+private:
+	struct Entry {
+		uint64_t key;
+		uint32_t line;
+		uint32_t position;
+		bool operator<(const Entry& other) const;
+	};
+	
+	//fills keys for every n-gram starting at each note, returns how many
+	int makeKeys(const std::vector<int>& pitches, const std::vector<double>& onsets, std::vector<uint64_t>& grams) const;
+	void addLine(const MIDIScore& score, int scoreNumber, int track, int channel, const std::vector<int>& noteIndices);
+	bool postingsValid() const;
+	
+	int n;
+	bool useRhythm;
+	int scoresAdded;
+	
+	std::vector<MIDIMelodyLine> lines;
+	std::vector<Entry> pending;//until build()
+	
+	std::vector<uint64_t> keys;//sorted
+	std::vector<uint32_t> offsets;//keys.size() + 1 entries into postings
+	std::vector<uint8_t> postings;
+};
+#endif
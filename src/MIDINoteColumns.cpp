@@ -0,0 +1,109 @@
+/*
+ *  MIDINoteColumns.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#include "MIDINoteColumns.h"
+#include "MIDIScore.h"
+#include <cstring>
+
+const size_t columnAlignment = 64;//cache line
+
+static size_t alignedColumnBytes(size_t bytes){
+	return (bytes + columnAlignment - 1) & ~(columnAlignment - 1);
+}
+
+MIDINoteColumns::MIDINoteColumns(){
+	count = 0;
+	capacity = 0;
+	layout(0);
+}
+
+MIDINoteColumns::MIDINoteColumns(const MIDINoteColumns& other){
+	count = 0;
+	capacity = 0;
+	layout(0);
+	*this = other;
+}
+
+MIDINoteColumns& MIDINoteColumns::operator=(const MIDINoteColumns& other){
+	if (this == &other)
+		return *this;
+	
+	resize(other.count);
+	if (count > 0){
+		memcpy(onsetMillis, other.onsetMillis, count * sizeof(double));
+		memcpy(durationMillis, other.durationMillis, count * sizeof(double));
+		memcpy(onsetTicks, other.onsetTicks, count * sizeof(int32_t));
+		memcpy(durationTicks, other.durationTicks, count * sizeof(int32_t));
+		memcpy(track, other.track, count * sizeof(uint16_t));
+		memcpy(pitch, other.pitch, count);
+		memcpy(velocity, other.velocity, count);
+		memcpy(channel, other.channel, count);
+	}
+	return *this;
+}
+
+void MIDINoteColumns::resize(size_t n){
+	if (n > capacity)
+		layout(n);
+	count = n;
+}
+
+//carve every column out of the single storage block
+void MIDINoteColumns::layout(size_t newCapacity){
+	size_t doubleBytes = alignedColumnBytes(newCapacity * sizeof(double));
+	size_t intBytes = alignedColumnBytes(newCapacity * sizeof(int32_t));
+	size_t shortBytes = alignedColumnBytes(newCapacity * sizeof(uint16_t));
+	size_t byteBytes = alignedColumnBytes(newCapacity);
+	
+	storage.assign(2*doubleBytes + 2*intBytes + shortBytes + 3*byteBytes + columnAlignment, 0);
+	
+	uintptr_t base = (uintptr_t) &storage[0];
+	unsigned char* p = &storage[0] + (alignedColumnBytes(base) - base);
+	
+	onsetMillis = (double*) p;		p += doubleBytes;
+	durationMillis = (double*) p;	p += doubleBytes;
+	onsetTicks = (int32_t*) p;		p += intBytes;
+	durationTicks = (int32_t*) p;	p += intBytes;
+	track = (uint16_t*) p;			p += shortBytes;
+	pitch = p;						p += byteBytes;
+	velocity = p;					p += byteBytes;
+	channel = p;
+	
+	capacity = newCapacity;
+}
+
+void MIDINoteColumns::assign(const std::vector<noteData>& notes){
+	resize(notes.size());
+	for (size_t i = 0; i < count; i++){
+		const noteData& n = notes[i];
+		onsetMillis[i] = n.timeMillis;
+		durationMillis[i] = n.durationMillis;
+		onsetTicks[i] = n.ticks;
+		durationTicks[i] = (int32_t) n.durationTicks;
+		track[i] = (uint16_t) n.track;
+		pitch[i] = (uint8_t) n.pitch;
+		velocity[i] = (uint8_t) n.velocity;
+		channel[i] = (uint8_t) n.channel;
+	}
+}
+
+void MIDINoteColumns::toNotes(std::vector<noteData>& notes) const{
+	notes.resize(count);
+	for (size_t i = 0; i < count; i++){
+		noteData& n = notes[i];
+		n.beatPosition = 0;
+		n.timeMillis = onsetMillis[i];
+		n.durationMillis = durationMillis[i];
+		n.ticks = onsetTicks[i];
+		n.durationTicks = durationTicks[i];
+		n.track = track[i];
+		n.pitch = pitch[i];
+		n.velocity = velocity[i];
+		n.channel = channel[i];
+	}
+}
@@ -0,0 +1,53 @@
+/*
+ *  MIDINoteColumns.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#ifndef MIDI_NOTE_COLUMNS
+#define MIDI_NOTE_COLUMNS
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+struct noteData;
+
+//struct-of-arrays layout of the loaded notes
+//each column is contiguous and 64-byte aligned, all columns share one allocation
+//so passes that only want pitch or onset time don't drag whole noteData structs through cache
+
+class MIDINoteColumns{
+public:
+	MIDINoteColumns();
+	MIDINoteColumns(const MIDINoteColumns& other);
+	MIDINoteColumns& operator=(const MIDINoteColumns& other);
+	
+	void assign(const std::vector<noteData>& notes);
+	void toNotes(std::vector<noteData>& notes) const;
+	
+	void resize(size_t n);//keeps the allocation if it's already big enough, contents are not preserved
+	void clear(){ count = 0; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	
+	//columns, valid for size() entries
+	double* onsetMillis;
+	double* durationMillis;
+	int32_t* onsetTicks;
+	int32_t* durationTicks;
+	uint16_t* track;
+	uint8_t* pitch;
+	uint8_t* velocity;
+	uint8_t* channel;
+	
+private:
+	void layout(size_t newCapacity);
+	
+	std::vector<unsigned char> storage;
+	size_t count;
+	size_t capacity;
+};
+#endif
@@ -0,0 +1,58 @@
+/*
+ *  MIDIOnsetClusters.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#include "MIDIOnsetClusters.h"
+
+MIDIOnsetClusters::MIDIOnsetClusters(){
+}
+
+void MIDIOnsetClusters::build(const std::vector<noteData>& notes, double tolerance, bool inTicks){
+	chords.clear();
+	
+	for (int i = 0; i < notes.size(); i++){
+		const noteData& note = notes[i];
+		
+		//measured from the cluster's first onset so a run of close notes can't chain on forever
+		bool joins = false;
+		if (!chords.empty()){
+			const MIDIChord& last = chords.back();
+			double distance = inTicks ? note.ticks - last.startTicks : note.timeMillis - last.startMillis;
+			joins = distance <= tolerance;
+		}
+		
+		if (!joins){
+			MIDIChord chord;
+			chord.pitches.clear();
+			chord.startTicks = chord.endTicks = note.ticks;
+			chord.startMillis = chord.endMillis = note.timeMillis;
+			chord.firstNote = i;
+			chord.noteCount = 0;
+			chords.push_back(chord);
+		}
+		
+		MIDIChord& chord = chords.back();
+		if (note.pitch >= 0 && note.pitch < 128)
+			chord.pitches.add(note.pitch);
+		chord.endTicks = note.ticks;
+		chord.endMillis = note.timeMillis;
+		chord.noteCount++;
+	}
+}
+
+int MIDIOnsetClusters::findChord(double millis) const{
+	int low = 0;
+	int high = chords.size();
+	while (low < high){
+		int mid = (low + high) / 2;
+		if (chords[mid].startMillis <= millis)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low - 1;
+}
@@ -0,0 +1,65 @@
+/*
+ *  MIDIOnsetClusters.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#ifndef MIDI_ONSET_CLUSTERS
+#define MIDI_ONSET_CLUSTERS
+
+#include "MIDIScore.h"
+#include <stdint.h>
+
+//bits set in a 64 bit word - the builtin compiles to popcnt where the target has it
+//elsewhere (MSVC's __popcnt64 faults on CPUs without the instruction) count them by hand
+inline int midiPopCount(uint64_t x){
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_popcountll(x);
+#else
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (int)((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+//128 bit set of MIDI pitches
+struct MIDIPitchSet {
+	uint64_t bits[2];
+	
+	void clear(){ bits[0] = bits[1] = 0; }
+	void add(int pitch){ bits[pitch >> 6] |= (uint64_t)1 << (pitch & 63); }
+	bool contains(int pitch) const { return (bits[pitch >> 6] >> (pitch & 63)) & 1; }
+	int count() const { return midiPopCount(bits[0]) + midiPopCount(bits[1]); }
+	int overlap(const MIDIPitchSet& other) const {//pitches in both
+		return midiPopCount(bits[0] & other.bits[0]) + midiPopCount(bits[1] & other.bits[1]);
+	}
+	int difference(const MIDIPitchSet& other) const {//pitches in one but not the other
+		return midiPopCount(bits[0] ^ other.bits[0]) + midiPopCount(bits[1] ^ other.bits[1]);
+	}
+};
+
+//notes whose onsets fall within the tolerance of the first one, as a single expected chord
+struct MIDIChord {
+	MIDIPitchSet pitches;
+	int startTicks, endTicks;//first and last onset in the cluster
+	double startMillis, endMillis;
+	int firstNote;//index into the score's notes, which are in onset order
+	int noteCount;
+};
+
+class MIDIOnsetClusters{
+public:
+	MIDIOnsetClusters();
+	
+	//one pass over the (onset sorted) notes
+	//tolerance is in millis, or ticks if inTicks is set
+	void build(const std::vector<noteData>& notes, double tolerance, bool inTicks = false);
+	
+	int findChord(double millis) const;//last chord starting at or before millis, -1 if none
+	
+	std::vector<MIDIChord> chords;
+};
+#endif
@@ -0,0 +1,93 @@
+/*
+ *  MIDIPianoRoll.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#include "MIDIPianoRoll.h"
+#include <algorithm>
+
+const int pitchRows = 128;
+
+MIDIPianoRoll::MIDIPianoRoll(){
+	clear();
+}
+
+void MIDIPianoRoll::clear(){
+	levels.clear();
+	cells.clear();
+	baseTicksPerCell = 1;
+	lengthTicks = 0;
+	lowestPitch = 0;
+	highestPitch = -1;
+}
+
+void MIDIPianoRoll::build(const MIDIScore& score, int ticksPerCell){
+	clear();
+	
+	baseTicksPerCell = ticksPerCell > 0 ? ticksPerCell : std::max(1, score.pulsesPerQuarternote / 8);
+	
+	lowestPitch = pitchRows;
+	for (int i = 0; i < score.notes.size(); i++){
+		const noteData& note = score.notes[i];
+		lengthTicks = std::max(lengthTicks, (long)note.ticks + std::max(note.durationTicks, 1L));
+		lowestPitch = std::min(lowestPitch, note.pitch);
+		highestPitch = std::max(highestPitch, note.pitch);
+	}
+	if (highestPitch < 0)
+		lowestPitch = 0;
+	
+	//sizes of every level, down to a single column
+	int columns = std::max(1L, (lengthTicks + baseTicksPerCell - 1) / baseTicksPerCell);
+	size_t total = 0;
+	while (true){
+		Level level;
+		level.offset = total;
+		level.columns = columns;
+		levels.push_back(level);
+		total += (size_t)pitchRows * columns;
+		if (columns == 1)
+			break;
+		columns = (columns + 1) / 2;
+	}
+	cells.assign(total, 0);
+	
+	//finest level straight from the notes
+	uint8_t* base = &cells[0];
+	int baseColumns = levels[0].columns;
+	for (int i = 0; i < score.notes.size(); i++){
+		const noteData& note = score.notes[i];
+		if (note.pitch < 0 || note.pitch >= pitchRows)
+			continue;
+		uint8_t velocity = (uint8_t) std::min(std::max(note.velocity, 1), 127);
+		int first = note.ticks / baseTicksPerCell;
+		int last = std::min((long)baseColumns - 1, (note.ticks + std::max(note.durationTicks, 1L) - 1) / baseTicksPerCell);
+		uint8_t* row = base + (size_t)note.pitch * baseColumns;
+		for (int c = first; c <= last; c++)
+			row[c] = std::max(row[c], velocity);
+	}
+	
+	//each coarser level is the max of pairs from the one below
+	for (int l = 1; l < levels.size(); l++){
+		const Level& fine = levels[l-1];
+		const Level& coarse = levels[l];
+		for (int pitch = 0; pitch < pitchRows; pitch++){
+			const uint8_t* in = &cells[fine.offset + (size_t)pitch * fine.columns];
+			uint8_t* out = &cells[coarse.offset + (size_t)pitch * coarse.columns];
+			int pairs = fine.columns / 2;
+			for (int c = 0; c < pairs; c++)
+				out[c] = std::max(in[2*c], in[2*c+1]);
+			if (fine.columns & 1)
+				out[pairs] = in[fine.columns - 1];
+		}
+	}
+}
+
+int MIDIPianoRoll::levelForZoom(double ticksPerPixel) const{
+	int level = 0;
+	while (level + 1 < levels.size() && getTicksPerCell(level + 1) <= ticksPerPixel)
+		level++;
+	return level;
+}
@@ -0,0 +1,52 @@
+/*
+ *  MIDIPianoRoll.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#ifndef MIDI_PIANO_ROLL
+#define MIDI_PIANO_ROLL
+
+#include "MIDIScore.h"
+#include <stdint.h>
+
+//pitch x time occupancy at power-of-two time resolutions, for drawing
+//each cell holds the loudest velocity sounding in it (0 = silent)
+//level 0 is the finest, each level up halves the number of columns,
+//so at any zoom a draw only has to visit the cells on screen
+
+class MIDIPianoRoll{
+public:
+	MIDIPianoRoll();
+	
+	void build(const MIDIScore& score, int ticksPerCell = 0);//0 picks a 32nd note
+	void clear();
+	
+	int getNumLevels() const { return levels.size(); }
+	int getColumns(int level) const { return levels[level].columns; }
+	long getTicksPerCell(int level) const { return (long)baseTicksPerCell << level; }
+	long getLengthTicks() const { return lengthTicks; }
+	
+	//the coarsest level whose cells are still no wider than ticksPerPixel
+	int levelForZoom(double ticksPerPixel) const;
+	
+	//cells for one pitch at one level, getColumns(level) long
+	const uint8_t* getRow(int level, int pitch) const { return &cells[levels[level].offset + (size_t)pitch * levels[level].columns]; }
+	uint8_t getCell(int level, int column, int pitch) const { return getRow(level, pitch)[column]; }
+	
+	int lowestPitch, highestPitch;//range actually used, for framing
+	
+private:
+	struct Level {
+		size_t offset;
+		int columns;
+	};
+	
+	std::vector<Level> levels;
+	std::vector<uint8_t> cells;
+	int baseTicksPerCell;
+	long lengthTicks;
+};
+#endif
@@ -0,0 +1,120 @@
+/*
+ *  MIDIScore.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#include "MIDIScore.h"
+#include <algorithm>
+#include <thread>
+
+static bool tempoTickCompare(const MIDITempoSegment& a, const MIDITempoSegment& b){
+	return a.ticks < b.ticks;
+}
+
+static bool tempoChangeCompare(const MIDITempoSegment& a, const MIDITempoSegment& b){
+	if (a.ticks != b.ticks)
+		return a.ticks < b.ticks;
+	return a.track < b.track;
+}
+
+MIDIScore::MIDIScore(){
+	format = 0;
+	numberOfTracks = 0;
+	pulsesPerQuarternote = 240;
+	fingerprint.clear();
+	
+	std::vector<MIDITempoSegment> none;
+	setTempoChanges(none, 500);
+}
+
+void MIDIScore::setTempoChanges(std::vector<MIDITempoSegment>& changes, double firstBeatPeriod){
+	std::stable_sort(changes.begin(), changes.end(), tempoChangeCompare);
+	
+	tempoMap.clear();
+	MIDITempoSegment first;
+	first.ticks = 0;
+	first.millis = 0;
+	first.beatPeriod = firstBeatPeriod;
+	first.track = -1;
+	tempoMap.push_back(first);
+	
+	for (int i = 0; i < changes.size(); i++){
+		MIDITempoSegment& last = tempoMap.back();
+		if (changes[i].ticks == last.ticks){
+			last.beatPeriod = changes[i].beatPeriod;//later change at the same tick wins
+			last.track = changes[i].track;
+		} else {
+			MIDITempoSegment segment;
+			segment.ticks = changes[i].ticks;
+			segment.millis = last.millis + (last.beatPeriod * (segment.ticks - last.ticks)) / (double) pulsesPerQuarternote;
+			segment.beatPeriod = changes[i].beatPeriod;
+			segment.track = changes[i].track;
+			tempoMap.push_back(segment);
+		}
+	}
+}
+
+double MIDIScore::ticksToMillis(long ticks) const{
+	MIDITempoSegment key;
+	key.ticks = (int)ticks;
+	std::vector<MIDITempoSegment>::const_iterator it = std::upper_bound(tempoMap.begin(), tempoMap.end(), key, tempoTickCompare);
+	if (it != tempoMap.begin())
+		--it;
+	return it->millis + (it->beatPeriod * (ticks - it->ticks)) / (double) pulsesPerQuarternote;
+}
+
+double MIDIScore::durationToMillis(long startTicks, long durationTicks) const{
+	return ticksToMillis(startTicks + durationTicks) - ticksToMillis(startTicks);
+}
+
+static bool tempoMillisCompare(const MIDITempoSegment& a, const MIDITempoSegment& b){
+	return a.millis < b.millis;
+}
+
+double MIDIScore::millisToTicks(double millis) const{
+	MIDITempoSegment key;
+	key.millis = millis;
+	std::vector<MIDITempoSegment>::const_iterator it = std::upper_bound(tempoMap.begin(), tempoMap.end(), key, tempoMillisCompare);
+	if (it != tempoMap.begin())
+		--it;
+	return it->ticks + ((millis - it->millis) * pulsesPerQuarternote) / it->beatPeriod;
+}
+
+
+MIDIScoreSlot::MIDIScoreSlot() : current(0){
+	readers[0] = 0;
+	readers[1] = 0;
+}
+
+MIDIScorePtr MIDIScoreSlot::load() const{
+	for (;;){
+		int i = current.load();
+		readers[i].fetch_add(1);
+		//once we're counted, publish() won't touch this place until we're done - but it may have
+		//already moved on from it, in which case it could be refilled under us
+		if (current.load() == i){
+			MIDIScorePtr score = scores[i];
+			readers[i].fetch_sub(1);
+			return score;
+		}
+		readers[i].fetch_sub(1);
+	}
+}
+
+void MIDIScoreSlot::publish(MIDIScorePtr newScore){
+	std::lock_guard<std::mutex> lock(publishing);
+	int old = current.load();
+	int next = 1 - old;
+	
+	//nobody reads the other place until the index says so, and it was emptied by the last publish
+	scores[next] = newScore;
+	current.store(next);
+	
+	//a load counted in the old place after this will see the new index and leave it alone
+	while (readers[old].load() != 0)
+		std::this_thread::yield();
+	scores[old].reset();
+}
@@ -0,0 +1,103 @@
+/*
+ *  MIDIScore.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#ifndef MIDI_SCORE
+#define MIDI_SCORE
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include "MIDIFingerprint.h"
+
+struct noteData {
+	float beatPosition;//in beats from beginning
+	int pitch;//as MIDI note number
+	double timeMillis;
+	int ticks;
+	int velocity;
+	long  durationTicks;
+	double durationMillis;
+	int channel;
+	int track;
+};
+
+//every channel message in the file, compactly, for rebuilding playback state
+//note-offs are put back in from the note durations (the reader folds them into the note-ons)
+struct MIDIChannelEvent {
+	int32_t ticks;
+	uint16_t track;
+	uint8_t status;//message type | channel
+	uint8_t data1;
+	uint8_t data2;
+	
+	int getMessageType() const { return status & 0xF0; }
+	int getChannel() const { return status & 0x0F; }
+	bool isNoteOff() const { return getMessageType() == 0x80 || (getMessageType() == 0x90 && data2 == 0); }
+};
+
+struct MIDITempoSegment {
+	int ticks;//where this tempo starts
+	double millis;//time at ticks
+	double beatPeriod;//millis per quarter note from here on
+	int track;//track the tempo event was on, -1 for the initial guess
+};
+
+//the result of loading one file
+//handed out as a MIDIScorePtr (pointer to const) so it can be shared between threads without locking
+
+class MIDIScore{
+public:
+	MIDIScore();
+	
+	double ticksToMillis(long ticks) const;//absolute tick position to millis using the tempo map
+	double durationToMillis(long startTicks, long durationTicks) const;
+	double millisToTicks(double millis) const;//and back again, fractional
+	
+	void setTempoChanges(std::vector<MIDITempoSegment>& changes, double firstBeatPeriod);//changes only need ticks and beatPeriod
+	
+	std::vector<noteData> notes;//all tracks, sorted by onset
+	std::vector<MIDIChannelEvent> channelEvents;//all tracks, sorted by time, note-offs first at the same tick
+	std::vector<MIDITempoSegment> tempoMap;
+	std::vector<MIDITempoSegment> tempoChanges;//the tempo events the map was built from
+	
+	MIDIFingerprint fingerprint;//of the notes, filled in by the loader
+	
+	std::string path;
+	int format;
+	int numberOfTracks;
+	int pulsesPerQuarternote;
+};
+
+typedef std::shared_ptr<const MIDIScore> MIDIScorePtr;
+
+//holds the current score for other threads - readers take their own reference with load() and keep
+//using it however long they like, and the old one goes when its last reader lets go
+//(std::atomic_load on a shared_ptr would do, but libstdc++ does it with a global pool of mutexes)
+//
+//the score lives in one of two places and an index says which - load() marks itself as reading that
+//place, checks it's still the current one and copies the pointer out, so it's never waiting on a lock,
+//and only goes round again if a publish() lands right then
+//publish() fills the other place and switches the index over, then waits for any reader still copying
+//out of the old place before letting it go - just the time to bump a reference count
+class MIDIScoreSlot{
+public:
+	MIDIScoreSlot();
+	
+	MIDIScorePtr load() const;
+	void publish(MIDIScorePtr newScore);//publishers take turns, readers never wait for them
+	
+private:
+	MIDIScorePtr scores[2];
+	std::atomic<int> current;
+	mutable std::atomic<int> readers[2];//loads copying out of each place right now
+	std::mutex publishing;
+};
+#endif
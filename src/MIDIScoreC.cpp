@@ -0,0 +1,246 @@
+/*
+ *  MIDIScoreC.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#include "MIDIScoreC.h"
+#include "MIDIFileLoader.h"
+#include "MIDICurveStore.h"
+#include <new>
+#include <stdexcept>
+#include <cmath>
+#include <cstring>
+
+//the layouts are promised in the header, so hold the compiler to them
+static_assert(sizeof(MIDINoteRecord) == 40 && offsetof(MIDINoteRecord, track) == 28 && offsetof(MIDINoteRecord, channel) == 32, "MIDINoteRecord layout");
+static_assert(sizeof(MIDITempoRecord) == 24 && offsetof(MIDITempoRecord, ticks) == 16, "MIDITempoRecord layout");
+static_assert(sizeof(MIDIControlRecord) == 16 && offsetof(MIDIControlRecord, value) == 12, "MIDIControlRecord layout");
+static_assert(MIDI_SCORE_C_PITCH_BEND == MIDI_CURVE_PITCH_BEND && MIDI_SCORE_C_PRESSURE == MIDI_CURVE_PRESSURE && MIDI_SCORE_C_CONTROLLERS == MIDI_CURVES_PER_CHANNEL, "controller numbers");
+
+//converted once when the score is loaded, then handed out as is
+struct MIDIScoreHandle {
+	MIDIScorePtr score;
+	std::vector<MIDINoteRecord> notes;
+	std::vector<MIDITempoRecord> tempoMap;
+	std::vector<MIDIControlRecord> controls;
+	size_t seriesStart[16 * MIDI_SCORE_C_CONTROLLERS + 1];//into controls, by channel * MIDI_SCORE_C_CONTROLLERS + controller
+};
+
+static void fillHandle(MIDIScoreHandle& handle){
+	const MIDIScore& score = *handle.score;
+
+	handle.notes.resize(score.notes.size());
+	for (size_t i = 0; i < score.notes.size(); i++){
+		const noteData& n = score.notes[i];
+		MIDINoteRecord& r = handle.notes[i];
+		memset(&r, 0, sizeof(r));
+		r.onsetMillis = n.timeMillis;
+		r.durationMillis = n.durationMillis;
+		r.onsetTicks = n.ticks;
+		r.durationTicks = (int32_t)n.durationTicks;
+		r.beatPosition = n.beatPosition;
+		r.track = n.track;
+		r.pitch = n.pitch;
+		r.velocity = n.velocity;
+		r.channel = n.channel;
+	}
+
+	handle.tempoMap.resize(score.tempoMap.size());
+	for (size_t i = 0; i < score.tempoMap.size(); i++){
+		const MIDITempoSegment& s = score.tempoMap[i];
+		MIDITempoRecord& r = handle.tempoMap[i];
+		r.millis = s.millis;
+		r.beatPeriod = s.beatPeriod;
+		r.ticks = s.ticks;
+		r.track = s.track;
+	}
+
+	//counting sort into series - channelEvents are in time order, so each series comes out in time order too
+	const int seriesCount = 16 * MIDI_SCORE_C_CONTROLLERS;
+	std::vector<size_t> sizes(seriesCount, 0);
+	std::vector<int> series(score.channelEvents.size(), -1);
+	for (size_t i = 0; i < score.channelEvents.size(); i++){
+		const MIDIChannelEvent& e = score.channelEvents[i];
+		int controller;
+		switch (e.getMessageType()){
+			case 0xB0: controller = e.data1 & 0x7F; break;
+			case 0xD0: controller = MIDI_SCORE_C_PRESSURE; break;
+			case 0xE0: controller = MIDI_SCORE_C_PITCH_BEND; break;
+			default: continue;
+		}
+		series[i] = e.getChannel() * MIDI_SCORE_C_CONTROLLERS + controller;
+		sizes[series[i]]++;
+	}
+
+	handle.seriesStart[0] = 0;
+	for (int k = 0; k < seriesCount; k++)
+		handle.seriesStart[k + 1] = handle.seriesStart[k] + sizes[k];
+
+	handle.controls.resize(handle.seriesStart[seriesCount]);
+	std::vector<size_t> next(handle.seriesStart, handle.seriesStart + seriesCount);
+	for (size_t i = 0; i < score.channelEvents.size(); i++){
+		if (series[i] < 0)
+			continue;
+		const MIDIChannelEvent& e = score.channelEvents[i];
+		MIDIControlRecord& r = handle.controls[next[series[i]]++];
+		r.millis = score.ticksToMillis(e.ticks);
+		r.ticks = e.ticks;
+		r.channel = e.getChannel();
+		r.controller = series[i] % MIDI_SCORE_C_CONTROLLERS;
+		if (r.controller == MIDI_SCORE_C_PITCH_BEND)
+			r.value = (e.data2 << 7) | e.data1;
+		else
+			r.value = r.controller == MIDI_SCORE_C_PRESSURE ? e.data1 : e.data2;
+	}
+}
+
+//nothing may be thrown back across the C boundary, so every entry point that can throw catches
+//everything and turns it into an error code here - running out of memory, or asking a container
+//for more than it can hold, counts as going over the limits and anything else as unreadable
+static int thrownError(){
+	try {
+		throw;
+	} catch (const std::bad_alloc&) {
+		return MIDI_PARSE_LIMIT_EXCEEDED;
+	} catch (const std::length_error&) {
+		return MIDI_PARSE_LIMIT_EXCEEDED;
+	} catch (...) {
+		return MIDI_PARSE_NOT_READABLE;
+	}
+}
+
+static MIDIScoreHandle* makeHandle(MIDIScorePtr score, int* error){
+	if (!score)
+		return 0;
+	try {
+		MIDIScoreHandle* handle = new MIDIScoreHandle();
+		handle->score = score;
+		fillHandle(*handle);
+		return handle;
+	} catch (...) {
+		if (error)
+			*error = thrownError();
+		return 0;
+	}
+}
+
+static MIDIParseOptions quietOptions(){
+	MIDIParseOptions options;
+	options.quiet = true;
+	return options;
+}
+
+int midiScoreVersion(void){
+	return MIDI_SCORE_C_VERSION;
+}
+
+MIDIScoreHandle* midiScoreOpen(const char* path, int* error){
+	if (error)
+		*error = MIDI_PARSE_OK;
+	if (!path){
+		if (error)
+			*error = MIDI_PARSE_NOT_READABLE;
+		return 0;
+	}
+	try {
+		MIDIFileLoader loader;
+		loader.printMidiInfo = false;
+		MIDIParseResult result;
+		MIDIScorePtr score = loader.loadScore(std::string(path), quietOptions(), &result);
+		if (!score && error)
+			*error = result.error;
+		return makeHandle(score, error);
+	} catch (...) {
+		if (error)
+			*error = thrownError();
+		return 0;
+	}
+}
+
+MIDIScoreHandle* midiScoreLoad(const void* data, size_t size, int* error){
+	if (error)
+		*error = MIDI_PARSE_OK;
+	try {
+		MIDIFileLoader loader;
+		loader.printMidiInfo = false;
+		MIDIParseResult result;
+		MIDIScorePtr score = loader.loadScore(data, size, "", quietOptions(), &result);
+		if (!score && error)
+			*error = result.error;
+		return makeHandle(score, error);
+	} catch (...) {
+		if (error)
+			*error = thrownError();
+		return 0;
+	}
+}
+
+void midiScoreFree(MIDIScoreHandle* score){
+	delete score;
+}
+
+const char* midiScoreErrorString(int error){
+	MIDIParseResult result;
+	result.error = (MIDIParseError)error;
+	return result.describe();
+}
+
+int midiScoreFormat(const MIDIScoreHandle* score){
+	return score ? score->score->format : -1;
+}
+
+int midiScoreTrackCount(const MIDIScoreHandle* score){
+	return score ? score->score->numberOfTracks : 0;
+}
+
+int midiScoreTicksPerQuarter(const MIDIScoreHandle* score){
+	return score ? score->score->pulsesPerQuarternote : 0;
+}
+
+double midiScoreTicksToMillis(const MIDIScoreHandle* score, double ticks){
+	if (!score)
+		return 0;
+	//whole ticks through the tempo map, the fraction at the tempo there
+	long whole = (long)floor(ticks);
+	double millis = score->score->ticksToMillis(whole);
+	if (ticks != whole)
+		millis += score->score->durationToMillis(whole, 1) * (ticks - whole);
+	return millis;
+}
+
+double midiScoreMillisToTicks(const MIDIScoreHandle* score, double millis){
+	return score ? score->score->millisToTicks(millis) : 0;
+}
+
+const MIDINoteRecord* midiScoreNotes(const MIDIScoreHandle* score, size_t* count){
+	if (count)
+		*count = score ? score->notes.size() : 0;
+	return score && !score->notes.empty() ? &score->notes[0] : 0;
+}
+
+const MIDITempoRecord* midiScoreTempoMap(const MIDIScoreHandle* score, size_t* count){
+	if (count)
+		*count = score ? score->tempoMap.size() : 0;
+	return score && !score->tempoMap.empty() ? &score->tempoMap[0] : 0;
+}
+
+const MIDIControlRecord* midiScoreControls(const MIDIScoreHandle* score, size_t* count){
+	if (count)
+		*count = score ? score->controls.size() : 0;
+	return score && !score->controls.empty() ? &score->controls[0] : 0;
+}
+
+const MIDIControlRecord* midiScoreControlSeries(const MIDIScoreHandle* score, int channel, int controller, size_t* count){
+	if (count)
+		*count = 0;
+	if (!score || channel < 0 || channel >= 16 || controller < 0 || controller >= MIDI_SCORE_C_CONTROLLERS)
+		return 0;
+	int k = channel * MIDI_SCORE_C_CONTROLLERS + controller;
+	size_t begin = score->seriesStart[k], end = score->seriesStart[k + 1];
+	if (count)
+		*count = end - begin;
+	return begin < end ? &score->controls[begin] : 0;
+}
@@ -0,0 +1,99 @@
+/*
+ *  MIDIScoreC.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+//plain C interface for loading scores from other languages through FFI
+//the arrays handed out belong to the score and stay put until midiScoreFree, so they can be
+//wrapped (numpy structured arrays, Rust slices, ctypes) without copying anything
+//records are fixed width, native byte order, with no hidden padding - the sizes are given with each
+
+#ifndef MIDI_SCORE_C
+#define MIDI_SCORE_C
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32)
+#define MIDI_SCORE_API __declspec(dllexport)
+#else
+#define MIDI_SCORE_API __attribute__((visibility("default")))
+#endif
+
+//bumped whenever a record layout or a signature changes
+#define MIDI_SCORE_C_VERSION 1
+
+//controller numbers past the 0-127 CCs, as in MIDICurveStore
+#define MIDI_SCORE_C_PITCH_BEND 128
+#define MIDI_SCORE_C_PRESSURE 129
+#define MIDI_SCORE_C_CONTROLLERS 130
+
+typedef struct MIDIScoreHandle MIDIScoreHandle;
+
+//40 bytes
+typedef struct {
+	double onsetMillis;//0
+	double durationMillis;//8
+	int32_t onsetTicks;//16
+	int32_t durationTicks;//20
+	float beatPosition;//24
+	uint16_t track;//28
+	uint8_t pitch;//30
+	uint8_t velocity;//31
+	uint8_t channel;//32
+	uint8_t reserved[7];//33, always zero
+} MIDINoteRecord;
+
+//24 bytes
+typedef struct {
+	double millis;//0, where this tempo starts
+	double beatPeriod;//8, millis per quarter note
+	int32_t ticks;//16
+	int32_t track;//20, -1 for the initial tempo
+} MIDITempoRecord;
+
+//16 bytes
+typedef struct {
+	double millis;//0
+	int32_t ticks;//8
+	uint16_t value;//12, 0-127, or 0-16383 centred on 8192 for pitch bend
+	uint8_t channel;//14
+	uint8_t controller;//15, 0-127 or MIDI_SCORE_C_PITCH_BEND / MIDI_SCORE_C_PRESSURE
+} MIDIControlRecord;
+
+MIDI_SCORE_API int midiScoreVersion(void);
+
+//null on failure, with the MIDIParseError code in error if it isn't null (0 is success)
+//running out of memory is reported as going over the limits, and nothing is ever thrown out of these
+MIDI_SCORE_API MIDIScoreHandle* midiScoreOpen(const char* path, int* error);
+MIDI_SCORE_API MIDIScoreHandle* midiScoreLoad(const void* data, size_t size, int* error);//the bytes can go once this returns
+MIDI_SCORE_API void midiScoreFree(MIDIScoreHandle* score);
+MIDI_SCORE_API const char* midiScoreErrorString(int error);
+
+MIDI_SCORE_API int midiScoreFormat(const MIDIScoreHandle* score);
+MIDI_SCORE_API int midiScoreTrackCount(const MIDIScoreHandle* score);
+MIDI_SCORE_API int midiScoreTicksPerQuarter(const MIDIScoreHandle* score);
+MIDI_SCORE_API double midiScoreTicksToMillis(const MIDIScoreHandle* score, double ticks);
+MIDI_SCORE_API double midiScoreMillisToTicks(const MIDIScoreHandle* score, double millis);
+
+//all tracks, sorted by onset
+MIDI_SCORE_API const MIDINoteRecord* midiScoreNotes(const MIDIScoreHandle* score, size_t* count);
+MIDI_SCORE_API const MIDITempoRecord* midiScoreTempoMap(const MIDIScoreHandle* score, size_t* count);
+
+//every controller, pitch bend and pressure message, grouped by channel then controller, in time order within each
+MIDI_SCORE_API const MIDIControlRecord* midiScoreControls(const MIDIScoreHandle* score, size_t* count);
+//the part of that for one channel and controller
+MIDI_SCORE_API const MIDIControlRecord* midiScoreControlSeries(const MIDIScoreHandle* score, int channel, int controller, size_t* count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ *  MIDIScoreFollower.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#include "MIDIScoreFollower.h"
+#include <cstring>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+static const float unreachable = 1e30f;
+
+MIDIScoreFollower::MIDIScoreFollower(){
+	stayPenalty = 0.3;
+	skipPenalty = 0.6;
+	reset();
+}
+
+void MIDIScoreFollower::setScore(MIDIScorePtr newScore, double chordTolerance){
+	score = newScore;
+	clusters.chords.clear();
+	if (score)
+		clusters.build(score->notes, chordTolerance);
+	reset();
+}
+
+void MIDIScoreFollower::reset(){
+	cost = costBuffers[0];
+	nextCost = costBuffers[1];
+	for (int i = 0; i < window + 4; i++)
+		costBuffers[0][i] = costBuffers[1][i] = unreachable;
+	cost[1] = 0;//just before the first chord
+	windowStart = 0;
+	
+	estimate.chord = -1;
+	estimate.scoreMillis = 0;
+	estimate.scoreTicks = 0;
+	estimate.tempoRatio = 1;
+	estimate.cost = 0;
+	lastLiveMillis = 0;
+	historyCount = 0;
+	historyNext = 0;
+}
+
+void MIDIScoreFollower::shiftWindow(int chords){
+	if (chords <= 0)
+		return;
+	if (chords > window)
+		chords = window;
+	
+	//the guards pick up the costs of the two chords just before the new start
+	memmove(cost, cost + chords, (window + 2 - chords) * sizeof(float));
+	for (int i = window + 2 - chords; i < window + 2; i++)
+		cost[i] = unreachable;
+	windowStart += chords;
+}
+
+const MIDIFollowEstimate& MIDIScoreFollower::noteOn(int pitch, double liveMillis){
+	const std::vector<MIDIChord>& chords = clusters.chords;
+	if (chords.empty() || pitch < 0 || pitch > 127)
+		return estimate;
+	
+	//0 if the chord has the pitch, 1 if not
+	int available = (int)chords.size() - windowStart;
+	for (int i = 0; i < window; i++){
+		if (i >= available)
+			noteCost[i] = unreachable;
+		else
+			noteCost[i] = chords[windowStart + i].pitches.contains(pitch) ? 0.f : 1.f;
+	}
+	
+	//cost[i + 2] is chord windowStart + i
+	//next = note + min(stay on the chord, advance one, skip one)
+	nextCost[0] = nextCost[1] = unreachable;
+#ifdef __SSE__
+	__m128 stay = _mm_set1_ps(stayPenalty);
+	__m128 skip = _mm_set1_ps(skipPenalty);
+	for (int i = 0; i < window; i += 4){
+		__m128 same = _mm_add_ps(_mm_loadu_ps(cost + i + 2), stay);
+		__m128 previous = _mm_loadu_ps(cost + i + 1);
+		__m128 skipped = _mm_add_ps(_mm_loadu_ps(cost + i), skip);
+		__m128 best = _mm_min_ps(same, _mm_min_ps(previous, skipped));
+		_mm_storeu_ps(nextCost + i + 2, _mm_add_ps(best, _mm_load_ps(noteCost + i)));
+	}
+#else
+	for (int i = 0; i < window; i++){
+		float best = cost[i + 2] + stayPenalty;
+		if (cost[i + 1] < best)
+			best = cost[i + 1];
+		if (cost[i] + skipPenalty < best)
+			best = cost[i] + skipPenalty;
+		nextCost[i + 2] = best + noteCost[i];
+	}
+#endif
+	
+	float* swap = cost;
+	cost = nextCost;
+	nextCost = swap;
+	
+	//best and runner up, then take the best off everything so the costs stay small
+	int bestIndex = 0;
+	float best = unreachable, second = unreachable;
+	for (int i = 0; i < window; i++){
+		float c = cost[i + 2];
+		if (c < best){
+			second = best;
+			best = c;
+			bestIndex = i;
+		} else if (c < second)
+			second = c;
+	}
+	for (int i = 0; i < window + 2; i++){
+		if (cost[i] < unreachable)
+			cost[i] -= best;
+	}
+	
+	int chord = windowStart + bestIndex;
+	if (chord > estimate.chord)
+		updateTempo(liveMillis, chords[chord].startMillis);
+	
+	estimate.chord = chord;
+	estimate.scoreMillis = chords[chord].startMillis;
+	estimate.scoreTicks = chords[chord].startTicks;
+	estimate.cost = second < unreachable ? second - best : 0;
+	lastLiveMillis = liveMillis;
+	
+	//keep the best path about a quarter of the way into the window
+	if (bestIndex > window / 2)
+		shiftWindow(bestIndex - window / 4);
+	
+	return estimate;
+}
+
+void MIDIScoreFollower::updateTempo(double liveMillis, double scoreMillis){
+	historyLive[historyNext] = liveMillis;
+	historyScore[historyNext] = scoreMillis;
+	historyNext = (historyNext + 1) % tempoHistory;
+	if (historyCount < tempoHistory)
+		historyCount++;
+	if (historyCount < 3)
+		return;
+	
+	//least squares slope of score time against live time
+	double meanLive = 0, meanScore = 0;
+	for (int i = 0; i < historyCount; i++){
+		meanLive += historyLive[i];
+		meanScore += historyScore[i];
+	}
+	meanLive /= historyCount;
+	meanScore /= historyCount;
+	
+	double covariance = 0, variance = 0;
+	for (int i = 0; i < historyCount; i++){
+		covariance += (historyLive[i] - meanLive) * (historyScore[i] - meanScore);
+		variance += (historyLive[i] - meanLive) * (historyLive[i] - meanLive);
+	}
+	if (variance <= 0)
+		return;
+	
+	double ratio = covariance / variance;
+	if (ratio < 0.25)
+		ratio = 0.25;
+	if (ratio > 4)
+		ratio = 4;
+	estimate.tempoRatio = ratio;
+}
+
+double MIDIScoreFollower::getScoreMillis(double liveMillis) const{
+	if (estimate.chord < 0)
+		return 0;
+	return estimate.scoreMillis + (liveMillis - lastLiveMillis) * estimate.tempoRatio;
+}
@@ -0,0 +1,73 @@
+/*
+ *  MIDIScoreFollower.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#ifndef MIDI_SCORE_FOLLOWER
+#define MIDI_SCORE_FOLLOWER
+
+#include "MIDIScore.h"
+#include "MIDIOnsetClusters.h"
+
+struct MIDIFollowEstimate {
+	int chord;//index into the follower's clusters, -1 before anything has matched
+	double scoreMillis;//where we are in the score
+	long scoreTicks;
+	double tempoRatio;//score millis per live millis, 1 = as written, 2 = playing twice as fast
+	double cost;//how far the best path is ahead of the runner up, bigger is surer
+};
+
+//online DTW of live note-ons against the score's chords
+//the score is clustered into chords once, then each incoming note updates a fixed window
+//of path costs around the current position - the same work for every note however long the piece,
+//and nothing is allocated after setScore()
+
+class MIDIScoreFollower{
+public:
+	MIDIScoreFollower();
+	
+	void setScore(MIDIScorePtr score, double chordTolerance = 30);//millis, not real-time
+	void reset();//back to the start of the piece
+	
+	//call for every live note-on, liveMillis on whatever clock you like as long as it's consistent
+	const MIDIFollowEstimate& noteOn(int pitch, double liveMillis);
+	
+	//where we should be now, extrapolated from the last match at the current tempo
+	double getScoreMillis(double liveMillis) const;
+	const MIDIFollowEstimate& getEstimate() const { return estimate; }
+	
+	const MIDIOnsetClusters& getChords() const { return clusters; }
+	
+	float stayPenalty;//another note on the same chord
+	float skipPenalty;//per chord jumped over
+	
+	static const int window = 64;//chords considered at once, a multiple of 4
+	
+private:
+	void shiftWindow(int chords);
+	void updateTempo(double liveMillis, double scoreMillis);
+	
+	MIDIScorePtr score;
+	MIDIOnsetClusters clusters;
+	
+	//costs for chords windowStart-2 .. windowStart+window-1, the first two are guards for the recurrence
+	alignas(16) float costBuffers[2][window + 4];
+	float* cost;
+	float* nextCost;
+	alignas(16) float noteCost[window];
+	int windowStart;
+	
+	MIDIFollowEstimate estimate;
+	double lastLiveMillis;
+	
+	//recent (live, score) matches for the tempo fit
+	static const int tempoHistory = 8;
+	double historyLive[tempoHistory];
+	double historyScore[tempoHistory];
+	int historyCount;
+	int historyNext;
+};
+#endif
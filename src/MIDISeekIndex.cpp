@@ -0,0 +1,128 @@
+/*
+ *  MIDISeekIndex.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#include "MIDISeekIndex.h"
+#include <cstring>
+#include <algorithm>
+
+void MIDIChannelState::reset(){
+	program = 0;
+	pressure = 0;
+	pitchBend = 8192;
+	memset(controllers, 0, sizeof(controllers));
+	memset(noteVelocity, 0, sizeof(noteVelocity));
+	//the usual power-on values
+	controllers[7] = 100;//volume
+	controllers[10] = 64;//pan
+	controllers[11] = 127;//expression
+}
+
+void MIDIPlaybackState::reset(){
+	for (int i = 0; i < 16; i++)
+		channels[i].reset();
+}
+
+void MIDIPlaybackState::apply(const MIDIChannelEvent& event){
+	MIDIChannelState& channel = channels[event.getChannel()];
+	switch (event.getMessageType()){
+		case 0x80://note off
+			channel.noteVelocity[event.data1 & 0x7F] = 0;
+			break;
+		case 0x90://note on
+			channel.noteVelocity[event.data1 & 0x7F] = event.data2;
+			break;
+		case 0xB0://controller
+			channel.controllers[event.data1 & 0x7F] = event.data2;
+			if (event.data1 == 0x7B || event.data1 == 0x78){//all notes / sounds off
+				memset(channel.noteVelocity, 0, sizeof(channel.noteVelocity));
+			}
+			break;
+		case 0xC0:
+			channel.program = event.data1;
+			break;
+		case 0xD0:
+			channel.pressure = event.data1;
+			break;
+		case 0xE0:
+			channel.pitchBend = (event.data2 << 7) | event.data1;
+			break;
+	}
+}
+
+
+MIDISeekIndex::MIDISeekIndex(){
+	intervalTicks = 1;
+}
+
+void MIDISeekIndex::build(MIDIScorePtr newScore, int interval){
+	score = newScore;
+	checkpoints.clear();
+	if (!score)
+		return;
+	
+	intervalTicks = interval > 0 ? interval : 4 * score->pulsesPerQuarternote;
+	if (intervalTicks <= 0)
+		intervalTicks = 1;
+	
+	const std::vector<MIDIChannelEvent>& events = score->channelEvents;
+	
+	Checkpoint checkpoint;
+	checkpoint.ticks = 0;
+	checkpoint.eventIndex = 0;
+	checkpoint.state.reset();
+	checkpoints.push_back(checkpoint);
+	
+	//a checkpoint goes where an interval's first event is, not at every interval up to the
+	//last event - a sparse file with a huge gap would otherwise need one for every empty bar
+	for (int i = 0; i < events.size(); i++){
+		long ticks = events[i].ticks;
+		const Checkpoint& last = checkpoints.back();
+		if (ticks > 0 && ticks / intervalTicks > last.ticks / intervalTicks
+			&& i - last.eventIndex >= checkpointEvents && events[i - 1].ticks < ticks){
+			checkpoint.ticks = ticks;
+			checkpoint.eventIndex = i;
+			checkpoints.push_back(checkpoint);
+		}
+		checkpoint.state.apply(events[i]);
+	}
+}
+
+bool MIDISeekIndex::tickLess(long ticks, const Checkpoint& checkpoint){
+	return ticks < checkpoint.ticks;
+}
+
+//the last checkpoint at or before ticks
+const MIDISeekIndex::Checkpoint& MIDISeekIndex::checkpointAt(long ticks) const{
+	std::vector<Checkpoint>::const_iterator next = std::upper_bound(checkpoints.begin(), checkpoints.end(), ticks, tickLess);
+	return next == checkpoints.begin() ? *next : *(next - 1);
+}
+
+void MIDISeekIndex::stateAt(long ticks, MIDIPlaybackState& state) const{
+	if (checkpoints.empty() || ticks < 0){
+		state.reset();
+		return;
+	}
+	
+	const Checkpoint& checkpoint = checkpointAt(ticks);
+	state = checkpoint.state;
+	
+	const std::vector<MIDIChannelEvent>& events = score->channelEvents;
+	for (int i = checkpoint.eventIndex; i < events.size() && events[i].ticks <= ticks; i++)
+		state.apply(events[i]);
+}
+
+int MIDISeekIndex::eventIndexAfter(long ticks) const{
+	if (checkpoints.empty())
+		return 0;
+	
+	const std::vector<MIDIChannelEvent>& events = score->channelEvents;
+	int i = checkpointAt(ticks).eventIndex;
+	while (i < events.size() && events[i].ticks <= ticks)
+		i++;
+	return i;
+}
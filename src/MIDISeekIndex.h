@@ -0,0 +1,70 @@
+/*
+ *  MIDISeekIndex.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#ifndef MIDI_SEEK_INDEX
+#define MIDI_SEEK_INDEX
+
+#include "MIDIScore.h"
+
+//what a channel looks like at some moment - enough to start playback from there
+struct MIDIChannelState {
+	uint8_t program;
+	uint8_t pressure;//channel aftertouch
+	uint16_t pitchBend;//14 bit, 8192 is centre
+	uint8_t controllers[128];//sustain is controllers[64]
+	uint8_t noteVelocity[128];//0 if the note isn't sounding
+	
+	void reset();
+	bool isSounding(int pitch) const { return noteVelocity[pitch] > 0; }
+	bool sustainOn() const { return controllers[64] >= 64; }
+};
+
+struct MIDIPlaybackState {
+	MIDIChannelState channels[16];
+	
+	void reset();
+	void apply(const MIDIChannelEvent& event);
+};
+
+//checkpoints of all 16 channels every intervalTicks (a 4/4 bar unless told otherwise), but only
+//at intervals where something happens and only once checkpointEvents have gone by since the last,
+//so there is never more than one for every checkpointEvents events, however far apart they are
+//seeking copies the checkpoint at or before the target and replays the events since,
+//so the cost is bounded by one interval's worth of events plus checkpointEvents wherever you seek to
+
+class MIDISeekIndex{
+public:
+	MIDISeekIndex();
+	
+	void build(MIDIScorePtr score, int intervalTicks = 0);
+	
+	//state after every event at or before ticks
+	void stateAt(long ticks, MIDIPlaybackState& state) const;
+	//first event after ticks, where playback carries on from
+	int eventIndexAfter(long ticks) const;
+	
+	MIDIScorePtr getScore() const { return score; }
+	int getIntervalTicks() const { return intervalTicks; }
+	
+private:
+	struct Checkpoint {
+		long ticks;//state just before this tick
+		int eventIndex;//first event not yet applied
+		MIDIPlaybackState state;
+	};
+	
+	static const int checkpointEvents = 64;
+	
+	static bool tickLess(long ticks, const Checkpoint& checkpoint);
+	const Checkpoint& checkpointAt(long ticks) const;
+	
+	MIDIScorePtr score;
+	int intervalTicks;
+	std::vector<Checkpoint> checkpoints;//in tick order, the first at tick 0
+};
+#endif
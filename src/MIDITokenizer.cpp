@@ -0,0 +1,224 @@
+/*
+ *  MIDITokenizer.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#include "MIDITokenizer.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <cstdio>
+
+MIDITokenizer::MIDITokenizer(const MIDITokenizerConfig& c){
+	config = c;
+	if (config.stepsPerQuarter < 1)
+		config.stepsPerQuarter = 1;
+	if (config.maxShiftSteps < 1)
+		config.maxShiftSteps = 1;
+	if (config.velocityBins < 0 || config.velocityBins > 128)
+		config.velocityBins = 0;
+	ticksPerQuarter = 480;
+	truncated = false;
+	output = 0;
+	capacity = 0;
+	written = 0;
+}
+
+void MIDITokenizer::start(){
+	events.clear();
+	timeSignatures.clear();
+	ticksPerQuarter = 480;
+	truncated = false;
+}
+
+size_t MIDITokenizer::tokenize(const std::string& path, uint16_t* out, size_t capacity){
+	start();
+	MIDIParseOptions options;
+	options.quiet = true;
+	options.sink = this;
+	options.sinkOnly = true;
+	MIDIFileReader reader(path, options);
+	result = reader.getParseResult();
+	if (!result.ok())
+		return 0;
+	return finish(out, capacity);
+}
+
+size_t MIDITokenizer::tokenize(const void* data, size_t size, uint16_t* out, size_t capacity){
+	start();
+	MIDIParseOptions options;
+	options.quiet = true;
+	options.sink = this;
+	options.sinkOnly = true;
+	MIDIFileReader reader(data, size, options);
+	result = reader.getParseResult();
+	if (!result.ok())
+		return 0;
+	return finish(out, capacity);
+}
+
+void MIDITokenizer::header(int format, unsigned int tracks, int timingDivision){
+	//SMPTE timing has no quarter notes, treat it as 480 ppq rather than give up
+	if (timingDivision > 0 && timingDivision < 32768)
+		ticksPerQuarter = timingDivision;
+}
+
+void MIDITokenizer::channelEvent(unsigned int track, unsigned long time, MIDIByte status, MIDIByte data1, MIDIByte data2){
+	int type = status & 0xF0;
+	bool on = type == 0x90 && data2 > 0;
+	bool off = type == 0x80 || (type == 0x90 && data2 == 0);
+	if (!on && !(off && config.noteOffs))
+		return;
+	//offs sort before ons at the same time, so a repeated note ends before it starts again
+	events.push_back(((uint64_t)time << 24) | ((uint64_t)on << 16) | ((uint64_t)(data1 & 0x7F) << 8) | (data2 & 0x7F));
+}
+
+void MIDITokenizer::metaEvent(unsigned int track, unsigned long time, MIDIByte code, const std::string& data){
+	if (code == MIDIConstants::MIDI_TIME_SIGNATURE && data.size() >= 2){
+		int numerator = (MIDIByte)data[0];
+		int denominatorPower = (MIDIByte)data[1];
+		if (numerator > 0 && denominatorPower < 8)
+			timeSignatures.push_back(((uint64_t)time << 16) | (numerator << 8) | denominatorPower);
+	}
+}
+
+void MIDITokenizer::emit(uint16_t token){
+	if (written < capacity)
+		output[written++] = token;
+	else
+		truncated = true;
+}
+
+//time shifts from step up to target - whole maxShiftSteps shifts and then the rest,
+//written in one go so a gap of millions of steps costs no more than the room left for it
+void MIDITokenizer::shiftTo(long target, long& step){
+	if (target <= step)
+		return;
+	long whole = (target - step) / config.maxShiftSteps;
+	long rest = (target - step) % config.maxShiftSteps;
+	size_t room = capacity - written;
+	if ((unsigned long)whole > room){
+		std::fill_n(output + written, room, timeShiftToken(config.maxShiftSteps));
+		written = capacity;
+		truncated = true;
+		return;
+	}
+	std::fill_n(output + written, whole, timeShiftToken(config.maxShiftSteps));
+	written += whole;
+	if (rest > 0)
+		emit(timeShiftToken(rest));
+	step = target;
+}
+
+size_t MIDITokenizer::finish(uint16_t* out, size_t outCapacity){
+	output = out;
+	capacity = outCapacity;
+	written = 0;
+	
+	//tracks come in one after another, each already in time order
+	std::sort(events.begin(), events.end());
+	std::sort(timeSignatures.begin(), timeSignatures.end());
+	
+	if (config.boundaries)
+		emit(BEGIN);
+	
+	long step = 0;
+	int lastVelocityBin = -1;
+	
+	//bar lines in ticks, the bar length changing with the time signature
+	double barTicks = 4.0 * ticksPerQuarter;
+	double nextBar = 0;
+	int signature = 0;
+	
+	for (size_t i = 0; i <= events.size() && !truncated; i++){
+		bool last = i == events.size();
+		unsigned long time = last ? 0 : events[i] >> 24;
+		
+		while (config.bars && !last && nextBar <= time && !truncated){
+			while (signature < timeSignatures.size() && (timeSignatures[signature] >> 16) <= nextBar){
+				int numerator = (timeSignatures[signature] >> 8) & 0xFF;
+				int denominator = 1 << (timeSignatures[signature] & 0xFF);
+				barTicks = numerator * 4.0 * ticksPerQuarter / denominator;
+				signature++;
+			}
+			shiftTo((long)(nextBar * config.stepsPerQuarter / ticksPerQuarter + 0.5), step);
+			emit(BAR);
+			nextBar += barTicks;
+		}
+		//once the buffer's full nothing more can go in, however much of the file is left
+		if (last || truncated)
+			break;
+		
+		shiftTo((long)((double)time * config.stepsPerQuarter / ticksPerQuarter + 0.5), step);
+		
+		bool on = (events[i] >> 16) & 1;
+		int pitch = (events[i] >> 8) & 0x7F;
+		if (on){
+			if (config.velocityBins > 0){
+				int bin = (events[i] & 0x7F) * config.velocityBins / 128;
+				if (bin != lastVelocityBin){
+					emit(velocityToken(bin));
+					lastVelocityBin = bin;
+				}
+			}
+			emit(noteOnToken(pitch));
+		} else
+			emit(noteOffToken(pitch));
+	}
+	
+	if (config.boundaries){
+		//always room for the end token, even if the sequence was cut short
+		if (written >= capacity && capacity > 0){
+			written = capacity - 1;
+			truncated = true;
+		}
+		emit(END);
+	}
+	return written;
+}
+
+std::string MIDITokenizer::describe(uint16_t token) const{
+	char text[32];
+	int t = token;
+	if (t == PAD) return "pad";
+	if (t == BEGIN) return "begin";
+	if (t == END) return "end";
+	if (t == BAR) return "bar";
+	t -= FIRST_NOTE_ON;
+	if (t < 128)
+		snprintf(text, sizeof(text), "on %i", t);
+	else if (t < 256)
+		snprintf(text, sizeof(text), "off %i", t - 128);
+	else if (t < 256 + config.maxShiftSteps)
+		snprintf(text, sizeof(text), "shift %i", t - 256 + 1);
+	else if (t < 256 + config.maxShiftSteps + config.velocityBins)
+		snprintf(text, sizeof(text), "velocity %i", t - 256 - config.maxShiftSteps);
+	else
+		return "?";
+	return text;
+}
+
+void MIDITokenizer::tokenizeFiles(const std::vector<std::string>& paths, const MIDITokenizerConfig& config,
+								  uint16_t* out, size_t capacityPerFile, size_t* counts, int threads){
+	if (threads <= 0)
+		threads = std::thread::hardware_concurrency();
+	if (threads <= 0)
+		threads = 1;
+	if (threads > (int)paths.size())
+		threads = paths.size();
+	
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++){
+		workers.push_back(std::thread([&](){
+			MIDITokenizer tokenizer(config);//buffers get reused from file to file
+			for (size_t i = next++; i < paths.size(); i = next++)
+				counts[i] = tokenizer.tokenize(paths[i], out + i * capacityPerFile, capacityPerFile);
+		}));
+	}
+	for (int t = 0; t < workers.size(); t++)
+		workers[t].join();
+}
@@ -0,0 +1,81 @@
+/*
+ *  MIDITokenizer.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#ifndef MIDI_TOKENIZER
+#define MIDI_TOKENIZER
+
+#include "MIDIFileReader.h"
+#include <stdint.h>
+
+struct MIDITokenizerConfig {
+	MIDITokenizerConfig() : stepsPerQuarter(12), maxShiftSteps(96), velocityBins(32),
+		noteOffs(true), bars(true), boundaries(true) {}
+	
+	int stepsPerQuarter;//time quantisation
+	int maxShiftSteps;//longer gaps become several shifts
+	int velocityBins;//0 leaves velocity out altogether
+	bool noteOffs;
+	bool bars;//a bar token at every bar line, from the time signatures (4/4 until told otherwise)
+	bool boundaries;//begin and end of sequence tokens
+};
+
+//event tokens, fed straight from the reader's decode loop - the file is never built into a composition
+//
+//vocabulary, in order: pad, begin, end, bar, note-on x128, note-off x128, time shift x maxShiftSteps (1 step upwards),
+//velocity x velocityBins (set before the note-ons it applies to, only when it changes)
+
+class MIDITokenizer : public MIDIEventSink{
+public:
+	MIDITokenizer(const MIDITokenizerConfig& config = MIDITokenizerConfig());
+	
+	//tokens go into the caller's buffer, returns how many were written
+	//if it doesn't fit the sequence is cut short and wasTruncated() says so
+	size_t tokenize(const std::string& path, uint16_t* out, size_t capacity);
+	size_t tokenize(const void* data, size_t size, uint16_t* out, size_t capacity);
+	
+	//a batch across threads (0 = one per core), file i's tokens at out + i * capacityPerFile and its length in counts[i]
+	static void tokenizeFiles(const std::vector<std::string>& paths, const MIDITokenizerConfig& config,
+							  uint16_t* out, size_t capacityPerFile, size_t* counts, int threads = 0);
+	
+	bool wasTruncated() const { return truncated; }
+	MIDIParseResult getParseResult() const { return result; }
+	
+	//the vocabulary
+	enum { PAD = 0, BEGIN = 1, END = 2, BAR = 3, FIRST_NOTE_ON = 4 };
+	uint16_t noteOnToken(int pitch) const { return FIRST_NOTE_ON + pitch; }
+	uint16_t noteOffToken(int pitch) const { return FIRST_NOTE_ON + 128 + pitch; }
+	uint16_t timeShiftToken(int steps) const { return FIRST_NOTE_ON + 256 + steps - 1; }
+	uint16_t velocityToken(int bin) const { return FIRST_NOTE_ON + 256 + config.maxShiftSteps + bin; }
+	int vocabularySize() const { return FIRST_NOTE_ON + 256 + config.maxShiftSteps + config.velocityBins; }
+	std::string describe(uint16_t token) const;
+	
+	//MIDIEventSink
+	virtual void header(int format, unsigned int tracks, int timingDivision);
+	virtual void channelEvent(unsigned int track, unsigned long time, MIDIByte status, MIDIByte data1, MIDIByte data2);
+	virtual void metaEvent(unsigned int track, unsigned long time, MIDIByte code, const std::string& data);
+	
+private:
+	void start();
+	size_t finish(uint16_t* out, size_t capacity);
+	void emit(uint16_t token);
+	void shiftTo(long target, long& step);
+	
+	MIDITokenizerConfig config;
+	int ticksPerQuarter;
+	
+	//notes as time | off/on | pitch | velocity, so sorting the numbers puts them in order
+	std::vector<uint64_t> events;
+	std::vector<uint64_t> timeSignatures;//time | numerator | denominator
+	
+	uint16_t* output;
+	size_t capacity;
+	size_t written;
+	bool truncated;
+	MIDIParseResult result;
+};
+#endif
@@ -0,0 +1,183 @@
+/*
+ *  MIDITransform.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#include "MIDITransform.h"
+#include <cmath>
+#include <cstring>
+
+MIDITransform::MIDITransform(){
+	clear();
+}
+
+void MIDITransform::clear(){
+	semitones = 0;
+	stretchFactor = 1;
+	gridTicks = 0;
+	quantizeStrength = 1;
+	policy = MIDI_RANGE_CLAMP;
+	for (int v = 0; v < 128; v++)
+		velocityTable[v] = v;
+}
+
+MIDITransform& MIDITransform::transpose(int n){
+	semitones += n;
+	return *this;
+}
+
+MIDITransform& MIDITransform::stretch(double factor){
+	if (factor > 0)
+		stretchFactor *= factor;
+	return *this;
+}
+
+MIDITransform& MIDITransform::quantize(int grid, double strength){
+	//a second quantise replaces the first, quantising twice to different grids isn't worth composing
+	gridTicks = grid > 0 ? grid : 0;
+	quantizeStrength = strength < 0 ? 0 : (strength > 1 ? 1 : strength);
+	return *this;
+}
+
+MIDITransform& MIDITransform::velocityCurve(double gain, double offset, double gamma){
+	//compose with whatever curve is already there
+	for (int v = 0; v < 128; v++){
+		int current = velocityTable[v];
+		if (current == 0)
+			continue;//velocity 0 is a note-off, leave it be
+		double mapped = 127.0 * gain * pow(current / 127.0, gamma) + offset;
+		int value = (int)(mapped + 0.5);
+		velocityTable[v] = value < 1 ? 1 : (value > 127 ? 127 : value);
+	}
+	return *this;
+}
+
+MIDITransform& MIDITransform::outOfRange(MIDIRangePolicy p){
+	policy = p;
+	return *this;
+}
+
+size_t MIDITransform::apply(MIDINoteColumns& notes, const MIDIScore* tempo) const{
+	return run(notes, notes, tempo);
+}
+
+size_t MIDITransform::apply(const MIDINoteColumns& in, MIDINoteColumns& out, const MIDIScore* tempo) const{
+	out.resize(in.size());
+	return run(in, out, tempo);
+}
+
+//in and out can be the same columns, the write position never gets ahead of the read position
+size_t MIDITransform::run(const MIDINoteColumns& in, MIDINoteColumns& out, const MIDIScore* tempo) const{
+	const size_t n = in.size();
+	size_t written = 0;
+	
+	//locals rather than members in the loops, byte stores could alias anything otherwise and nothing would vectorise
+	int16_t pitches[blockSize];
+	uint16_t kept[blockSize];
+	uint8_t table[128];
+	memcpy(table, velocityTable, sizeof(table));
+	const int shift = semitones;
+	const double factor = stretchFactor;
+	bool constantTempo = tempo && tempo->tempoMap.size() == 1;
+	double millisPerTick = constantTempo ? tempo->tempoMap[0].beatPeriod / tempo->pulsesPerQuarternote : 0;
+	
+	for (size_t block = 0; block < n; block += blockSize){
+		const int count = (int)(n - block < blockSize ? n - block : blockSize);
+		
+		//pitch first, it decides which notes survive
+		const uint8_t* inPitch = in.pitch + block;
+		for (int i = 0; i < count; i++)
+			pitches[i] = inPitch[i] + shift;
+		
+		int keptCount = 0;
+		switch (policy){
+			case MIDI_RANGE_CLAMP:
+				for (int i = 0; i < count; i++)
+					pitches[i] = pitches[i] < 0 ? 0 : (pitches[i] > 127 ? 127 : pitches[i]);
+				keptCount = count;
+				break;
+			case MIDI_RANGE_FOLD:
+				for (int i = 0; i < count; i++){
+					while (pitches[i] < 0) pitches[i] += 12;
+					while (pitches[i] > 127) pitches[i] -= 12;
+				}
+				keptCount = count;
+				break;
+			case MIDI_RANGE_DROP:
+				for (int i = 0; i < count; i++){
+					kept[keptCount] = i;
+					keptCount += (pitches[i] >= 0 && pitches[i] <= 127);
+				}
+				break;
+		}
+		
+		const size_t w = written;
+		if (keptCount == count){
+			//straight through, column by column
+			uint8_t* outPitch = out.pitch + w;
+			for (int i = 0; i < count; i++)
+				outPitch[i] = (uint8_t) pitches[i];
+			uint8_t* outVelocity = out.velocity + w;
+			const uint8_t* inVelocity = in.velocity + block;
+			for (int i = 0; i < count; i++)
+				outVelocity[i] = table[inVelocity[i] & 0x7F];
+			//the rest are copied as they are - nothing at all to do if it's in place and nothing's been dropped yet
+			if (&in != &out || w != block){
+				memmove(out.channel + w, in.channel + block, count);
+				memmove(out.track + w, in.track + block, count * sizeof(uint16_t));
+				memmove(out.onsetTicks + w, in.onsetTicks + block, count * sizeof(int32_t));
+				memmove(out.durationTicks + w, in.durationTicks + block, count * sizeof(int32_t));
+				memmove(out.onsetMillis + w, in.onsetMillis + block, count * sizeof(double));
+				memmove(out.durationMillis + w, in.durationMillis + block, count * sizeof(double));
+			}
+		} else {
+			//gather the survivors down
+			for (int k = 0; k < keptCount; k++){
+				const int i = kept[k];
+				out.pitch[w + k] = (uint8_t) pitches[i];
+				out.velocity[w + k] = table[in.velocity[block + i] & 0x7F];
+				out.channel[w + k] = in.channel[block + i];
+				out.track[w + k] = in.track[block + i];
+				out.onsetTicks[w + k] = in.onsetTicks[block + i];
+				out.durationTicks[w + k] = in.durationTicks[block + i];
+				out.onsetMillis[w + k] = in.onsetMillis[block + i];
+				out.durationMillis[w + k] = in.durationMillis[block + i];
+			}
+		}
+		
+		if (gridTicks > 0){
+			int32_t* ticks = out.onsetTicks + w;
+			for (int k = 0; k < keptCount; k++){
+				int32_t nearest = ((ticks[k] + gridTicks / 2) / gridTicks) * gridTicks;
+				ticks[k] += (int32_t) floor((nearest - ticks[k]) * quantizeStrength + 0.5);
+			}
+			if (constantTempo){
+				double* millis = out.onsetMillis + w;
+				for (int k = 0; k < keptCount; k++)
+					millis[k] = ticks[k] * millisPerTick;
+			} else if (tempo){
+				for (int k = 0; k < keptCount; k++){
+					out.onsetMillis[w + k] = tempo->ticksToMillis(ticks[k]);
+					out.durationMillis[w + k] = tempo->durationToMillis(ticks[k], out.durationTicks[w + k]);
+				}
+			}
+		}
+		
+		if (factor != 1){
+			double* onsets = out.onsetMillis + w;
+			double* durations = out.durationMillis + w;
+			for (int k = 0; k < keptCount; k++){
+				onsets[k] *= factor;
+				durations[k] *= factor;
+			}
+		}
+		
+		written += keptCount;
+	}
+	
+	out.resize(written);
+	return written;
+}
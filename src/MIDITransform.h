@@ -0,0 +1,58 @@
+/*
+ *  MIDITransform.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#ifndef MIDI_TRANSFORM
+#define MIDI_TRANSFORM
+
+#include "MIDINoteColumns.h"
+#include "MIDIScore.h"
+
+enum MIDIRangePolicy {
+	MIDI_RANGE_CLAMP,//pin to 0 or 127
+	MIDI_RANGE_DROP,//lose the note
+	MIDI_RANGE_FOLD//shift by octaves until it fits
+};
+
+//a chain of note transforms, applied together in one pass over the columns
+//the operations all touch different columns (or commute) so however the chain is built
+//it collapses to: transpose, velocity curve, quantise (ticks, then millis from the tempo map), stretch
+//
+//the pass goes a block at a time, each operation running down its column within the block while it's in cache,
+//so the loops are simple enough to vectorise - notes are only moved about if some get dropped
+
+class MIDITransform{
+public:
+	MIDITransform();
+	
+	void clear();
+	
+	MIDITransform& transpose(int semitones);
+	MIDITransform& stretch(double factor);//millis only, 2 = half speed
+	MIDITransform& quantize(int gridTicks, double strength = 1);//onsets towards the grid, 0 < strength <= 1
+	MIDITransform& velocityCurve(double gain, double offset = 0, double gamma = 1);//127 * gain * (v/127)^gamma + offset
+	MIDITransform& outOfRange(MIDIRangePolicy policy);
+	
+	//tempo is the score the notes came from, needed to get millis for quantised ticks
+	//without it the millis are left alone when quantising
+	//both return the number of notes left
+	size_t apply(MIDINoteColumns& notes, const MIDIScore* tempo = 0) const;
+	size_t apply(const MIDINoteColumns& in, MIDINoteColumns& out, const MIDIScore* tempo = 0) const;//out is reused
+	
+	static const int blockSize = 1024;
+	
+private:
+	size_t run(const MIDINoteColumns& in, MIDINoteColumns& out, const MIDIScore* tempo) const;
+	
+	int semitones;
+	double stretchFactor;
+	int gridTicks;
+	double quantizeStrength;
+	MIDIRangePolicy policy;
+	uint8_t velocityTable[128];
+};
+#endif
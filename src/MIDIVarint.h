@@ -0,0 +1,59 @@
+/*
+ *  MIDIVarint.h
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+#ifndef MIDI_VARINT
+#define MIDI_VARINT
+
+#include <vector>
+#include <stdint.h>
+#include <cstddef>
+
+//7 bits per byte, low bits first, top bit set on all but the last byte
+//(little endian, unlike MIDI's own variable length numbers)
+
+inline void writeVarint(std::vector<uint8_t>& data, uint64_t n){
+	while (n >= 0x80){
+		data.push_back((n & 0x7F) | 0x80);
+		n >>= 7;
+	}
+	data.push_back(n);
+}
+
+inline uint64_t readVarint(const uint8_t* data, size_t& position){
+	uint64_t n = 0;
+	int shift = 0;
+	uint8_t byte;
+	do {
+		byte = data[position++];
+		n |= (uint64_t)(byte & 0x7F) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+	return n;
+}
+
+//the same, for data that can't be trusted - false if it runs past end or is longer than a 64 bit number needs
+inline bool readVarint(const uint8_t* data, size_t end, size_t& position, uint64_t& n){
+	n = 0;
+	for (int shift = 0; shift < 64 && position < end; shift += 7){
+		uint8_t byte = data[position++];
+		n |= (uint64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+//signed numbers, small either side of zero stay small
+inline uint64_t zigzag(int64_t n){
+	return ((uint64_t)n << 1) ^ (uint64_t)(n >> 63);
+}
+
+inline int64_t unzigzag(uint64_t n){
+	return (int64_t)(n >> 1) ^ -(int64_t)(n & 1);
+}
+#endif
@@ -35,11 +35,15 @@
 #include <fstream>
 #include <string>
 #include <cstdio>
+#include <cstring>
 
 #include "MIDIFileReader.h"
 #include "MIDIEvent.h"
+#include "MIDIArchive.h"
 
 #include <sstream>
+#include <cstdarg>
+#include <algorithm>
 
 using std::string;
 using std::ifstream;
@@ -53,29 +57,123 @@ using namespace MIDIConstants;
 
 //#define DEBUG_MIDI_FILE_READER 1
 
-#define throw_exception(...) do { \
-        char message[128]; \
-        snprintf(message, 128, __VA_ARGS__); \
-        throw MIDIException(std::string(message)); \
-    } while (0)
-    
 
 
-MIDIFileReader::MIDIFileReader(std::string path) :
+MIDIFileReader::MIDIFileReader(std::string path,
+                               const MIDIParseOptions &options) :
     m_timingDivision(0),
     m_format(MIDI_FILE_BAD_FORMAT),
     m_numberOfTracks(0),
     m_trackByteCount(0),
     m_decrementCount(false),
+    m_allocatedBytes(0),
     m_path(path),
-    m_midiFile(0),
-    m_fileSize(0)
+    m_data(0),
+    m_dataSize(0),
+    m_position(0),
+    m_options(options),
+    m_currentTrack(-1),
+    m_failed(false)
 {
+    // Read the whole file in one go and parse it from memory
+    ifstream file(m_path.c_str(), ios::in | ios::binary);
+
+    bool readOK;
+    {
+        MIDI_STATS_TIMER(m_options.stats, MIDI_PHASE_READ, -1);
+        readOK = file && readStream(file);
+    }
+
+    if (!readOK) {
+	setParseError(MIDI_PARSE_NOT_READABLE, "File not found or not readable.");
+	m_format = MIDI_FILE_BAD_FORMAT;
+	return;
+    }
+
+    if (parseFile()) {
+	m_error = "";
+    }
+}
+
+MIDIFileReader::MIDIFileReader(const void *data, size_t size,
+                               const MIDIParseOptions &options) :
+    m_timingDivision(0),
+    m_format(MIDI_FILE_BAD_FORMAT),
+    m_numberOfTracks(0),
+    m_trackByteCount(0),
+    m_decrementCount(false),
+    m_allocatedBytes(0),
+    m_data((const MIDIByte *)data),
+    m_dataSize(size),
+    m_position(0),
+    m_options(options),
+    m_currentTrack(-1),
+    m_failed(false)
+{
+    MIDI_STATS(m_options.stats, bytesRead += size);
+
+    // Gzipped data has to be inflated into our own buffer first
+    if (MIDIGzip::isGzip(data, size)) {
+        MIDI_STATS_TIMER(m_options.stats, MIDI_PHASE_READ, -1);
+        if (!inflated(MIDIGzip::inflate(data, size, m_buffer,
+                                        m_options.maxAllocatedBytes))) {
+            m_format = MIDI_FILE_BAD_FORMAT;
+            return;
+        }
+    }
+
     if (parseFile()) {
 	m_error = "";
     }
 }
 
+MIDIFileReader::MIDIFileReader(std::istream &in,
+                               const MIDIParseOptions &options) :
+    m_timingDivision(0),
+    m_format(MIDI_FILE_BAD_FORMAT),
+    m_numberOfTracks(0),
+    m_trackByteCount(0),
+    m_decrementCount(false),
+    m_allocatedBytes(0),
+    m_data(0),
+    m_dataSize(0),
+    m_position(0),
+    m_options(options),
+    m_currentTrack(-1),
+    m_failed(false)
+{
+    bool readOK;
+    {
+        MIDI_STATS_TIMER(m_options.stats, MIDI_PHASE_READ, -1);
+        readOK = readStream(in);
+    }
+
+    if (!readOK) {
+	setParseError(MIDI_PARSE_NOT_READABLE, "Stream not readable.");
+	m_format = MIDI_FILE_BAD_FORMAT;
+	return;
+    }
+
+    if (parseFile()) {
+	m_error = "";
+    }
+}
+
+MIDIFileReader::MIDIFileReader() :
+    m_timingDivision(0),
+    m_format(MIDI_FILE_BAD_FORMAT),
+    m_numberOfTracks(0),
+    m_trackByteCount(0),
+    m_decrementCount(false),
+    m_allocatedBytes(0),
+    m_data(0),
+    m_dataSize(0),
+    m_position(0),
+    m_currentTrack(-1),
+    m_failed(false)
+{
+}
+
 MIDIFileReader::~MIDIFileReader()
 {
 }
@@ -92,11 +190,90 @@ MIDIFileReader::getError() const
     return m_error;
 }
 
+// Read everything left in a stream into our own buffer and parse
+// from that.  Seekable streams are sized up front so the buffer is
+// only allocated once, and gzipped ones are inflated as they're read.
+//
+bool
+MIDIFileReader::readStream(std::istream &in)
+{
+    if (MIDIGzip::isGzip(in)) {
+        return inflated(MIDIGzip::inflate(in, m_buffer, m_options.maxAllocatedBytes));
+    }
+
+    // Our copy counts against the allocation limit like everything
+    // else, so don't read more than it would allow
+    size_t limit = m_options.maxAllocatedBytes;
+
+    std::streampos start = in.tellg();
+    if (start != std::streampos(-1) && in.seekg(0, ios::end)) {
+        std::streampos end = in.tellg();
+        in.seekg(start);
+        size_t size = (size_t)(end - start);
+        if (limit && size > limit) {
+            setParseError(MIDI_PARSE_LIMIT_EXCEEDED, "Data is over the limit");
+            return false;
+        }
+        m_buffer.resize(size);
+        if (!m_buffer.empty()) {
+            in.read(&m_buffer[0], m_buffer.size());
+        }
+        m_buffer.resize((size_t)in.gcount());
+    } else {
+        in.clear();
+        char block[65536];
+        while (in.read(block, sizeof(block)) || in.gcount() > 0) {
+            if (limit && m_buffer.size() + in.gcount() > limit) {
+                setParseError(MIDI_PARSE_LIMIT_EXCEEDED, "Data is over the limit");
+                return false;
+            }
+            m_buffer.insert(m_buffer.end(), block, block + in.gcount());
+        }
+    }
+
+    if (in.bad()) {
+        return false;
+    }
+
+    m_data = m_buffer.empty() ? 0 : (const MIDIByte *)&m_buffer[0];
+    m_dataSize = m_buffer.size();
+    m_position = 0;
+
+    MIDI_STATS(m_options.stats, bytesRead += m_dataSize);
+    MIDI_STATS(m_options.stats, allocations++);
+    MIDI_STATS(m_options.stats, allocatedBytes += m_buffer.capacity());
+    return true;
+}
+
+// Point the parse at a freshly inflated m_buffer, or record why it
+// couldn't be inflated.  The inflated size counts against the same
+// allocation limit as the events do.
+//
+bool
+MIDIFileReader::inflated(int result)
+{
+    if (result == MIDI_INFLATE_TOO_BIG) {
+        setParseError(MIDI_PARSE_LIMIT_EXCEEDED, "Inflated data is over the limit");
+        return false;
+    } else if (result != MIDI_INFLATE_OK) {
+        setParseError(MIDI_PARSE_NOT_READABLE, "Compressed data is corrupt or unsupported.");
+        return false;
+    }
+
+    m_data = m_buffer.empty() ? 0 : (const MIDIByte *)&m_buffer[0];
+    m_dataSize = m_buffer.size();
+    m_position = 0;
+
+    MIDI_STATS(m_options.stats, allocations++);
+    return true;
+}
+
 long
 MIDIFileReader::midiBytesToLong(const string& bytes)
 {
     if (bytes.length() != 4) {
-	throw_exception("Wrong length for long data in MIDI stream (%d, should be %d)", (int)bytes.length(), 4);
+	setParseError(MIDI_PARSE_UNEXPECTED_END, "Wrong length for long data in MIDI stream (%d, should be %d)", (int)bytes.length(), 4);
+	return 0;
     }
 
     long longRet = ((long)(((MIDIByte)bytes[0]) << 24)) |
@@ -111,7 +288,8 @@ int
 MIDIFileReader::midiBytesToInt(const string& bytes)
 {
     if (bytes.length() != 2) {
-	throw_exception("Wrong length for int data in MIDI stream (%d, should be %d)", (int)bytes.length(), 2);
+	setParseError(MIDI_PARSE_UNEXPECTED_END, "Wrong length for int data in MIDI stream (%d, should be %d)", (int)bytes.length(), 2);
+	return 0;
     }
 
     int intRet = ((int)(((MIDIByte)bytes[0]) << 8)) |
@@ -127,25 +305,18 @@ MIDIFileReader::midiBytesToInt(const string& bytes)
 MIDIByte
 MIDIFileReader::getMIDIByte()
 {
-    if (!m_midiFile) {
-	throw_exception("getMIDIByte called but no MIDI file open");
-    }
-
-    if (m_midiFile->eof()) {
-        throw_exception("End of MIDI file encountered while reading");
+    if (atEnd()) {
+        setParseError(MIDI_PARSE_UNEXPECTED_END, "End of MIDI file encountered while reading");
+        return 0;
     }
 
     if (m_decrementCount && m_trackByteCount <= 0) {
-        throw_exception("Attempt to get more bytes than expected on Track");
+        setParseError(MIDI_PARSE_TRACK_OVERRUN, "Attempt to get more bytes than expected on Track");
+        return 0;
     }
 
-    char byte;
-    if (m_midiFile->read(&byte, 1)) {
-	--m_trackByteCount;
-	return (MIDIByte)byte;
-    }
-
-    throw_exception("Attempt to read past MIDI file end");
+    --m_trackByteCount;
+    return m_data[m_position++];
 }
 
 
@@ -156,37 +327,31 @@ MIDIFileReader::getMIDIByte()
 string
 MIDIFileReader::getMIDIBytes(unsigned long numberOfBytes)
 {
-    if (!m_midiFile) {
-	throw_exception("getMIDIBytes called but no MIDI file open");
-    }
-
-    if (m_midiFile->eof()) {
-        throw_exception("End of MIDI file encountered while reading");
+    if (numberOfBytes > 0 && atEnd()) {
+        setParseError(MIDI_PARSE_UNEXPECTED_END, "End of MIDI file encountered while reading");
+        return string();
     }
 
     if (m_decrementCount && (numberOfBytes > (unsigned long)m_trackByteCount)) {
-        throw_exception("Attempt to get more bytes than available on Track (%lu, only have %ld)", numberOfBytes, m_trackByteCount);
-    }
-
-    string stringRet;
-    char fileMIDIByte;
-
-    while (stringRet.length() < numberOfBytes &&
-           m_midiFile->read(&fileMIDIByte, 1)) {
-        stringRet += fileMIDIByte;
+        setParseError(MIDI_PARSE_TRACK_OVERRUN, "Attempt to get more bytes than available on Track (%lu, only have %ld)", numberOfBytes, m_trackByteCount);
+        return string();
     }
 
-    // if we've reached the end of file without fulfilling the
-    // quota then panic as our parsing has performed incorrectly
+    // if the file ends before the quota is met then panic as our
+    // parsing has performed incorrectly
     //
-    if (stringRet.length() < numberOfBytes) {
-        stringRet = "";
-        throw_exception("Attempt to read past MIDI file end");
+    if (numberOfBytes > m_dataSize - m_position) {
+        setParseError(MIDI_PARSE_UNEXPECTED_END, "Attempt to read past MIDI file end");
+        m_position = m_dataSize;
+        return string();
     }
 
+    string stringRet((const char *)m_data + m_position, numberOfBytes);
+    m_position += numberOfBytes;
+
     // decrement the byte count
     if (m_decrementCount)
-        m_trackByteCount -= stringRet.length();
+        m_trackByteCount -= numberOfBytes;
 
     return stringRet;
 }
@@ -197,16 +362,12 @@ MIDIFileReader::getMIDIBytes(unsigned long numberOfBytes)
 long
 MIDIFileReader::getNumberFromMIDIBytes(int firstByte)
 {
-    if (!m_midiFile) {
-	throw_exception("getNumberFromMIDIBytes called but no MIDI file open");
-    }
-
     long longRet = 0;
     MIDIByte midiByte;
 
     if (firstByte >= 0) {
 	midiByte = (MIDIByte)firstByte;
-    } else if (m_midiFile->eof()) {
+    } else if (atEnd()) {
 	return longRet;
     } else {
 	midiByte = getMIDIByte();
@@ -215,10 +376,16 @@ MIDIFileReader::getNumberFromMIDIBytes(int firstByte)
     longRet = midiByte;
     if (midiByte & 0x80) {
 	longRet &= 0x7F;
+	int length = 1;
 	do {
+	    // The standard allows four bytes at most
+	    if (++length > 4) {
+		setParseError(MIDI_PARSE_INVALID_EVENT, "Variable length quantity too long");
+		return 0;
+	    }
 	    midiByte = getMIDIByte();
 	    longRet = (longRet << 7) + (midiByte & 0x7F);
-	} while (!m_midiFile->eof() && (midiByte & 0x80));
+	} while (!atEnd() && (midiByte & 0x80));
     }
 
     return longRet;
@@ -226,25 +393,30 @@ MIDIFileReader::getNumberFromMIDIBytes(int firstByte)
 
 
 // Seek to the next track in the midi file and set the number
-// of bytes to be read in the counter m_trackByteCount.
+// of bytes to be read in the counter m_trackByteCount.  Chunks of
+// any other type are hopped over whole using their own lengths.
 //
 bool
 MIDIFileReader::skipToNextTrack()
 {
-    if (!m_midiFile) {
-	throw_exception("skipToNextTrack called but no MIDI file open");
-    }
-
-    string buffer, buffer2;
+    string buffer;
     m_trackByteCount = -1;
     m_decrementCount = false;
 
-    while (!m_midiFile->eof() && (m_decrementCount == false)) {
-        buffer = getMIDIBytes(4); 
+    while (!atEnd() && !m_failed && (m_decrementCount == false)) {
+        buffer = getMIDIBytes(8);
+        if (m_failed) {
+            break;
+        }
+        unsigned long length = (unsigned long)midiBytesToLong(buffer.substr(4));
 	if (buffer.compare(0, 4, MIDI_TRACK_HEADER) == 0) {
-	    m_trackByteCount = midiBytesToLong(getMIDIBytes(4));
+	    m_trackByteCount = length;
 	    m_decrementCount = true;
-	}
+	} else if (length > m_dataSize - m_position) {
+            m_position = m_dataSize;
+        } else {
+            m_position += length;
+        }
     }
 
     if (m_trackByteCount == -1) { // we haven't found a track
@@ -255,97 +427,142 @@ MIDIFileReader::skipToNextTrack()
 }
 
 
-// Read in a MIDI file.  The parsing process throws exceptions back up
-// here if we run into trouble which we can then pass back out to
-// whoever called us using a nice bool.
+// Read in a MIDI file.  Anything going wrong while parsing is
+// recorded in m_result (and m_error) and passed back out to whoever
+// called us using a nice bool.
 //
 bool
 MIDIFileReader::parseFile()
 {
     m_error = "";
+    m_result = MIDIParseResult();
+    m_failed = false;
 
 #ifdef DEBUG_MIDI_FILE_READER
     cerr << "MIDIFileReader::open() : fileName = " << m_path.toStdString() << endl;
 #endif
 
-    // Open the file
-    m_midiFile = new ifstream(m_path.c_str(), ios::in | ios::binary);
-
-    if (!*m_midiFile) {
-	m_error = "File not found or not readable.";
+    if (!m_data) {
+	setParseError(MIDI_PARSE_NO_DATA, "No MIDI data.");
 	m_format = MIDI_FILE_BAD_FORMAT;
-	delete m_midiFile;
-        m_midiFile = 0;
 	return false;
     }
 
+    // Our own copy of the data (read in or inflated) is the first
+    // thing charged against the limit; a caller's buffer isn't ours
+    m_position = 0;
+    m_allocatedBytes = m_buffer.capacity();
+
+    if (m_options.progress) {
+        m_options.progress->totalBytes = m_dataSize;
+    }
+
     bool retval = false;
 
-    try {
+    // Parse the MIDI header first.  The first 14 bytes of the file.
+    bool headerOK;
+    {
+        MIDI_STATS_TIMER(m_options.stats, MIDI_PHASE_HEADER, -1);
+        headerOK = parseHeader(getMIDIBytes(14));
+    }
 
-	// Set file size so we can count it off
-	//
-	m_midiFile->seekg(0, ios::end);
-	m_fileSize = m_midiFile->tellg();
-	m_midiFile->seekg(0, ios::beg);
+    if (!headerOK) {
+        m_failed = false; // report it as a bad header, whatever the cause
+        setParseError(MIDI_PARSE_BAD_HEADER, "Not a MIDI file.");
+        m_format = MIDI_FILE_BAD_FORMAT;
+        goto done;
+    }
 
-	// Parse the MIDI header first.  The first 14 bytes of the file.
-	if (!parseHeader(getMIDIBytes(14))) {
-	    m_format = MIDI_FILE_BAD_FORMAT;
-	    m_error = "Not a MIDI file.";
-	    goto done;
-	}
+    if (m_options.sink) {
+        m_options.sink->header(m_format, m_numberOfTracks, m_timingDivision);
+    }
+
+    if (m_options.progress) {
+        m_options.progress->totalTracks = m_numberOfTracks;
+    }
 
-	for (unsigned int j = 0; j < m_numberOfTracks; ++j) {
+    for (unsigned int j = 0; j < m_numberOfTracks; ++j) {
 
 #ifdef DEBUG_MIDI_FILE_READER
-	    cerr << "Parsing Track " << j << endl;
+        cerr << "Parsing Track " << j << endl;
 #endif
 
-	    if (!skipToNextTrack()) {
+        MIDI_STATS_TIMER(m_options.stats, MIDI_PHASE_DECODE, j);
+
+        m_currentTrack = j;
+
+        if (!skipToNextTrack()) {
 #ifdef DEBUG_MIDI_FILE_READER
-		cerr << "Couldn't find Track " << j << endl;
+            cerr << "Couldn't find Track " << j << endl;
 #endif
-		m_error = "File corrupted or in non-standard format?";
-		m_format = MIDI_FILE_BAD_FORMAT;
-		goto done;
-	    }
+            setParseError(MIDI_PARSE_TRACK_NOT_FOUND, "File corrupted or in non-standard format?");
+            m_format = MIDI_FILE_BAD_FORMAT;
+            goto done;
+        }
 
 #ifdef DEBUG_MIDI_FILE_READER
-	    cerr << "Track has " << m_trackByteCount << " bytes" << endl;
+        cerr << "Track has " << m_trackByteCount << " bytes" << endl;
 #endif
 
-	    // Run through the events taking them into our internal
-	    // representation.
-	    if (!parseTrack(j)) {
+        if (m_options.sink) {
+            m_options.sink->startTrack(j);
+        }
+
+        // Run through the events taking them into our internal
+        // representation.
+        if (!parseTrack(j)) {
 #ifdef DEBUG_MIDI_FILE_READER
-		cerr << "Track " << j << " parsing failed" << endl;
+            cerr << "Track " << j << " parsing failed" << endl;
 #endif
-		m_error = "File corrupted or in non-standard format?";
-		m_format = MIDI_FILE_BAD_FORMAT;
-		goto done;
-	    }
-	}
-	
-	retval = true;
+            setParseError(MIDI_PARSE_BAD_TRACK, "File corrupted or in non-standard format?");
+            m_format = MIDI_FILE_BAD_FORMAT;
+            goto done;
+        }
 
-    } catch (MIDIException e) {
+        if (m_options.sink) {
+            m_options.sink->endTrack(j);
+        }
 
-        cerr << "MIDIFileReader::open() - caught exception - " << e.what() << endl;
-	m_error = e.what();
+        if (m_options.progress) {
+            updateProgress();
+            if (m_failed) {
+                goto done;
+            }
+            ++m_options.progress->tracksDone;
+        }
     }
-    
+
+    retval = true;
+
 done:
-    m_midiFile->close();
-    delete m_midiFile;
+    if (m_failed && !m_options.quiet) {
+        cerr << "MIDIFileReader::parseFile() - " << m_error << " (offset "
+             << m_result.offset << ", track " << m_result.track << ")" << endl;
+    }
+
+    MIDI_STATS(m_options.stats, bytesParsed += m_position);
 
     for (unsigned int track = 0; track < m_numberOfTracks; ++track) {
+        finaliseTrack(track);
+    }
 
-        // Convert the deltaTime to an absolute time since the track
-        // start.  The addTime method returns the sum of the current
-        // MIDI Event delta time plus the argument.
+    return retval;
+}
 
-	unsigned long acc = 0;
+// Convert a parsed track's delta times to absolute times and pair up
+// its note-offs.
+//
+void
+MIDIFileReader::finaliseTrack(unsigned int track)
+{
+    // Convert the deltaTime to an absolute time since the track
+    // start.  The addTime method returns the sum of the current
+    // MIDI Event delta time plus the argument.
+
+    {
+        MIDI_STATS_TIMER(m_options.stats, MIDI_PHASE_DELTA, track);
+
+        unsigned long acc = 0;
 
         for (MIDITrack::iterator i = m_midiComposition[track].begin();
              i != m_midiComposition[track].end(); ++i) {
@@ -357,10 +574,41 @@ done:
             cerr << " to " << i->getTime() << endl;
 #endif
         }
+    }
 
-        consolidateNoteOffEvents(track);
+    MIDI_STATS_TIMER(m_options.stats, MIDI_PHASE_CONSOLIDATE, track);
+    consolidateNoteOffEvents(track);
+}
+
+bool
+MIDIFileReader::parseTrackChunk(const string &chunkData,
+                                unsigned int trackNum,
+                                MIDITrack &track,
+                                MIDIParseResult *result)
+{
+    MIDIFileReader reader;
+
+    reader.m_data = (const MIDIByte *)chunkData.data();
+    reader.m_dataSize = chunkData.length();
+    reader.m_trackByteCount = chunkData.length();
+    reader.m_decrementCount = true;
+
+    reader.m_currentTrack = trackNum;
+
+    bool retval = reader.parseTrack(trackNum);
+
+    if (!retval && !reader.m_failed) {
+        reader.setParseError(MIDI_PARSE_BAD_TRACK, "Track could not be parsed");
+    }
+    if (result) {
+        *result = reader.m_result;
     }
 
+    reader.m_data = 0;
+
+    reader.finaliseTrack(trackNum);
+    track.swap(reader.m_midiComposition[trackNum]);
+
     return retval;
 }
 
@@ -409,45 +657,305 @@ MIDIFileReader::parseHeader(const string &midiHeader)
     return true; 
 }
 
+// What each status byte means to the track decoder: how many data
+// bytes follow it and who deals with it.  Data bytes (below 0x80)
+// only get here as running status; 0xF7 escapes are length-prefixed
+// like sysex, so they go the same way and their bytes are never
+// taken for events; the system common and real-time messages have
+// no business in a file and are skipped.  This is all
+// constant data, so it's laid down at compile time.
+//
+#define STATUS_ROW(info) info, info, info, info, info, info, info, info, \
+                         info, info, info, info, info, info, info, info
+
+#define DATA_BYTE  { 0, MIDI_STATUS_DATA,    &MIDIFileReader::skipEvent }
+#define CHANNEL_1  { 1, MIDI_STATUS_CHANNEL, &MIDIFileReader::channelEvent<1> }
+#define CHANNEL_2  { 2, MIDI_STATUS_CHANNEL, &MIDIFileReader::channelEvent<2> }
+#define SYSTEM     { 0, MIDI_STATUS_SYSTEM,  &MIDIFileReader::skipEvent }
+
+const MIDIFileReader::StatusInfo MIDIFileReader::m_statusTable[256] = {
+    STATUS_ROW(DATA_BYTE), STATUS_ROW(DATA_BYTE),   // 0x00 - 0x1F
+    STATUS_ROW(DATA_BYTE), STATUS_ROW(DATA_BYTE),
+    STATUS_ROW(DATA_BYTE), STATUS_ROW(DATA_BYTE),
+    STATUS_ROW(DATA_BYTE), STATUS_ROW(DATA_BYTE),   // 0x70 - 0x7F
+    STATUS_ROW(CHANNEL_2),                          // note off
+    STATUS_ROW(CHANNEL_2),                          // note on
+    STATUS_ROW(CHANNEL_2),                          // poly aftertouch
+    STATUS_ROW(CHANNEL_2),                          // controller
+    STATUS_ROW(CHANNEL_1),                          // program change
+    STATUS_ROW(CHANNEL_1),                          // channel aftertouch
+    STATUS_ROW(CHANNEL_2),                          // pitch bend
+    { 0, MIDI_STATUS_SYSEX, &MIDIFileReader::sysExEvent },  // 0xF0
+    SYSTEM, SYSTEM, SYSTEM, SYSTEM, SYSTEM, SYSTEM,
+    { 0, MIDI_STATUS_SYSEX, &MIDIFileReader::sysExEvent },  // 0xF7, escape
+    SYSTEM, SYSTEM, SYSTEM, SYSTEM, SYSTEM, SYSTEM, SYSTEM,
+    { 0, MIDI_STATUS_META, &MIDIFileReader::metaEvent }     // 0xFF
+};
+
+#undef STATUS_ROW
+#undef DATA_BYTE
+#undef CHANNEL_1
+#undef CHANNEL_2
+#undef SYSTEM
+
+// The byte reads on the hot path: the same checks as getMIDIByte(),
+// but inline.
+//
+inline bool
+MIDIFileReader::readByte(MIDIByte &byte)
+{
+    if (m_position < m_dataSize &&
+        (!m_decrementCount || m_trackByteCount > 0)) {
+        --m_trackByteCount;
+        byte = m_data[m_position++];
+        return true;
+    }
+    byte = getMIDIByte(); // to report the error
+    return false;
+}
+
+inline unsigned long
+MIDIFileReader::readDeltaTime()
+{
+    // Nearly always a single byte
+    if (m_position < m_dataSize && !(m_data[m_position] & 0x80) &&
+        (!m_decrementCount || m_trackByteCount > 0)) {
+        --m_trackByteCount;
+        return m_data[m_position++];
+    }
+    return getNumberFromMIDIBytes();
+}
+
+// Channel messages, with DataBytes known at compile time so the
+// common note and controller path has no decisions left in it.
+//
+template <int DataBytes>
+bool
+MIDIFileReader::channelEvent(MIDITrack &events, unsigned int trackNum,
+                             unsigned long deltaTime, unsigned long time,
+                             MIDIByte eventCode, MIDIByte data1)
+{
+    MIDIByte data2 = 0;
+    if (DataBytes == 2 && !readByte(data2)) {
+        return false;
+    }
+
+#ifdef DEBUG_MIDI_FILE_READER
+    cerr << "MIDI event for channel " << (eventCode & MIDI_CHANNEL_NUM_MASK)
+         << " (track " << trackNum << ") with delta time " << deltaTime << endl;
+#endif
+
+    if (m_options.sink) {
+        m_options.sink->channelEvent(trackNum, time, eventCode, data1, data2);
+    }
+    if (!m_options.sinkOnly) {
+        MIDI_STATS(m_options.stats, countPush(events));
+        events.emplace_back(deltaTime, eventCode, data1, data2);
+    }
+    return true;
+}
+
+bool
+MIDIFileReader::metaEvent(MIDITrack &events, unsigned int trackNum,
+                          unsigned long deltaTime, unsigned long time,
+                          MIDIByte eventCode, MIDIByte data1)
+{
+    MIDIByte metaEventCode = data1;
+    unsigned int messageLength = getNumberFromMIDIBytes();
+
+    if (!payloadAllowed(messageLength)) {
+        return false;
+    }
+
+#ifdef DEBUG_MIDI_FILE_READER
+    cerr << "Meta event of type " << int(metaEventCode) << " and " << messageLength << " bytes found" << endl;
+#endif
+    string metaMessage = getMIDIBytes(messageLength);
+
+    if (m_failed) {
+        return false;
+    }
+
+    if (m_options.sink) {
+        m_options.sink->metaEvent(trackNum, time, metaEventCode, metaMessage);
+    }
+
+    if (metaEventCode == MIDI_TRACK_NAME) {
+        m_trackNames[trackNum] = metaMessage.c_str();
+    }
+
+    if (!m_options.sinkOnly) {
+        MIDI_STATS(m_options.stats, countPush(events));
+        events.emplace_back(deltaTime, MIDI_FILE_META_EVENT, metaEventCode, metaMessage);
+    }
+    return true;
+}
+
+bool
+MIDIFileReader::sysExEvent(MIDITrack &events, unsigned int trackNum,
+                           unsigned long deltaTime, unsigned long time,
+                           MIDIByte eventCode, MIDIByte data1)
+{
+    unsigned int messageLength = getNumberFromMIDIBytes(data1);
+
+    if (!payloadAllowed(messageLength)) {
+        return false;
+    }
+
+#ifdef DEBUG_MIDI_FILE_READER
+    cerr << "SysEx of " << messageLength << " bytes found" << endl;
+#endif
+
+    string metaMessage = getMIDIBytes(messageLength);
+
+    if (m_failed) {
+        return false;
+    }
+
+    if (metaMessage.empty() ||
+        MIDIByte(metaMessage[metaMessage.length() - 1]) !=
+            MIDI_END_OF_EXCLUSIVE)
+    {
+#ifdef DEBUG_MIDI_FILE_READER
+        cerr << "MIDIFileReader::parseTrack() - "
+                  << "malformed or unsupported SysEx type"
+                  << endl;
+#endif
+        return true;
+    }
+
+    // chop off the EOX 
+    // length fixed by Pedro Lopez-Cabanillas (20030523)
+    //
+    metaMessage = metaMessage.substr(0, metaMessage.length()-1);
+
+    if (!m_options.sinkOnly) {
+        MIDI_STATS(m_options.stats, countPush(events));
+        events.emplace_back(deltaTime, MIDI_SYSTEM_EXCLUSIVE, metaMessage);
+    }
+    return true;
+}
+
+bool
+MIDIFileReader::skipEvent(MIDITrack &, unsigned int,
+                          unsigned long, unsigned long,
+                          MIDIByte eventCode, MIDIByte)
+{
+#ifdef DEBUG_MIDI_FILE_READER
+    cerr << "MIDIFileReader::parseTrack()" 
+         << " - Unsupported MIDI Event Code:  "
+         << (int)eventCode << endl;
+#endif
+    return true;
+}
+
+// Meta and sysex payloads are checked against the limits before
+// they're read, so a huge length costs nothing.
+//
+bool
+MIDIFileReader::payloadAllowed(unsigned long length)
+{
+    if (m_options.maxPayloadBytes && length > m_options.maxPayloadBytes) {
+        setParseError(MIDI_PARSE_LIMIT_EXCEEDED, "Message of %lu bytes is over the limit", length);
+        return false;
+    }
+    if (!m_options.sinkOnly) {
+        m_allocatedBytes += length;
+    }
+    return true;
+}
+
+inline bool
+MIDIFileReader::withinLimits(const MIDITrack &events, unsigned int eventCount)
+{
+    if (m_options.maxEventsPerTrack && eventCount > m_options.maxEventsPerTrack) {
+        setParseError(MIDI_PARSE_LIMIT_EXCEEDED, "Too many events on track");
+        return false;
+    }
+    if (m_options.maxAllocatedBytes && !m_options.sinkOnly) {
+        // What the track's vector holds, reserved or not - and if it's
+        // full, what it will hold once this event makes it grow
+        size_t capacity = events.capacity();
+        if (events.size() == capacity) {
+            capacity = capacity ? capacity * 2 : 1;
+        }
+        if (m_allocatedBytes + capacity * sizeof(MIDIEvent) > m_options.maxAllocatedBytes) {
+            setParseError(MIDI_PARSE_LIMIT_EXCEEDED, "Too much memory needed for events");
+            return false;
+        }
+    }
+    return true;
+}
+
 // Extract the contents from a MIDI file track and places it into
 // our local map of MIDI events.
 //
 bool
 MIDIFileReader::parseTrack(unsigned int trackNum)
 {
-    MIDIByte midiByte, metaEventCode, data1, data2;
+    MIDIByte midiByte, data1;
     MIDIByte eventCode = 0x80;
-    string metaMessage;
-    unsigned int messageLength;
     unsigned long deltaTime;
     unsigned long accumulatedTime = 0;
 
     // Remember the last non-meta status byte (-1 if we haven't seen one)
     int runningStatus = -1;
 
-    while (!m_midiFile->eof() && (m_trackByteCount > 0)) {
+    unsigned int eventCount = 0;
+
+    // Looked up once rather than for every event, and sized for the
+    // track up front - an event is at least three bytes with running
+    // status and a one byte delta time, so this rarely has to grow.
+    // Sized from the bytes actually there rather than the length the
+    // chunk header claims, and never more than the limits would let
+    // us fill.
+    MIDITrack &events = m_midiComposition[trackNum];
+    if (!m_options.sinkOnly && m_decrementCount && m_trackByteCount > 0) {
+        size_t available = std::min((size_t)m_trackByteCount,
+                                    m_dataSize - m_position);
+        size_t expected = available / 3;
+        if (m_options.maxEventsPerTrack) {
+            expected = std::min(expected, m_options.maxEventsPerTrack);
+        }
+        if (m_options.maxAllocatedBytes) {
+            size_t used = m_allocatedBytes + events.capacity() * sizeof(MIDIEvent);
+            size_t room = used < m_options.maxAllocatedBytes ?
+                m_options.maxAllocatedBytes - used : 0;
+            expected = std::min(expected, room / sizeof(MIDIEvent));
+        }
+        MIDI_STATS(m_options.stats, allocations++);
+        events.reserve(events.size() + expected);
+        MIDI_STATS(m_options.stats, allocatedBytes += events.capacity() * sizeof(MIDIEvent));
+    }
 
-	if (eventCode < 0x80) {
-#ifdef DEBUG_MIDI_FILE_READER
-	    cerr << "WARNING: Invalid event code " << eventCode
-		 << " in MIDI file" << endl;
-#endif
-	    throw_exception("Invalid event code %d found", int(eventCode));
-	}
+    while (!atEnd() && (m_trackByteCount > 0)) {
+
+        ++eventCount;
 
-        deltaTime = getNumberFromMIDIBytes();
+        if (m_options.progress && (eventCount & 0x3ff) == 0) {
+            updateProgress();
+        }
+
+        if (m_failed || !withinLimits(events, eventCount)) {
+            return false;
+        }
+
+        deltaTime = readDeltaTime();
 
 #ifdef DEBUG_MIDI_FILE_READER
 	cerr << "read delta time " << deltaTime << endl;
 #endif
 
         // Get a single byte
-        midiByte = getMIDIByte();
+        if (!readByte(midiByte)) {
+            return false;
+        }
 
         if (!(midiByte & MIDI_STATUS_BYTE_MASK)) {
 
 	    if (runningStatus < 0) {
-		throw_exception("Running status used for first event in track");
+		setParseError(MIDI_PARSE_RUNNING_STATUS, "Running status used for first event in track");
+		return false;
 	    }
 
 	    eventCode = (MIDIByte)runningStatus;
@@ -461,204 +969,568 @@ MIDIFileReader::parseTrack(unsigned int trackNum)
 	    cerr << "have new event code " << int(midiByte) << endl;
 #endif
             eventCode = midiByte;
-	    data1 = getMIDIByte();
+	    if (!readByte(data1)) {
+                return false;
+            }
 	}
 
-        if (eventCode == MIDI_FILE_META_EVENT) {
+        MIDI_STATS(m_options.stats, countEvent(eventCode));
 
-	    metaEventCode = data1;
-            messageLength = getNumberFromMIDIBytes();
+        const StatusInfo &info = m_statusTable[eventCode];
 
-#ifdef DEBUG_MIDI_FILE_READER
-		cerr << "Meta event of type " << int(metaEventCode) << " and " << messageLength << " bytes found, putting on track " << metaTrack << endl;
-#endif
-            metaMessage = getMIDIBytes(messageLength);
+        // Meta events don't take part in running status
+        if (info.statusClass != MIDI_STATUS_META) {
+            runningStatus = eventCode;
+        }
 
-	    accumulatedTime += deltaTime;
+        accumulatedTime += deltaTime;
 
-            MIDIEvent e(deltaTime,
-                        MIDI_FILE_META_EVENT,
-                        metaEventCode,
-                        metaMessage);
+        if (!(this->*info.handler)(events, trackNum, deltaTime,
+                                   accumulatedTime, eventCode, data1)) {
+            return false;
+        }
+    }
 
-	    m_midiComposition[trackNum].push_back(e);
+    if (!m_options.sinkOnly) {
+        m_allocatedBytes += events.capacity() * sizeof(MIDIEvent);
+    }
 
-	    if (metaEventCode == MIDI_TRACK_NAME) {
-		m_trackNames[trackNum] = metaMessage.c_str();
-	    }
+    return !m_failed;
+}
 
-        } else { // non-meta events
+// Publish how far we've got, and give up if we've been cancelled.
+//
+void
+MIDIFileReader::updateProgress()
+{
+    m_options.progress->bytesParsed.store(m_position, std::memory_order_relaxed);
 
-	    runningStatus = eventCode;
+    if (m_options.progress->cancelled.load(std::memory_order_relaxed)) {
+        setParseError(MIDI_PARSE_CANCELLED, "Parse cancelled");
+    }
+}
 
-	    int channel = (eventCode & MIDI_CHANNEL_NUM_MASK);
-	    
-	    accumulatedTime += deltaTime;
+// Record what went wrong and where.  Only the first error counts,
+// anything after it is usually just fallout.
+//
+void
+MIDIFileReader::setParseError(MIDIParseError error, const char *format, ...)
+{
+    if (m_failed) {
+        return;
+    }
 
-            switch (eventCode & MIDI_MESSAGE_TYPE_MASK) {
+    m_failed = true;
+    m_result.error = error;
+    m_result.offset = m_position;
+    m_result.track = m_currentTrack;
+
+    char message[128];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    m_error = message;
+}
 
-            case MIDI_NOTE_ON:
-            case MIDI_NOTE_OFF:
-            case MIDI_POLY_AFTERTOUCH:
-            case MIDI_CTRL_CHANGE:
-                data2 = getMIDIByte();
+MIDIParseResult
+MIDIFileReader::check(const void *data, size_t size)
+{
+    MIDIParseOptions options;
+    options.quiet = true;
+    options.sinkOnly = true; // with no sink, nothing is kept at all
+    MIDIFileReader reader(data, size, options);
+    return reader.getParseResult();
+}
 
-                {
-                // create and store our event
-                MIDIEvent midiEvent(deltaTime, eventCode, data1, data2);
+const char *
+MIDIParseResult::describe() const
+{
+    switch (error) {
+    case MIDI_PARSE_OK:               return "OK";
+    case MIDI_PARSE_NOT_READABLE:     return "File not found or not readable";
+    case MIDI_PARSE_NO_DATA:          return "No MIDI data";
+    case MIDI_PARSE_BAD_HEADER:       return "Not a MIDI file";
+    case MIDI_PARSE_TRACK_NOT_FOUND:  return "Track chunk not found";
+    case MIDI_PARSE_BAD_TRACK:        return "Track could not be parsed";
+    case MIDI_PARSE_UNEXPECTED_END:   return "Unexpected end of data";
+    case MIDI_PARSE_TRACK_OVERRUN:    return "Event runs past end of track";
+    case MIDI_PARSE_RUNNING_STATUS:   return "Running status with no previous status";
+    case MIDI_PARSE_INVALID_EVENT:    return "Invalid event code";
+    case MIDI_PARSE_CANCELLED:        return "Cancelled";
+    case MIDI_PARSE_LIMIT_EXCEEDED:   return "Over the resource limits";
+    }
+    return "Unknown error";
+}
 
-#ifdef DEBUG_MIDI_FILE_READER
-		cerr << "MIDI event for channel " << channel << " (track "
-                     << trackNum << ") with delta time " << deltaTime << endl;
-#endif
+// Delete dead NOTE OFF and NOTE ON/Zero Velocity Events after
+// reading them and modifying their relevant NOTE ONs.  Return true
+// if there are some notes in this track.
+//
+// Each note-off goes to the earliest note-on still waiting on the
+// same channel and pitch, which is what searching forward from each
+// note-on in turn gives - but done in one pass, with a queue of
+// waiting notes per channel and pitch, and the dead events all
+// squeezed out together at the end.  Notes left waiting last until
+// the end of the track, as it stood when they'd have been reached.
+//
+bool
+MIDIFileReader::consolidateNoteOffEvents(unsigned int track)
+{
+    static const size_t none = size_t(-1);
 
-                m_midiComposition[trackNum].push_back(midiEvent);
-                }
-                break;
+    bool notesOnTrack = false;
 
-            case MIDI_PITCH_BEND:
-                data2 = getMIDIByte();
+    MIDITrack &t = m_midiComposition[track];
+    size_t count = t.size();
 
-                {
-                // create and store our event
-                MIDIEvent midiEvent(deltaTime, eventCode, data1, data2);
-                m_midiComposition[trackNum].push_back(midiEvent);
-                }
-                break;
-
-            case MIDI_PROG_CHANGE:
-            case MIDI_CHNL_AFTERTOUCH:
-                
-                {
-                // create and store our event
-                MIDIEvent midiEvent(deltaTime, eventCode, data1);
-                m_midiComposition[trackNum].push_back(midiEvent);
-                }
-                break;
+    std::vector<size_t> head(16 * 128, none), tail(16 * 128, none);
+    std::vector<size_t> next(count, none);
+    std::vector<size_t> usedBy(count, none);   // the note-on a note-off went to
 
-            case MIDI_SYSTEM_EXCLUSIVE:
-                messageLength = getNumberFromMIDIBytes(data1);
+    for (size_t i = 0; i < count; ++i) {
 
-#ifdef DEBUG_MIDI_FILE_READER
-		cerr << "SysEx of " << messageLength << " bytes found" << endl;
-#endif
+        MIDIEvent &e = t[i];
+        MIDIByte type = e.getMessageType();
 
-                metaMessage= getMIDIBytes(messageLength);
+        if (type != MIDI_NOTE_ON && type != MIDI_NOTE_OFF) {
+            continue;
+        }
 
-                if (MIDIByte(metaMessage[metaMessage.length() - 1]) !=
-                        MIDI_END_OF_EXCLUSIVE)
-                {
-#ifdef DEBUG_MIDI_FILE_READER
-                    cerr << "MIDIFileReader::parseTrack() - "
-                              << "malformed or unsupported SysEx type"
-                              << endl;
-#endif
-                    continue;
-                }
+        size_t key = (e.getChannelNumber() & 0x0f) * 128 + (e.getPitch() & 0x7f);
 
-                // chop off the EOX 
-                // length fixed by Pedro Lopez-Cabanillas (20030523)
-                //
-                metaMessage = metaMessage.substr(0, metaMessage.length()-1);
+        if (type == MIDI_NOTE_ON && e.getVelocity() > 0) {
 
-                {
-                MIDIEvent midiEvent(deltaTime,
-                                    MIDI_SYSTEM_EXCLUSIVE,
-                                    metaMessage);
-                m_midiComposition[trackNum].push_back(midiEvent);
-                }
-                break;
+            notesOnTrack = true;
+
+            if (tail[key] == none) {
+                head[key] = i;
+            } else {
+                next[tail[key]] = i;
+            }
+            tail[key] = i;
+
+        } else if (head[key] != none) {
+
+            MIDIEvent &on = t[head[key]];
 
-            case MIDI_END_OF_EXCLUSIVE:
 #ifdef DEBUG_MIDI_FILE_READER
-                cerr << "MIDIFileReader::parseTrack() - "
-                          << "Found a stray MIDI_END_OF_EXCLUSIVE" << endl;
+            cerr << "Found note-off at " << e.getTime() << " for note at " << on.getTime() << endl;
 #endif
-                break;
 
-            default:
+            on.setDuration(e.getTime() - on.getTime());
+            usedBy[i] = head[key];
+
+            head[key] = next[head[key]];
+            if (head[key] == none) {
+                tail[key] = none;
+            }
+        }
+    }
+
+    if (!notesOnTrack) {
+        return false;
+    }
+
+    // If no matching NOTE OFF has been found then set
+    // Event duration to length of track
+    //
+    // The end of the track for a note is its last event not already
+    // taken by an earlier note, so it only moves back as we go on
+    //
+    std::vector<size_t> waiting;
+    for (size_t key = 0; key < head.size(); ++key) {
+        for (size_t i = head[key]; i != none; i = next[i]) {
+            waiting.push_back(i);
+        }
+    }
+    std::sort(waiting.begin(), waiting.end());
+
+    size_t last = count - 1;
+    for (size_t w = 0; w < waiting.size(); ++w) {
+        size_t i = waiting[w];
+        while (usedBy[last] < i) {
+            --last;
+        }
 #ifdef DEBUG_MIDI_FILE_READER
-                cerr << "MIDIFileReader::parseTrack()" 
-                          << " - Unsupported MIDI Event Code:  "
-                          << (int)eventCode << endl;
+        cerr << "Failed to find note-off for note at " << t[i].getTime() << endl;
 #endif
-                break;
-            } 
+        t[i].setDuration(t[last].getTime() - t[i].getTime());
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (usedBy[i] != none) {
+            continue;
+        }
+        if (kept != i) {
+            t[kept] = std::move(t[i]);
         }
+        ++kept;
     }
+    t.erase(t.begin() + kept, t.end());
 
-    return true;
+    return notesOnTrack;
 }
 
-// Delete dead NOTE OFF and NOTE ON/Zero Velocity Events after
-// reading them and modifying their relevant NOTE ONs.  Return true
-// if there are some notes in this track.
+MIDIComposition
+MIDIFileReader::load() const
+{
+    return m_midiComposition;
+}
+
+const MIDIComposition &
+MIDIFileReader::getComposition() const
+{
+    return m_midiComposition;
+}
+
+
+
+
+static unsigned long
+bigEndian32(const MIDIByte *p)
+{
+    return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) |
+           ((unsigned long)p[2] << 8) | (unsigned long)p[3];
+}
+
+// Variable length number from a buffer, false if it runs off the end.
+//
+static bool
+readVariableLength(const MIDIByte *data, size_t size, size_t &pos,
+                   unsigned long &value)
+{
+    value = 0;
+    for (int i = 0; i < 4; ++i) {
+        if (pos >= size) return false;
+        MIDIByte b = data[pos++];
+        value = (value << 7) | (b & 0x7F);
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+// Data bytes following a channel or system common status byte.
 //
+static int
+dataByteCount(MIDIByte status)
+{
+    switch (status & MIDI_MESSAGE_TYPE_MASK) {
+    case MIDI_PROG_CHANGE:
+    case MIDI_CHNL_AFTERTOUCH:
+        return 1;
+    case MIDI_SYSTEM_EXCLUSIVE:
+        if (status == MIDI_SONG_POSITION_PTR) return 2;
+        if (status == MIDI_TC_QUARTER_FRAME || status == MIDI_SONG_SELECT) return 1;
+        return 0;
+    default:
+        return 2;
+    }
+}
+
 bool
-MIDIFileReader::consolidateNoteOffEvents(unsigned int track)
+MIDIFileReader::probeHeader(const MIDIByte *header, MIDIProbeInfo &info)
 {
-    bool notesOnTrack = false;
-    bool noteOffFound;
+    if (memcmp(header, MIDI_FILE_HEADER, 4) != 0 ||
+        bigEndian32(header + 4) != 6) {
+        return false;
+    }
 
-    MIDITrack &t = m_midiComposition[track];
+    info.format = (MIDIFileFormatType)((header[8] << 8) | header[9]);
+    info.numberOfTracks = (header[10] << 8) | header[11];
+    info.timingDivision = (header[12] << 8) | header[13];
+    return true;
+}
 
-    for (MIDITrack::iterator i = t.begin(); i != t.end(); ++i) {
+// Walk one track's events looking only at the meta events.
+//
+bool
+MIDIFileReader::scanTrackMeta(const MIDIByte *data, size_t size, int track,
+                              MIDIProbeInfo &info,
+                              std::vector<std::pair<unsigned long, long> > &tempi)
+{
+    size_t pos = 0;
+    unsigned long time = 0;
+    unsigned long delta, length;
+    MIDIByte runningStatus = 0;
 
-        if (i->getMessageType() == MIDI_NOTE_ON && i->getVelocity() > 0) {
+    while (pos < size) {
 
-#ifdef DEBUG_MIDI_FILE_READER
-            cerr << "Looking for note-offs for note at " << i->getTime() << " (pitch " << (int)i->getPitch() << ")" <<  endl;
-#endif
+        if (!readVariableLength(data, size, pos, delta) || pos >= size) {
+            return false;
+        }
+        time += delta;
 
-	    notesOnTrack = true;
-            noteOffFound = false;
+        MIDIByte status = data[pos];
+        if (status & MIDI_STATUS_BYTE_MASK) {
+            ++pos;
+        } else if (runningStatus) {
+            status = runningStatus;   // this byte is the first data byte
+        } else {
+            return false;
+        }
 
-            for (MIDITrack::iterator j = i; j != t.end(); ++j) {
+        if (status == MIDI_FILE_META_EVENT) {
 
-                if ((j->getChannelNumber() == i->getChannelNumber()) &&
-		    (j->getPitch() == i->getPitch()) &&
-                    (j->getMessageType() == MIDI_NOTE_OFF ||
-                    (j->getMessageType() == MIDI_NOTE_ON &&
-                     j->getVelocity() == 0x00))) {
+            if (pos >= size) return false;
+            MIDIByte type = data[pos++];
+            if (!readVariableLength(data, size, pos, length) ||
+                length > size - pos) {
+                return false;
+            }
 
-#ifdef DEBUG_MIDI_FILE_READER
-                    cerr << "Found note-off at " << j->getTime() << " for note at " << i->getTime() << endl;
-#endif
+            if (type == MIDI_TRACK_NAME && info.trackNames.find(track) == info.trackNames.end()) {
+                info.trackNames[track] = string((const char *)data + pos, length);
+            } else if (type == MIDI_SET_TEMPO && length == 3) {
+                long tempo = (data[pos] << 16) | (data[pos+1] << 8) | data[pos+2];
+                tempi.push_back(std::pair<unsigned long, long>(time, tempo));
+            } else if (type == MIDI_END_OF_TRACK) {
+                pos = size;
+            }
+            pos += length;
 
-                    i->setDuration(j->getTime() - i->getTime());
+        } else if (status == MIDI_SYSTEM_EXCLUSIVE || status == MIDI_END_OF_EXCLUSIVE) {
 
-#ifdef DEBUG_MIDI_FILE_READER
-                    cerr << "Duration is now " << i->getDuration() << endl;
-#endif
+            if (!readVariableLength(data, size, pos, length) ||
+                length > size - pos) {
+                return false;
+            }
+            pos += length;
 
-                    t.erase(j);
+        } else {
 
-                    noteOffFound = true;
-                    break;
-                }
+            if (status < MIDI_SYSTEM_EXCLUSIVE) {
+                runningStatus = status;
             }
+            pos += dataByteCount(status);
+        }
+    }
 
-            // If no matching NOTE OFF has been found then set
-            // Event duration to length of track
-            //
-            if (!noteOffFound) {
-#ifdef DEBUG_MIDI_FILE_READER
-                cerr << "Failed to find note-off for note at " << i->getTime() << endl;
-#endif
-		MIDITrack::iterator j = t.end();
-		--j;
-                i->setDuration(j->getTime() - i->getTime());
-	    }
+    if (time > info.durationTicks) {
+        info.durationTicks = time;
+    }
+    return true;
+}
+
+static bool
+tempoTickLess(const std::pair<unsigned long, long> &a,
+              const std::pair<unsigned long, long> &b)
+{
+    return a.first < b.first;
+}
+
+// Turn the end tick into millis using whatever tempo changes we saw.
+//
+void
+MIDIFileReader::finishProbe(MIDIProbeInfo &info,
+                            std::vector<std::pair<unsigned long, long> > &tempi)
+{
+    info.tempoChanges = tempi.size();
+
+    if (info.timingDivision & 0x8000) {
+        // SMPTE: frames per second and ticks per frame
+        int frames = 256 - (info.timingDivision >> 8);
+        int subframes = info.timingDivision & 0xff;
+        if (frames > 0 && subframes > 0) {
+            info.durationMillis = info.durationTicks * 1000.0 / (frames * subframes);
         }
+        return;
     }
 
-    return notesOnTrack;
+    if (info.timingDivision == 0) {
+        return;
+    }
+
+    // By tick only: tempi come in track then file order, so the
+    // last of several at the same tick wins, as in the loaded score.
+    std::stable_sort(tempi.begin(), tempi.end(), tempoTickLess);
+
+    double millis = 0;
+    unsigned long tick = 0;
+    long tempo = 500000; // 120bpm until told otherwise
+
+    for (size_t i = 0; i < tempi.size() && tempi[i].first < info.durationTicks; ++i) {
+        millis += (tempi[i].first - tick) * (tempo / 1000.0) / info.timingDivision;
+        tick = tempi[i].first;
+        tempo = tempi[i].second;
+    }
+
+    info.durationMillis = millis + (info.durationTicks - tick) * (tempo / 1000.0) / info.timingDivision;
 }
 
-MIDIComposition
-MIDIFileReader::load() const
+// Gzipped data is probed once it's been inflated, as it would be
+// parsed - but the inflated bytes are taken as they are, so a file
+// that inflates to itself can't keep us going round.
+//
+MIDIParseResult
+MIDIFileReader::probeInflated(const std::vector<char> &buffer,
+                              int inflateResult,
+                              MIDIProbeInfo &info, bool scanMeta)
 {
-    return m_midiComposition;
+    if (inflateResult != MIDI_INFLATE_OK) {
+        MIDIParseResult result;
+        info = MIDIProbeInfo();
+        info.metaScanned = scanMeta;
+        result.error = inflateResult == MIDI_INFLATE_TOO_BIG ?
+            MIDI_PARSE_LIMIT_EXCEEDED : MIDI_PARSE_NOT_READABLE;
+        return result;
+    }
+    return probeBytes(buffer.empty() ? 0 : &buffer[0], buffer.size(),
+                      info, scanMeta);
+}
+
+MIDIParseResult
+MIDIFileReader::probe(const void *data, size_t size, MIDIProbeInfo &info,
+                      bool scanMeta, const MIDIParseOptions &options)
+{
+    if (MIDIGzip::isGzip(data, size)) {
+        std::vector<char> buffer;
+        int inflateResult = MIDIGzip::inflate(data, size, buffer,
+                                              options.maxAllocatedBytes);
+        return probeInflated(buffer, inflateResult, info, scanMeta);
+    }
+    return probeBytes(data, size, info, scanMeta);
+}
+
+MIDIParseResult
+MIDIFileReader::probeBytes(const void *data, size_t size, MIDIProbeInfo &info,
+                           bool scanMeta)
+{
+    const MIDIByte *bytes = (const MIDIByte *)data;
+    MIDIParseResult result;
+    info = MIDIProbeInfo();
+    info.metaScanned = scanMeta;
+
+    if (size < 14 || !probeHeader(bytes, info)) {
+        result.error = MIDI_PARSE_BAD_HEADER;
+        return result;
+    }
+
+    std::vector<std::pair<unsigned long, long> > tempi;
+    size_t pos = 14;
+
+    while (pos + 8 <= size) {
+        unsigned long length = bigEndian32(bytes + pos + 4);
+        if (memcmp(bytes + pos, MIDI_TRACK_HEADER, 4) == 0) {
+            size_t available = std::min((size_t)length, size - pos - 8);
+            if (scanMeta &&
+                !scanTrackMeta(bytes + pos + 8, available, info.tracksFound, info, tempi) &&
+                result.ok()) {
+                result.error = MIDI_PARSE_BAD_TRACK;
+                result.offset = pos;
+                result.track = info.tracksFound;
+            }
+            info.trackSizes.push_back(length);
+            ++info.tracksFound;
+        }
+        if (length > size - pos - 8) {
+            if (result.ok()) {
+                result.error = MIDI_PARSE_UNEXPECTED_END;
+                result.offset = size;
+                result.track = info.tracksFound - 1;
+            }
+            break;
+        }
+        pos += 8 + length;
+    }
+
+    if (scanMeta) {
+        finishProbe(info, tempi);
+    }
+
+    if (result.ok() && info.tracksFound < info.numberOfTracks) {
+        result.error = MIDI_PARSE_TRACK_NOT_FOUND;
+        result.offset = pos;
+        result.track = info.tracksFound;
+    }
+
+    return result;
 }
 
+// The file version seeks over track chunks rather than reading them,
+// unless we're scanning them for meta events.
+//
+MIDIParseResult
+MIDIFileReader::probe(const std::string &path, MIDIProbeInfo &info,
+                      bool scanMeta, const MIDIParseOptions &options)
+{
+    MIDIParseResult result;
+    info = MIDIProbeInfo();
+    info.metaScanned = scanMeta;
+
+    ifstream file(path.c_str(), ios::in | ios::binary);
+    if (!file) {
+        result.error = MIDI_PARSE_NOT_READABLE;
+        return result;
+    }
+
+    // No hopping about in a gzipped file - it has to be inflated whole
+    if (MIDIGzip::isGzip(file)) {
+        std::vector<char> buffer;
+        int inflateResult = MIDIGzip::inflate(file, buffer,
+                                              options.maxAllocatedBytes);
+        return probeInflated(buffer, inflateResult, info, scanMeta);
+    }
+
+    file.seekg(0, ios::end);
+    size_t fileSize = (size_t)file.tellg();
+    file.seekg(0, ios::beg);
+
+    MIDIByte header[14];
+    if (!file.read((char *)header, 14) || !probeHeader(header, info)) {
+        result.error = MIDI_PARSE_BAD_HEADER;
+        return result;
+    }
+
+    std::vector<std::pair<unsigned long, long> > tempi;
+    std::vector<MIDIByte> chunk;
+    size_t pos = 14;
+    MIDIByte chunkHeader[8];
 
+    while (pos + 8 <= fileSize && file.read((char *)chunkHeader, 8)) {
+        unsigned long length = bigEndian32(chunkHeader + 4);
+        size_t available = std::min((size_t)length, fileSize - pos - 8);
+
+        if (memcmp(chunkHeader, MIDI_TRACK_HEADER, 4) == 0) {
+            if (scanMeta) {
+                chunk.resize(available);
+                if (available > 0) {
+                    file.read((char *)&chunk[0], available);
+                }
+                if (!scanTrackMeta(chunk.empty() ? 0 : &chunk[0], available,
+                                   info.tracksFound, info, tempi) && result.ok()) {
+                    result.error = MIDI_PARSE_BAD_TRACK;
+                    result.offset = pos;
+                    result.track = info.tracksFound;
+                }
+            }
+            info.trackSizes.push_back(length);
+            ++info.tracksFound;
+        }
+
+        if (length > fileSize - pos - 8) {
+            if (result.ok()) {
+                result.error = MIDI_PARSE_UNEXPECTED_END;
+                result.offset = fileSize;
+                result.track = info.tracksFound - 1;
+            }
+            break;
+        }
+
+        pos += 8 + length;
+        file.seekg(pos, ios::beg);
+    }
+
+    if (scanMeta) {
+        finishProbe(info, tempi);
+    }
+
+    if (result.ok() && info.tracksFound < info.numberOfTracks) {
+        result.error = MIDI_PARSE_TRACK_NOT_FOUND;
+        result.offset = pos;
+        result.track = info.tracksFound;
+    }
+
+    return result;
+}
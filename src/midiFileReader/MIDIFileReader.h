@@ -34,32 +34,214 @@
 #define _MIDI_FILE_READER_H_
 
 #include "MIDIComposition.h"
+#include "MIDILoadStats.h"
 
 #include <set>
+#include <vector>
 #include <iostream>
+#include <atomic>
 
 typedef unsigned char MIDIByte;
 
+// Progress of a parse, for watching (and cancelling) it from another
+// thread.  The totals are known once the data is in memory and the
+// header has been read.
+//
+struct MIDIParseProgress
+{
+    MIDIParseProgress() :
+        bytesParsed(0), totalBytes(0),
+        tracksDone(0), totalTracks(0),
+        cancelled(false) { }
+
+    std::atomic<size_t>   bytesParsed;
+    std::atomic<size_t>   totalBytes;
+    std::atomic<unsigned> tracksDone;
+    std::atomic<unsigned> totalTracks;
+    std::atomic<bool>     cancelled;   // set to make the parse give up
+};
+
+// Receives events straight from the decode loop, for consumers that
+// want to stream through a file rather than look at the composition
+// afterwards.  Times are absolute (in ticks from the track start),
+// tracks arrive one after another, and note-offs are not paired up.
+//
+class MIDIEventSink
+{
+public:
+    virtual ~MIDIEventSink() { }
+
+    virtual void header(int format, unsigned int tracks, int timingDivision) { }
+    virtual void startTrack(unsigned int track) { }
+    virtual void channelEvent(unsigned int track, unsigned long time,
+                              MIDIByte status, MIDIByte data1, MIDIByte data2) = 0;
+    virtual void metaEvent(unsigned int track, unsigned long time, MIDIByte code,
+                           const std::string &data) { }
+    virtual void endTrack(unsigned int track) { }
+};
+
+// The limits are there so that one hostile file can't take all the
+// memory or time a worker has.  Zero means no limit.  With them in
+// place a parse is linear in the size of the data: decoding touches
+// each byte once, hopping over unknown chunks costs one step per
+// chunk, and note-off pairing is a single pass per track.
+//
+// maxAllocatedBytes is charged with what the reader keeps: its own
+// copy of the data (read from a file or stream, or inflated - not a
+// caller's buffer), the capacity of each track's event vector,
+// including the growth the next event would cause, and meta and sysex
+// payloads.  It doesn't cover scratch space: pairing note-offs needs
+// about 24 bytes per event of the track being finished, and a buffer
+// that grows briefly holds its old and new copies together.  Those
+// come on top of the limit and are freed straight away.
+//
+struct MIDIParseOptions
+{
+    MIDIParseOptions() : progress(0), stats(0), quiet(false),
+                         sink(0), sinkOnly(false),
+                         maxEventsPerTrack(1 << 24),
+                         maxPayloadBytes(1 << 24),
+                         maxAllocatedBytes(size_t(1) << 30) { }
+
+    MIDIParseProgress *progress;
+    MIDILoadStats     *stats;      // filled in if built with MIDI_LOAD_STATS
+    bool               quiet;      // nothing on the console for bad files
+    MIDIEventSink     *sink;       // told about every event as it's decoded
+    bool               sinkOnly;   // don't keep the events, the sink has them
+
+    size_t             maxEventsPerTrack;
+    size_t             maxPayloadBytes;    // longest meta or sysex message
+    size_t             maxAllocatedBytes;  // data, events and payloads, whole file
+};
+
+// Errors are reported as codes rather than exceptions, so scanning
+// a dirty corpus costs no more for the bad files than the good ones.
+//
+enum MIDIParseError
+{
+    MIDI_PARSE_OK = 0,
+    MIDI_PARSE_NOT_READABLE,
+    MIDI_PARSE_NO_DATA,
+    MIDI_PARSE_BAD_HEADER,
+    MIDI_PARSE_TRACK_NOT_FOUND,
+    MIDI_PARSE_BAD_TRACK,
+    MIDI_PARSE_UNEXPECTED_END,
+    MIDI_PARSE_TRACK_OVERRUN,
+    MIDI_PARSE_RUNNING_STATUS,
+    MIDI_PARSE_INVALID_EVENT,
+    MIDI_PARSE_CANCELLED,
+    MIDI_PARSE_LIMIT_EXCEEDED
+};
+
+struct MIDIParseResult
+{
+    MIDIParseResult() : error(MIDI_PARSE_OK), offset(0), track(-1) { }
+
+    bool ok() const { return error == MIDI_PARSE_OK; }
+    const char *describe() const;
+
+    MIDIParseError error;
+    size_t         offset;     // byte offset into the data where it went wrong
+    int            track;      // -1 if it wasn't in a track
+};
+
+// What MIDIFileReader::probe() finds out about a file without
+// parsing it.  The names, tempo and duration are only filled in if
+// the meta events were scanned.  durationMillis follows the file's
+// own tempo events; MIDIFileLoader::probe() gives it as the loader
+// would time the notes.
+//
+struct MIDIProbeInfo
+{
+    MIDIProbeInfo() :
+        format(MIDIConstants::MIDI_FILE_BAD_FORMAT),
+        numberOfTracks(0), tracksFound(0), timingDivision(0),
+        metaScanned(false), durationTicks(0), durationMillis(0),
+        tempoChanges(0) { }
+
+    MIDIConstants::MIDIFileFormatType format;
+    unsigned int numberOfTracks;   // as the header claims
+    unsigned int tracksFound;      // MTrk chunks actually present
+    int          timingDivision;
+    std::vector<size_t> trackSizes;
+
+    bool         metaScanned;
+    std::map<int, std::string> trackNames;
+    unsigned long durationTicks;   // latest end of track
+    double       durationMillis;
+    unsigned int tempoChanges;
+};
+
 class MIDIFileReader
 {
 public:
-    MIDIFileReader(std::string path);
+    MIDIFileReader(std::string path,
+                   const MIDIParseOptions &options = MIDIParseOptions());
+
+    // Parse directly from a caller's buffer (an mmap region, an
+    // embedded resource...).  The bytes are not copied, so they must
+    // stay valid for the lifetime of the reader - unless they're
+    // gzipped, in which case they're inflated into a buffer of our own.
+    MIDIFileReader(const void *data, size_t size,
+                   const MIDIParseOptions &options = MIDIParseOptions());
+
+    // Read the rest of a stream into memory and parse that.
+    MIDIFileReader(std::istream &in,
+                   const MIDIParseOptions &options = MIDIParseOptions());
+
     virtual ~MIDIFileReader();
 
+    // Not copyable: m_data may point into our own m_buffer.
+    MIDIFileReader(const MIDIFileReader &) = delete;
+    MIDIFileReader &operator=(const MIDIFileReader &) = delete;
+
     virtual bool isOK() const;
     virtual std::string getError() const;
+    MIDIParseResult getParseResult() const { return m_result; }
+
+    // Parse without keeping anything or printing anything, just to
+    // find out whether (and where) the data is broken.
+    static MIDIParseResult check(const void *data, size_t size);
 
     virtual MIDIComposition load() const;
+    const MIDIComposition &getComposition() const; // without the copy
 
     MIDIConstants::MIDIFileFormatType getFormat() const { return m_format; }
     int getTimingDivision() const { return m_timingDivision; }
+    const std::map<int, std::string> &getTrackNames() const { return m_trackNames; }
+
+    // Read just the header and hop from chunk header to chunk header,
+    // for cataloguing.  With scanMeta the tracks are read too, but only
+    // meta events are looked at - channel data is skipped over.
+    // Gzipped data is inflated first, under options.maxAllocatedBytes;
+    // nothing else in the options matters here.
+    static MIDIParseResult probe(const std::string &path,
+                                 MIDIProbeInfo &info,
+                                 bool scanMeta = false,
+                                 const MIDIParseOptions &options = MIDIParseOptions());
+    static MIDIParseResult probe(const void *data, size_t size,
+                                 MIDIProbeInfo &info,
+                                 bool scanMeta = false,
+                                 const MIDIParseOptions &options = MIDIParseOptions());
+
+    // Decode a single track from the contents of its MTrk chunk (the
+    // bytes following the 8-byte chunk header), with absolute times
+    // and consolidated note-offs as for a whole file.  Nothing is
+    // printed; what went wrong is put in result, if given.
+    static bool parseTrackChunk(const std::string &chunkData,
+                                unsigned int trackNum,
+                                MIDITrack &track,
+                                MIDIParseResult *result = 0);
 
 protected:
+    MIDIFileReader();
+
 
     bool parseFile();
     bool parseHeader(const std::string &midiHeader);
     bool parseTrack(unsigned int trackNum);
     bool consolidateNoteOffEvents(unsigned int track);
+    void finaliseTrack(unsigned int track);
 
     // Internal convenience functions
     //
@@ -73,20 +255,81 @@ protected:
 
     bool skipToNextTrack();
 
+    // The track decoder, driven by a table indexed by status byte
+    //
+    enum StatusClass {
+        MIDI_STATUS_DATA,       // running status
+        MIDI_STATUS_CHANNEL,
+        MIDI_STATUS_SYSEX,
+        MIDI_STATUS_META,
+        MIDI_STATUS_SYSTEM      // not allowed in files, skipped
+    };
+
+    typedef bool (MIDIFileReader::*EventHandler)(MIDITrack &events,
+                                                 unsigned int trackNum,
+                                                 unsigned long deltaTime,
+                                                 unsigned long time,
+                                                 MIDIByte eventCode,
+                                                 MIDIByte data1);
+    struct StatusInfo {
+        unsigned char dataBytes;
+        unsigned char statusClass;
+        EventHandler  handler;
+    };
+
+    static const StatusInfo m_statusTable[256];
+
+    template <int DataBytes>
+    bool channelEvent(MIDITrack &, unsigned int, unsigned long, unsigned long, MIDIByte, MIDIByte);
+    bool metaEvent(MIDITrack &, unsigned int, unsigned long, unsigned long, MIDIByte, MIDIByte);
+    bool sysExEvent(MIDITrack &, unsigned int, unsigned long, unsigned long, MIDIByte, MIDIByte);
+    bool skipEvent(MIDITrack &, unsigned int, unsigned long, unsigned long, MIDIByte, MIDIByte);
+
+    bool readByte(MIDIByte &byte);
+    unsigned long readDeltaTime();
+
+    bool withinLimits(const MIDITrack &events, unsigned int eventCount);
+    bool payloadAllowed(unsigned long length);
+
+    bool readStream(std::istream &in);
+    bool inflated(int result);
+    static bool probeHeader(const MIDIByte *header, MIDIProbeInfo &info);
+    static MIDIParseResult probeBytes(const void *data, size_t size,
+                                      MIDIProbeInfo &info, bool scanMeta);
+    static MIDIParseResult probeInflated(const std::vector<char> &buffer,
+                                         int inflateResult,
+                                         MIDIProbeInfo &info, bool scanMeta);
+    static bool scanTrackMeta(const MIDIByte *data, size_t size, int track,
+                              MIDIProbeInfo &info,
+                              std::vector<std::pair<unsigned long, long> > &tempi);
+    static void finishProbe(MIDIProbeInfo &info,
+                            std::vector<std::pair<unsigned long, long> > &tempi);
+    void setParseError(MIDIParseError error, const char *format, ...);
+    bool atEnd() const { return m_position >= m_dataSize; }
+    void updateProgress();
+
     int                    m_timingDivision;   // pulses per quarter note
     MIDIConstants::MIDIFileFormatType m_format;
     unsigned int           m_numberOfTracks;
 
     long                   m_trackByteCount;
     bool                   m_decrementCount;
+    size_t                 m_allocatedBytes;   // by tracks finished, and payloads
 
     std::map<int, std::string> m_trackNames;
     MIDIComposition        m_midiComposition;
 
     std::string            m_path;
-    std::ifstream         *m_midiFile;
-    size_t                 m_fileSize;
+    std::vector<char>      m_buffer;    // only used if we read the data ourselves
+    const MIDIByte        *m_data;
+    size_t                 m_dataSize;
+    size_t                 m_position;
     std::string            m_error;
+
+    MIDIParseOptions       m_options;
+    MIDIParseResult        m_result;
+    int                    m_currentTrack;
+    bool                   m_failed;
 };
 
 
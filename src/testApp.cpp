@@ -8,8 +8,7 @@ void testApp::setup(){
 	//midiFileName = "../../../data/entertainer.mid";
 //	midiFileName = "/Users/andrew/Music/Logic/GreenOnionsChichester/GreenOnionsChichester/Bouncing/GreenOnionsMain.mid";
 	midiFileName = "/Users/andrew/Music/Logic/GreenOnionsChichester/GreenOnionsChichester/Bouncing/main2_redone.mid";
-	loader.loadFile(midiFileName);
-	loader.printNoteData();
+	currentLoad = loader.loadFileAsync(midiFileName);//printNoteData once it arrives in update()
 	
 	
 	//loader.filterMidiEvents();
@@ -25,11 +24,69 @@ void testApp::setup(){
 
 //--------------------------------------------------------------
 void testApp::update(){
+	if (loader.update()){
+		watcher.watch(loader.getScore()->path);//hashes the file on a worker thread, not here
+		loader.printNoteData();
+	}
+	
+	if (currentLoad && currentLoad->isFinished())
+		currentLoad.reset();
+	
+	watcher.update();
+	
+	//rebuild the piano roll whenever a new score (or a reload) has been published
+	MIDIScorePtr score = loader.getScore();
+	if (score && score != pianoRollScore){
+		pianoRoll.build(*score);
+		if (!pianoRollScore || pianoRollScore->path != score->path){
+			viewStartTicks = 0;
+			ticksPerPixel = max(1.0, pianoRoll.getLengthTicks() / (double)ofGetWidth());
+		}
+		pianoRollScore = score;
+	}
 }
 
 //--------------------------------------------------------------
 void testApp::draw(){
+	drawPianoRoll();
+	
+	if (currentLoad){
+		ofSetColor(255);
+		ofDrawBitmapString("loading " + ofToString((int)(100 * currentLoad->getFraction())) + "%, track "
+						   + ofToString((int)currentLoad->getTracksDone()) + " of " + ofToString((int)currentLoad->getTotalTracks()), 20, 20);
+	}
+}
+
+//only visits the cells on screen, at the level that matches the zoom
+void testApp::drawPianoRoll(){
+	if (pianoRoll.getNumLevels() == 0 || pianoRoll.highestPitch < pianoRoll.lowestPitch)
+		return;
 	
+	int level = pianoRoll.levelForZoom(ticksPerPixel);
+	long cellTicks = pianoRoll.getTicksPerCell(level);
+	int firstColumn = max(0, (int)(viewStartTicks / cellTicks));
+	int lastColumn = min(pianoRoll.getColumns(level) - 1, (int)((viewStartTicks + ofGetWidth() * ticksPerPixel) / cellTicks));
+	float rowHeight = ofGetHeight() / (float)(pianoRoll.highestPitch - pianoRoll.lowestPitch + 1);
+	
+	ofFill();
+	for (int pitch = pianoRoll.lowestPitch; pitch <= pianoRoll.highestPitch; pitch++){
+		const uint8_t* row = pianoRoll.getRow(level, pitch);
+		float y = (pianoRoll.highestPitch - pitch) * rowHeight;
+		
+		for (int c = firstColumn; c <= lastColumn; c++){
+			if (!row[c])
+				continue;
+			int end = c;//draw runs of the same velocity as one rect
+			while (end < lastColumn && row[end+1] == row[c])
+				end++;
+			
+			float x = (c * cellTicks - viewStartTicks) / ticksPerPixel;
+			float width = max(1.0, (end + 1 - c) * cellTicks / ticksPerPixel);
+			ofSetColor(row[c] * 2, 80, 255 - row[c] * 2);
+			ofRect(x, y, width, max(1.0f, rowHeight - 1));
+			c = end;
+		}
+	}
 }
 
 //--------------------------------------------------------------
@@ -38,6 +95,16 @@ void testApp::keyPressed(int key){
 	if (key == 'o'){
 		openMidiFile();
 	}
+	
+	//zoom and scroll the piano roll
+	if (key == '=')
+		ticksPerPixel = max(0.01, ticksPerPixel / 2);
+	if (key == '-')
+		ticksPerPixel *= 2;
+	if (key == OF_KEY_RIGHT)
+		viewStartTicks += ofGetWidth() * ticksPerPixel / 4;
+	if (key == OF_KEY_LEFT)
+		viewStartTicks = max(0.0, viewStartTicks - ofGetWidth() * ticksPerPixel / 4);
 }
 
 //--------------------------------------------------------------
@@ -79,7 +146,9 @@ void testApp::openMidiFile(){
 	
 	if (getFilenameFromDialogBox(filePtr)){
 		printf("Midifile: Loaded name okay :\n'%s' \n", midiFileName.c_str());
-		loader.loadFile(midiFileName);
+		if (currentLoad)
+			currentLoad->cancel();//only the newest piece matters
+		currentLoad = loader.loadFileAsync(midiFileName);
 	}
 	
 }
@@ -4,6 +4,8 @@
 #include "ofMain.h"
 
 #include "MIDIFileLoader.h"
+#include "MIDIFileWatcher.h"
+#include "MIDIPianoRoll.h"
 #include "ofxFileDialogOSX.h"
 
 #include <iostream>
@@ -13,6 +15,8 @@
 class testApp : public ofBaseApp{
     
 public:
+    testApp() : watcher(loader), viewStartTicks(0), ticksPerPixel(1) {}
+    
     void setup();
     void update();
     void draw();
@@ -28,9 +32,17 @@ public:
 	bool getFilenameFromDialogBox(string* fileNameToSave);
     
 	void openMidiFile();
+	void drawPianoRoll();
 	
 	std::string midiFileName;
 	MIDIFileLoader loader;
+	MIDIFileWatcher watcher;//reloads changed tracks when the file is saved again
+	MIDIAsyncLoadPtr currentLoad;
+	
+	MIDIPianoRoll pianoRoll;
+	MIDIScorePtr pianoRollScore;//what pianoRoll was built from
+	double viewStartTicks;
+	double ticksPerPixel;
 };
 
 #endif
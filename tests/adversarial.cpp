@@ -0,0 +1,538 @@
+/*
+ *  adversarial.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+//hostile standard MIDI files, generated here rather than kept as data
+//each is parsed under a stopwatch and a count of the heap in use, and has to finish
+//inside a time bound and a peak memory bound worked out from what the parse is allowed to keep
+
+#include "MIDIFileLoader.h"
+#include "MIDIArchive.h"
+#include "MIDISeekIndex.h"
+#include "MIDITokenizer.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <cstdlib>
+#include <sstream>
+#include <new>
+#include <atomic>
+
+//every allocation goes through here, with its size in front so the frees can be counted too
+//atomic, as the archive cases read on several threads at once
+static std::atomic<size_t> heapInUse(0);
+static std::atomic<size_t> heapPeak(0);
+
+void* operator new(size_t size){
+	size_t* block = (size_t*)malloc(size + 16);
+	if (!block)
+		throw std::bad_alloc();
+	block[0] = size;
+	size_t inUse = heapInUse += size;
+	size_t peak = heapPeak.load();
+	while (inUse > peak && !heapPeak.compare_exchange_weak(peak, inUse)){}
+	return block + 2;
+}
+
+void operator delete(void* p) noexcept{
+	if (!p)
+		return;
+	size_t* block = (size_t*)p - 2;
+	heapInUse -= block[0];
+	free(block);
+}
+
+void* operator new[](size_t size){ return operator new(size); }
+void operator delete[](void* p) noexcept{ operator delete(p); }
+
+
+static int failures = 0;
+static const size_t MB = 1 << 20;
+
+static void check(bool ok, const char* name, const char* what){
+	if (!ok){
+		printf("FAILED: %s - %s\n", name, what);
+		failures++;
+	}
+}
+
+//times one case and measures the most it had on the heap over what was there before it started
+class Measure{
+public:
+	Measure(const char* name) : name(name){
+		base = heapInUse;
+		heapPeak = base;
+		start = std::chrono::steady_clock::now();
+	}
+
+	void finish(double maxMillis, size_t maxBytes){
+		double millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		size_t peak = heapPeak - base;
+		printf("%-28s %8.1f ms (bound %.0f)  %8.1f MB peak (bound %.1f)\n", name, millis, maxMillis, peak / (double)MB, maxBytes / (double)MB);
+		check(millis <= maxMillis, name, "over the time bound");
+		check(peak <= maxBytes, name, "over the memory bound");
+	}
+
+private:
+	const char* name;
+	size_t base;
+	std::chrono::steady_clock::time_point start;
+};
+
+
+//building the files
+
+static void put32(std::string& s, uint32_t v){
+	s += (char)(v >> 24);
+	s += (char)(v >> 16);
+	s += (char)(v >> 8);
+	s += (char)v;
+}
+
+static void putVariable(std::string& s, uint32_t v){
+	char bytes[5];
+	int n = 0;
+	bytes[n++] = v & 0x7F;
+	while (v >>= 7)
+		bytes[n++] = (v & 0x7F) | 0x80;
+	while (n > 0)
+		s += bytes[--n];
+}
+
+static std::string header(int tracks, int ppq = 480){
+	std::string s("MThd", 4);
+	put32(s, 6);
+	s += std::string("\0\1", 2);
+	s += (char)(tracks >> 8);
+	s += (char)tracks;
+	s += (char)(ppq >> 8);
+	s += (char)ppq;
+	return s;
+}
+
+static std::string chunk(const char* type, const std::string& body){
+	std::string s(type, 4);
+	put32(s, body.size());
+	return s + body;
+}
+
+static std::string endOfTrack(){
+	return std::string("\0\xFF\x2F\0", 4);
+}
+
+static size_t eventCount(const MIDIFileReader& reader){
+	size_t n = 0;
+	const MIDIComposition& c = reader.getComposition();
+	for (MIDIComposition::const_iterator i = c.begin(); i != c.end(); ++i)
+		n += i->second.size();
+	return n;
+}
+
+static MIDIParseOptions quiet(){
+	MIDIParseOptions options;
+	options.quiet = true;
+	return options;
+}
+
+
+//thousands of note-ons that never get a note-off, over every channel and pitch
+//each is held to the end of the track, which is the expensive case for pairing
+static void unreleasedNotes(){
+	const int notes = 200000;
+	std::string track;
+	for (int i = 0; i < notes; i++){
+		track += (char)1;
+		track += (char)(0x90 | (i % 16));
+		track += (char)((i / 16) % 128);
+		track += (char)64;
+	}
+	track += endOfTrack();
+	std::string file = header(1) + chunk("MTrk", track);
+
+	{
+		Measure measure("unreleased note-ons");
+		MIDIFileReader reader(file.data(), file.size(), quiet());
+		check(reader.isOK(), "unreleased note-ons", "didn't parse");
+		check(eventCount(reader) == notes + 1, "unreleased note-ons", "lost notes");
+		//the reserve (a third of the track bytes), pairing scratch, and room for slack
+		measure.finish(1000, (track.size() / 3) * sizeof(MIDIEvent) + notes * 24 + 4 * MB);
+	}
+
+	//and under a limit too small for them: stopped, within the limit plus pairing scratch
+	{
+		Measure measure("unreleased, 4 MB limit");
+		MIDIParseOptions options = quiet();
+		options.maxAllocatedBytes = 4 * MB;
+		MIDIFileReader reader(file.data(), file.size(), options);
+		check(reader.getParseResult().error == MIDI_PARSE_LIMIT_EXCEEDED, "unreleased, 4 MB limit", "wasn't stopped");
+		measure.finish(1000, 2 * options.maxAllocatedBytes + MB);
+	}
+}
+
+//one pitch struck over and over, all the note-ons first and then all the note-offs,
+//so every note-off has the whole queue ahead of it - then the loader's repeat filter over the result
+static void denseRepeats(){
+	const int notes = 100000;
+	std::string track;
+	track += std::string("\0\x90\x3C\x40", 4);
+	for (int i = 1; i < notes; i++)
+		track += std::string("\0\x3C\x40", 3);//running status, same tick
+	for (int i = 0; i < notes; i++)
+		track += std::string("\1\x3C\0", 3);//note-on at zero velocity is a note-off
+	track += endOfTrack();
+	std::string file = header(1) + chunk("MTrk", track);
+
+	{
+		Measure measure("dense same-pitch repeats");
+		MIDIFileReader reader(file.data(), file.size(), quiet());
+		check(reader.isOK(), "dense same-pitch repeats", "didn't parse");
+		check(eventCount(reader) == notes + 1, "dense same-pitch repeats", "note-offs not all paired");
+		measure.finish(1000, (track.size() / 3) * sizeof(MIDIEvent) + 2 * notes * 24 + 4 * MB);
+	}
+
+	{
+		Measure measure("dense repeats, loaded");
+		MIDIFileLoader loader;
+		loader.printMidiInfo = false;
+		MIDIScorePtr score = loader.loadScore(file.data(), file.size(), "", quiet());
+		check(score && score->notes.size() == notes, "dense repeats, loaded", "didn't load");
+		loader.publishScore(score);
+		loader.filterMidiEvents();
+		check(loader.midiEvents.size() == 1, "dense repeats, loaded", "repeats not filtered");
+		//reader and score side by side, then the loader's working copy
+		measure.finish(2000, (track.size() / 3) * sizeof(MIDIEvent) + notes * (2 * sizeof(noteData) + sizeof(MIDIChannelEvent) * 2 + 48) + 8 * MB);
+	}
+}
+
+//megabytes of chunks that aren't MTrk before the one track - lots of little ones and a big one
+static void junkChunks(){
+	std::string file = header(1);
+	std::string small(8, 'x');
+	for (int i = 0; i < 250000; i++)
+		file += chunk("JUNK", small);
+	file += chunk("JUNK", std::string(4 * MB, 'y'));
+	file += chunk("MTrk", std::string("\0\x90\x3C\x40\x60\x80\x3C\0", 8) + endOfTrack());
+
+	{
+		Measure measure("junk chunks, in place");
+		MIDIFileReader reader(file.data(), file.size(), quiet());
+		check(reader.isOK() && eventCount(reader) == 2, "junk chunks, in place", "track not found");
+		measure.finish(1000, MB);//the caller's bytes aren't copied, nothing to keep but the track
+	}
+
+	{
+		std::istringstream stream(file);
+		Measure measure("junk chunks, from a stream");
+		MIDIFileReader reader(stream, quiet());
+		check(reader.isOK() && eventCount(reader) == 2, "junk chunks, from a stream", "track not found");
+		measure.finish(1000, file.size() + MB);//one copy of the data
+	}
+
+	{
+		std::istringstream stream(file);
+		Measure measure("junk chunks, stream over limit");
+		MIDIParseOptions options = quiet();
+		options.maxAllocatedBytes = 2 * MB;
+		MIDIFileReader reader(stream, options);
+		check(reader.getParseResult().error == MIDI_PARSE_LIMIT_EXCEEDED, "junk chunks, stream over limit", "wasn't refused");
+		measure.finish(1000, MB);//refused before it was read
+	}
+}
+
+//lengths that claim far more than is there - none of them should cost anything
+static void hugeLengths(){
+	{
+		//a track chunk claiming 2GB in a 26 byte file
+		std::string file = header(1) + std::string("MTrk\x7F\xFF\xFF\xF0\0\x90\x3C\x40", 12);
+		Measure measure("huge MTrk length");
+		MIDIFileReader reader(file.data(), file.size(), quiet());
+		measure.finish(100, MB);
+	}
+	{
+		//a junk chunk claiming 4GB
+		std::string file = header(1) + std::string("JUNK\xFF\xFF\xFF\xFF", 8);
+		Measure measure("huge junk chunk length");
+		MIDIFileReader reader(file.data(), file.size(), quiet());
+		check(!reader.isOK(), "huge junk chunk length", "found a track that isn't there");
+		measure.finish(100, MB);
+	}
+	{
+		//a delta time that never ends
+		std::string file = header(1) + chunk("MTrk", std::string(64, '\xFF'));
+		Measure measure("endless VLQ");
+		MIDIFileReader reader(file.data(), file.size(), quiet());
+		check(reader.getParseResult().error == MIDI_PARSE_INVALID_EVENT, "endless VLQ", "wasn't rejected");
+		measure.finish(100, MB);
+	}
+	{
+		//meta and sysex messages claiming 256MB, the most a four byte VLQ can say
+		std::string meta("\0\xFF\x01", 3);
+		std::string sysex("\0\xF0", 2);
+		putVariable(meta, 0x0FFFFFFF);
+		putVariable(sysex, 0x0FFFFFFF);
+		std::string metaFile = header(1) + chunk("MTrk", meta + std::string(16, 'z'));
+		std::string sysexFile = header(1) + chunk("MTrk", sysex + std::string(16, 'z'));
+		Measure measure("huge meta and sysex lengths");
+		MIDIFileReader metaReader(metaFile.data(), metaFile.size(), quiet());
+		MIDIFileReader sysexReader(sysexFile.data(), sysexFile.size(), quiet());
+		check(metaReader.getParseResult().error == MIDI_PARSE_LIMIT_EXCEEDED, "huge meta and sysex lengths", "meta length not refused");
+		check(sysexReader.getParseResult().error == MIDI_PARSE_LIMIT_EXCEEDED, "huge meta and sysex lengths", "sysex length not refused");
+		measure.finish(100, MB);
+	}
+}
+
+//an 0xF7 escape holding what looks like a note-on - its bytes are data, not events
+static void escapedBytes(){
+	std::string file = header(1) + chunk("MTrk", std::string("\0\xF7\x04\0\x91\x30\xF7", 7) + endOfTrack());
+	Measure measure("escaped note-on");
+	MIDIFileReader reader(file.data(), file.size(), quiet());
+	check(reader.isOK(), "escaped note-on", "didn't parse");
+	const MIDIComposition& c = reader.getComposition();
+	for (MIDIComposition::const_iterator i = c.begin(); i != c.end(); ++i)
+		for (size_t j = 0; j < i->second.size(); j++)
+			check(i->second[j].getMessageType() != MIDIConstants::MIDI_NOTE_ON, "escaped note-on", "phantom note from the escaped bytes");
+	measure.finish(100, MB);
+}
+
+//a few controllers 2^28 ticks apart at one tick per quarter - seeking mustn't cost anything for the empty bars
+static void sparseTicks(){
+	const int controllers = 7;
+	std::string track;
+	for (int i = 0; i < controllers; i++){
+		putVariable(track, 0x0FFFFFFF);
+		track += std::string("\xB0\x07", 2);
+		track += (char)(i + 1);
+	}
+	track += endOfTrack();
+	std::string file = header(1, 1) + chunk("MTrk", track);
+
+	Measure measure("sparse seek index");
+	MIDIFileLoader loader;
+	loader.printMidiInfo = false;
+	MIDIScorePtr score = loader.loadScore(file.data(), file.size(), "", quiet());
+	check(score && score->channelEvents.size() == controllers, "sparse seek index", "didn't load");
+	if (score){
+		MIDISeekIndex index;
+		index.build(score);
+		MIDIPlaybackState state;
+		index.stateAt(score->channelEvents.back().ticks, state);
+		check(state.channels[0].controllers[7] == controllers, "sparse seek index", "wrong state at the end");
+		index.stateAt(score->channelEvents.back().ticks - 1, state);
+		check(state.channels[0].controllers[7] == controllers - 1, "sparse seek index", "wrong state before the end");
+	}
+	measure.finish(100, MB);
+}
+
+//one note 2^28 quarters in - millions of bars and time shifts, but only a small buffer to put them in
+static void sparseTokens(){
+	std::string track;
+	putVariable(track, 0x0FFFFFFF);
+	track += std::string("\x90\x3C\x40", 3);
+	track += endOfTrack();
+	std::string file = header(1, 1) + chunk("MTrk", track);
+
+	Measure measure("sparse ticks, tokenized");
+	std::vector<uint16_t> tokens(1024);
+	MIDITokenizer tokenizer;
+	size_t count = tokenizer.tokenize(file.data(), file.size(), &tokens[0], tokens.size());
+	check(count == tokens.size() && tokenizer.wasTruncated(), "sparse ticks, tokenized", "wasn't cut short");
+	measure.finish(10, MB);
+}
+
+
+//writes deflate bits least significant first, as the format wants
+class BitWriter{
+public:
+	BitWriter() : bits(0), count(0) {}
+
+	void put(uint32_t value, int n){
+		bits |= (uint64_t)value << count;
+		count += n;
+		while (count >= 8){
+			out += (char)(bits & 0xFF);
+			bits >>= 8;
+			count -= 8;
+		}
+	}
+	//Huffman codes go in most significant bit first
+	void putCode(uint32_t code, int n){
+		uint32_t reversed = 0;
+		for (int i = 0; i < n; i++)
+			reversed |= ((code >> i) & 1) << (n - 1 - i);
+		put(reversed, n);
+	}
+	std::string finish(){
+		if (count > 0)
+			out += (char)(bits & 0xFF);
+		bits = 0;
+		count = 0;
+		return out;
+	}
+
+private:
+	uint64_t bits;
+	int count;
+	std::string out;
+};
+
+//a gzip file of one fixed Huffman block: a zero byte, then copies of 258 from one back, 13 bits each
+//about 160 times smaller than what it inflates to
+static std::string gzipBomb(size_t inflatedSize){
+	BitWriter w;
+	w.put(1, 1);//last block
+	w.put(1, 2);//fixed codes
+	w.putCode(0x30, 8);//literal 0
+	for (size_t n = 1; n + 258 <= inflatedSize; n += 258){
+		w.putCode(0xC5, 8);//length code 285, 258 bytes
+		w.putCode(0, 5);//distance code 0, one back
+	}
+	w.putCode(0, 7);//end of block
+	std::string gzip("\x1F\x8B\x08\0\0\0\0\0\0\xFF", 10);
+	gzip += w.finish();
+	gzip += std::string(8, '\0');//CRC and size, never reached
+	return gzip;
+}
+
+static void gzipBombs(){
+	std::string bomb = gzipBomb(1024 * MB);
+	const size_t limit = 16 * MB;
+
+	{
+		Measure measure("gzip bomb, in memory");
+		MIDIParseOptions options = quiet();
+		options.maxAllocatedBytes = limit;
+		MIDIFileReader reader(bomb.data(), bomb.size(), options);
+		check(reader.getParseResult().error == MIDI_PARSE_LIMIT_EXCEEDED, "gzip bomb, in memory", "wasn't stopped");
+		//the inflated buffer tops out one byte over the limit, and holds two copies as it grows
+		measure.finish(1000, 2 * limit + MB);
+	}
+
+	{
+		std::istringstream stream(bomb);
+		Measure measure("gzip bomb, from a stream");
+		MIDIParseOptions options = quiet();
+		options.maxAllocatedBytes = limit;
+		MIDIFileReader reader(stream, options);
+		check(reader.getParseResult().error == MIDI_PARSE_LIMIT_EXCEEDED, "gzip bomb, from a stream", "wasn't stopped");
+		measure.finish(1000, 2 * limit + MB);
+	}
+
+	{
+		Measure measure("gzip bomb, probed");
+		MIDIParseOptions options = quiet();
+		options.maxAllocatedBytes = limit;
+		MIDIProbeInfo info;
+		MIDIParseResult result = MIDIFileReader::probe(bomb.data(), bomb.size(), info, true, options);
+		check(result.error == MIDI_PARSE_LIMIT_EXCEEDED, "gzip bomb, probed", "wasn't stopped");
+		measure.finish(1000, 2 * limit + MB);
+	}
+}
+
+static void put16le(std::string& s, uint16_t v){
+	s += (char)v;
+	s += (char)(v >> 8);
+}
+
+static void put32le(std::string& s, uint32_t v){
+	put16le(s, (uint16_t)v);
+	put16le(s, (uint16_t)(v >> 16));
+}
+
+//a zip whose directory says each member inflates to 512MB - really a 16 byte stored block,
+//then a megabyte of padding so the compressed size is believable - all sharing the one local header
+static void lyingZip(){
+	const int memberCount = 8;
+	const uint32_t claimed = 512 * MB;
+	std::string data("\1\x10\0\xEF\xFF", 5);
+	data += std::string(16, 'm');
+	data += std::string(MB, '\0');
+
+	std::string zip;
+	put32le(zip, 0x04034b50);
+	put16le(zip, 20);
+	put16le(zip, 0);//flags
+	put16le(zip, 8);//deflate
+	put32le(zip, 0);//time and date
+	put32le(zip, 0);//crc
+	put32le(zip, data.size());
+	put32le(zip, claimed);
+	put16le(zip, 5);
+	put16le(zip, 0);
+	zip += "a.mid";
+	zip += data;
+
+	uint32_t directoryOffset = zip.size();
+	for (int i = 0; i < memberCount; i++){
+		char name[8];
+		snprintf(name, sizeof(name), "%d.mid", i);
+		put32le(zip, 0x02014b50);
+		put16le(zip, 20);
+		put16le(zip, 20);
+		put16le(zip, 0);
+		put16le(zip, 8);
+		put32le(zip, 0);
+		put32le(zip, 0);
+		put32le(zip, data.size());
+		put32le(zip, claimed);
+		put16le(zip, 5);
+		put16le(zip, 0);
+		put16le(zip, 0);//comment
+		put16le(zip, 0);//disk
+		put16le(zip, 0);//attributes
+		put32le(zip, 0);
+		put32le(zip, 0);//the local header
+		zip += name;
+	}
+	uint32_t directorySize = zip.size() - directoryOffset;
+	put32le(zip, 0x06054b50);
+	put32le(zip, 0);
+	put16le(zip, memberCount);
+	put16le(zip, memberCount);
+	put32le(zip, directorySize);
+	put32le(zip, directoryOffset);
+	put16le(zip, 0);
+
+	const char* path = "adversarial.zip";
+	{
+		std::ofstream file(path, std::ios::out | std::ios::binary);
+		file.write(zip.data(), zip.size());
+	}
+
+	{
+		Measure measure("lying zip, 4 threads");
+		MIDIZipArchive archive;
+		check(archive.open(path) && archive.getMembers().size() == memberCount, "lying zip, 4 threads", "didn't open");
+		std::atomic<int> rejected(0);
+		archive.readAll(std::vector<size_t>(), [&](size_t, MIDIInflateResult result, const std::vector<char>&){
+			if (result == MIDI_INFLATE_BAD_DATA)
+				rejected++;
+		}, 4, 1024 * MB);
+		check(rejected == memberCount, "lying zip, 4 threads", "members not rejected");
+		//each thread's output buffer stays a first block, plus its input block and the directory
+		measure.finish(1000, 4 * MB);
+	}
+	remove(path);
+}
+
+
+int main(){
+	printf("adversarial files, %d byte events\n", (int)sizeof(MIDIEvent));
+	unreleasedNotes();
+	denseRepeats();
+	junkChunks();
+	hugeLengths();
+	escapedBytes();
+	sparseTicks();
+	sparseTokens();
+	gzipBombs();
+	lyingZip();
+
+	if (failures)
+		return 1;
+	printf("adversarial passed\n");
+	return 0;
+}
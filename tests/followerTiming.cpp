@@ -0,0 +1,103 @@
+/*
+ *  followerTiming.cpp
+ *  ofxMidiFileLoader
+ *
+ *  Copyright 2013 QMUL. All rights reserved.
+ *
+ */
+
+//the score follower on a synthetic performance - slower than written, with dropped and wrong notes
+//checks it keeps up with the piece and that no note costs more than a few microseconds
+
+#include "MIDIScoreFollower.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what){
+	if (!ok){
+		printf("FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+//fixed seed so every run plays the same performance
+static unsigned int seed = 12345;
+static int randomInt(int n){
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) % n;
+}
+
+int main(){
+	const int chordCount = 4000;
+	const double spacing = 250;//score millis between chords
+	const double speed = 0.8;//played at 0.8 of the written tempo
+	const int runs = 5;
+	const double worstAllowed = 20;//micros, per note, least of the runs
+	
+	std::shared_ptr<MIDIScore> score(new MIDIScore());
+	for (int c = 0; c < chordCount; c++){
+		int size = 1 + randomInt(3);
+		for (int k = 0; k < size; k++){
+			noteData note;
+			note.timeMillis = c * spacing + k * 5;
+			note.ticks = c * 120 + k;
+			note.beatPosition = c / 2.0f;
+			note.pitch = 48 + randomInt(36);
+			note.velocity = 80;
+			note.durationTicks = 120;
+			note.durationMillis = spacing;
+			note.channel = 0;
+			note.track = 0;
+			score->notes.push_back(note);
+		}
+	}
+	
+	//the performance - about one note in twenty dropped and one in twenty wrong
+	std::vector<int> pitches;
+	std::vector<double> times;
+	for (size_t i = 0; i < score->notes.size(); i++){
+		int r = randomInt(20);
+		if (r == 0)
+			continue;
+		pitches.push_back(r == 1 ? 48 + randomInt(36) : score->notes[i].pitch);
+		times.push_back(score->notes[i].timeMillis / speed);
+	}
+	
+	MIDIScoreFollower follower;
+	follower.setScore(score);
+	
+	//each note's least time over the runs, so the machine being busy doesn't count against it
+	std::vector<double> micros(pitches.size(), 1e9);
+	for (int run = 0; run < runs; run++){
+		follower.reset();
+		for (size_t i = 0; i < pitches.size(); i++){
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			follower.noteOn(pitches[i], times[i]);
+			double took = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+			micros[i] = std::min(micros[i], took);
+		}
+	}
+	
+	const MIDIFollowEstimate& estimate = follower.getEstimate();
+	double worst = *std::max_element(micros.begin(), micros.end());
+	double total = 0;
+	for (size_t i = 0; i < micros.size(); i++)
+		total += micros[i];
+	
+	printf("%d chords, %d notes played: ended on chord %d, tempo ratio %.3f\n",
+		   (int)follower.getChords().chords.size(), (int)pitches.size(), estimate.chord, estimate.tempoRatio);
+	printf("per note: mean %.3f us, worst %.3f us\n", total / micros.size(), worst);
+	
+	check(estimate.chord >= (int)follower.getChords().chords.size() - 3, "follows the performance to the end");
+	check(estimate.tempoRatio > speed - 0.1 && estimate.tempoRatio < speed + 0.1, "tempo ratio near the played speed");
+	check(worst < worstAllowed, "worst per-note time in bounds");
+	
+	if (failures)
+		return 1;
+	printf("followerTiming passed\n");
+	return 0;
+}